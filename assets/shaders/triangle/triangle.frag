@@ -1,10 +1,28 @@
 #version 450
 
-layout (location = 0) in vec3 inColor;
+// Features are specialization constants, every combination compiles to branch-free code
+layout (constant_id = 0) const int RENDER_MODE = 0;
+layout (constant_id = 1) const bool ALPHA_TEST = false;
+layout (constant_id = 2) const bool FOG = false;
+
+// Additive modes fade to black instead of the fog color
+const int RENDER_MODE_GLOW = 3;
+const int RENDER_MODE_TRANS_ADD = 5;
+
+layout (location = 0) in vec4 inColor;
+layout (location = 1) in vec4 inFog;
 
 layout (location = 0) out vec4 outFragColor;
 
 void main() 
 {
-  outFragColor = vec4(inColor, 1.0);
-}
\ No newline at end of file
+  vec4 color = inColor;
+  if (ALPHA_TEST && color.a < 0.5) {
+    discard;
+  }
+  if (FOG) {
+    vec3 fogColor = (RENDER_MODE == RENDER_MODE_GLOW || RENDER_MODE == RENDER_MODE_TRANS_ADD) ? vec3(0.0) : inFog.rgb;
+    color.rgb = mix(color.rgb, fogColor, inFog.a);
+  }
+  outFragColor = color;
+}
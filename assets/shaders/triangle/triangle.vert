@@ -1,5 +1,16 @@
 #version 450
 
+// Features are specialization constants, every combination compiles to branch-free code
+layout (constant_id = 0) const int RENDER_MODE = 0;
+layout (constant_id = 2) const bool FOG = false;
+layout (constant_id = 3) const bool FULLBRIGHT = false;
+
+// Xash render modes, see ERenderMode
+const int RENDER_MODE_TRANS_COLOR = 1;
+const int RENDER_MODE_TRANS_TEXTURE = 2;
+const int RENDER_MODE_GLOW = 3;
+const int RENDER_MODE_TRANS_ADD = 5;
+
 layout (location = 0) in vec3 inPos;
 layout (location = 1) in vec3 inColor;
 
@@ -8,9 +19,15 @@ layout (binding = 0) uniform UBO
 	mat4 projectionMatrix;
 	mat4 modelMatrix;
 	mat4 viewMatrix;
+	// rgb render color, a render amount
+	vec4 renderColor;
+	vec4 ambientLight;
+	// rgb fog color, a density
+	vec4 fog;
 } ubo;
 
-layout (location = 0) out vec3 outColor;
+layout (location = 0) out vec4 outColor;
+layout (location = 1) out vec4 outFog;
 
 out gl_PerVertex 
 {
@@ -20,6 +37,26 @@ out gl_PerVertex
 
 void main() 
 {
-	outColor = inColor;
-	gl_Position = ubo.projectionMatrix * ubo.viewMatrix * ubo.modelMatrix * vec4(inPos.xyz, 1.0);
+	vec4 color = vec4(inColor, 1.0);
+	if (RENDER_MODE == RENDER_MODE_TRANS_COLOR) {
+		color = ubo.renderColor;
+	} else if (RENDER_MODE == RENDER_MODE_TRANS_TEXTURE || RENDER_MODE == RENDER_MODE_GLOW ||
+	           RENDER_MODE == RENDER_MODE_TRANS_ADD) {
+		color.a = ubo.renderColor.a;
+	}
+	if (!FULLBRIGHT) {
+		color.rgb *= ubo.ambientLight.rgb;
+	}
+	outColor = color;
+
+	vec4 viewPos = ubo.viewMatrix * ubo.modelMatrix * vec4(inPos.xyz, 1.0);
+	// Exponential squared fog, w carries the fraction of the fog color
+	float fogAmount = 0.0;
+	if (FOG) {
+		float fogDistance = length(viewPos.xyz) * ubo.fog.a;
+		fogAmount = 1.0 - clamp(exp(-fogDistance * fogDistance), 0.0, 1.0);
+	}
+	outFog = vec4(ubo.fog.rgb, fogAmount);
+
+	gl_Position = ubo.projectionMatrix * viewPos;
 }
@@ -0,0 +1,29 @@
+# Turn a SPIR-V binary into a constexpr word array, run as: cmake -DINPUT= -DOUTPUT= -DSYMBOL= -P EmbedSpirv.cmake
+file(READ "${INPUT}" SPIRV_HEX HEX)
+string(LENGTH "${SPIRV_HEX}" SPIRV_HEX_LENGTH)
+math(EXPR SPIRV_REMAINDER "${SPIRV_HEX_LENGTH} % 8")
+if (SPIRV_HEX_LENGTH EQUAL 0 OR NOT SPIRV_REMAINDER EQUAL 0)
+    message(FATAL_ERROR "${INPUT} is not a SPIR-V module")
+endif ()
+
+# SPIR-V words are little endian, eight words per line
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1;" SPIRV_WORD_LIST "${SPIRV_HEX}")
+string(REGEX REPLACE ";$" "" SPIRV_WORD_LIST "${SPIRV_WORD_LIST}")
+set(SPIRV_WORDS "")
+set(SPIRV_COLUMN 0)
+foreach (SPIRV_WORD IN LISTS SPIRV_WORD_LIST)
+    if (SPIRV_COLUMN EQUAL 8)
+        string(APPEND SPIRV_WORDS "\n        ")
+        set(SPIRV_COLUMN 0)
+    elseif (NOT SPIRV_WORDS STREQUAL "")
+        string(APPEND SPIRV_WORDS " ")
+    endif ()
+    string(APPEND SPIRV_WORDS "${SPIRV_WORD},")
+    math(EXPR SPIRV_COLUMN "${SPIRV_COLUMN} + 1")
+endforeach ()
+
+file(WRITE "${OUTPUT}.tmp" "// Generated from ${INPUT}, do not edit\n")
+file(APPEND "${OUTPUT}.tmp" "alignas(4) constexpr uint32_t ${SYMBOL}[] = {\n        ${SPIRV_WORDS}\n};\n")
+# Unchanged output keeps the library from recompiling
+file(COPY_FILE "${OUTPUT}.tmp" "${OUTPUT}" ONLY_IF_DIFFERENT)
+file(REMOVE "${OUTPUT}.tmp")
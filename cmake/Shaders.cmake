@@ -0,0 +1,65 @@
+# GLSL compiled at build time, optimized and embedded into the library as constexpr word arrays
+find_program(GLSLC glslc HINTS $ENV{VULKAN_SDK}/bin $ENV{VULKAN_SDK}/Bin)
+find_program(GLSLANG_VALIDATOR glslangValidator HINTS $ENV{VULKAN_SDK}/bin $ENV{VULKAN_SDK}/Bin)
+find_program(SPIRV_OPT spirv-opt HINTS $ENV{VULKAN_SDK}/bin $ENV{VULKAN_SDK}/Bin)
+set(REF_VK_EMBED_SPIRV_SCRIPT ${CMAKE_CURRENT_LIST_DIR}/EmbedSpirv.cmake)
+
+# Every shader under assetDir becomes an entry named by its relative path, e.g. shaders/triangle/triangle.vert
+function(REF_VK_EMBED_SHADERS target assetDir)
+    set(generatedDir ${CMAKE_CURRENT_BINARY_DIR}/generated)
+    file(GLOB_RECURSE shaderSources CONFIGURE_DEPENDS
+            ${assetDir}/*.vert ${assetDir}/*.frag ${assetDir}/*.comp)
+
+    # No .spv files are shipped, the library cannot start without its embedded shaders
+    if (NOT GLSLC AND NOT GLSLANG_VALIDATOR)
+        message(FATAL_ERROR "No GLSL compiler found, install the Vulkan SDK or put glslc on the PATH")
+    endif ()
+
+    set(includes "")
+    set(entries "")
+    set(headers "")
+    foreach (source IN LISTS shaderSources)
+        file(RELATIVE_PATH name ${assetDir} ${source})
+        string(MAKE_C_IDENTIFIER "SPIRV_${name}" symbol)
+        set(spirv ${generatedDir}/${name}.spv)
+        set(header ${generatedDir}/${name}.inc)
+        get_filename_component(outputDir ${spirv} DIRECTORY)
+
+        # Debug info only in debug builds, release modules are stripped by spirv-opt
+        if (GLSLC)
+            set(compileCommand ${GLSLC} ${source} -o ${spirv}.unoptimized $<$<CONFIG:Debug>:-g>)
+        else ()
+            set(compileCommand ${GLSLANG_VALIDATOR} -V ${source} -o ${spirv}.unoptimized $<$<CONFIG:Debug>:-g>)
+        endif ()
+        if (SPIRV_OPT)
+            set(optimizeCommand ${SPIRV_OPT} -O $<$<NOT:$<CONFIG:Debug>>:--strip-debug>
+                    ${spirv}.unoptimized -o ${spirv})
+        else ()
+            set(optimizeCommand ${CMAKE_COMMAND} -E copy ${spirv}.unoptimized ${spirv})
+        endif ()
+
+        add_custom_command(OUTPUT ${header}
+                COMMAND ${CMAKE_COMMAND} -E make_directory ${outputDir}
+                COMMAND ${compileCommand}
+                COMMAND ${optimizeCommand}
+                COMMAND ${CMAKE_COMMAND} -DINPUT=${spirv} -DOUTPUT=${header} -DSYMBOL=${symbol}
+                -P ${REF_VK_EMBED_SPIRV_SCRIPT}
+                DEPENDS ${source} ${REF_VK_EMBED_SPIRV_SCRIPT}
+                COMMENT "Compiling shader ${name}"
+                COMMAND_EXPAND_LISTS
+                VERBATIM)
+
+        string(APPEND includes "#include \"${name}.inc\"\n")
+        string(APPEND entries "        {CShaderLibrary::hash(\"${name}\"), \"${name}\", ${symbol}, sizeof(${symbol})},\n")
+        list(APPEND headers ${header})
+    endforeach ()
+
+    # Included by CShaderLibrary.cpp, the list only changes when shaders are added or removed
+    file(CONFIGURE OUTPUT ${generatedDir}/EmbeddedShaders.inc CONTENT
+            "// Generated by cmake/Shaders.cmake, do not edit\n${includes}
+static constexpr TEmbeddedShader EMBEDDED_SHADERS[] = {\n${entries}        {0, nullptr, nullptr, 0}\n};\n")
+
+    add_custom_target(${target}_shaders DEPENDS ${headers})
+    add_dependencies(${target} ${target}_shaders)
+    target_include_directories(${target} PRIVATE ${generatedDir})
+endfunction(REF_VK_EMBED_SHADERS)
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <common/CJobSystem.h>
+
+
+namespace REF_VK {
+
+    // Slices of the draw list, executed by the primary command buffer in this order
+    enum ECommandBucket {
+        COMMAND_BUCKET_WORLD,
+        COMMAND_BUCKET_STUDIO,
+        COMMAND_BUCKET_TRANSLUCENT,
+        COMMAND_BUCKET_HUD,
+        COMMAND_BUCKET_COUNT
+    };
+
+    typedef std::function<void(VkCommandBuffer commandBuffer)> TRecordFunc;
+
+    // Rendering pass a recording belongs to, render textures use their own ids above the main view
+    const uint32_t MAIN_VIEW_PASS = 0;
+
+    // Records the buckets of a frame into secondary command buffers on the job system.
+    // Every job system thread owns one command pool per frame slot, a pool is only touched by
+    // its thread and reset as a whole once the GPU has finished the slot.
+    class CCommandRecorder {
+    public:
+        // Record calls allowed per frame
+        static const uint32_t MAX_RECORD_JOBS = 64;
+
+        // pipelineStatistics are the statistics of queries active while the buffers execute
+        bool create(VkDevice logicDevice, uint32_t queueFamilyIndex, uint32_t slotCount, CJobSystem *jobs,
+                    VkQueryPipelineStatisticFlags pipelineStatistics = 0);
+
+        void destroy();
+
+        // Reset every pool of the slot, the caller guarantees the GPU is done with it. Every pass of the
+        // frame renders to these formats, so a recorded buffer can execute in any of them.
+        void beginFrame(uint32_t slot, VkFormat colorFormat, VkFormat depthFormat);
+
+        // Queue the recording of one bucket of a pass, the function runs on a job thread inside the pass.
+        // Only called from the thread that created the job system.
+        void record(ECommandBucket bucket, TRecordFunc func, uint32_t pass = MAIN_VIEW_PASS);
+
+        // Wait for the recording jobs of the frame
+        void wait();
+
+        // Execute the recorded buckets of a pass from first to last, in bucket order
+        void execute(VkCommandBuffer primary, uint32_t pass, ECommandBucket firstBucket, ECommandBucket lastBucket);
+
+        // Whether any bucket from first to last of a pass was recorded, empty passes are skipped
+        bool hasRecorded(uint32_t pass, ECommandBucket firstBucket, ECommandBucket lastBucket) const;
+
+    private:
+        typedef struct SRecordEntry {
+            ECommandBucket bucket;
+            uint32_t pass;
+            TRecordFunc func;
+            VkCommandBuffer commandBuffer;
+        } TRecordEntry;
+
+        typedef struct SThreadSlot {
+            VkCommandPool commandPool;
+            // Secondary buffers allocated from the pool, reused after each reset
+            std::vector<VkCommandBuffer> commandBuffers;
+            uint32_t usedCount;
+        } TThreadSlot;
+
+        VkDevice device = VK_NULL_HANDLE;
+        CJobSystem *jobSystem = nullptr;
+        // Indexed by job system thread, then frame slot
+        std::vector<std::vector<TThreadSlot>> threadSlots{};
+        uint32_t currentSlot = 0;
+        // Dynamic rendering, no render pass or framebuffer is inherited
+        VkFormat colorAttachmentFormat = VK_FORMAT_UNDEFINED;
+        VkCommandBufferInheritanceRenderingInfo renderingInheritanceInfo{};
+        VkCommandBufferInheritanceInfo inheritanceInfo{};
+        VkQueryPipelineStatisticFlags inheritedStatistics = 0;
+
+        // Parent of this frame's recording jobs
+        TJob *frameJob = nullptr;
+        std::array<TRecordEntry, MAX_RECORD_JOBS> entries{};
+        uint32_t entryCount = 0;
+
+        VkCommandBuffer acquireCommandBuffer(TThreadSlot &slot);
+
+        void recordEntry(uint32_t index);
+    };
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vulkan/vulkan.hpp>
+#include <common/Typedef.h>
+#include <common/vk_mem_alloc.h>
+
+
+namespace REF_VK {
+
+    // Called with the resource recreated at its new place, owners update views and descriptors here
+    typedef std::function<void(VkBuffer)> TBufferMovedFunc;
+    typedef std::function<void(VkImage)> TImageMovedFunc;
+    // Submit the recorded copies and block until they are done
+    typedef std::function<bool(VkCommandBuffer)> TSubmitFunc;
+
+    // Compacts device memory with VMA defragmentation. Only registered resources are moved,
+    // everything else (mapped rings, render targets) stays where it is.
+    class CDefragmenter {
+    public:
+        void create(VkDevice logicDevice, VmaAllocator allocator);
+
+        // The resource must own the whole allocation, createInfo is used to recreate it
+        void registerBuffer(VmaAllocation allocation, VkBuffer buffer, const VkBufferCreateInfo &createInfo,
+                            TBufferMovedFunc moved);
+
+        // Image in layout with every mip and layer initialized
+        void registerImage(VmaAllocation allocation, VkImage image, const VkImageCreateInfo &createInfo,
+                           VkImageLayout layout, VkImageAspectFlags aspect, TImageMovedFunc moved);
+
+        // Before the resource is destroyed
+        void unregister(VmaAllocation allocation);
+
+        // Move resources until VMA finds nothing left to compact. The GPU must be idle, moved
+        // resources are destroyed right after their pass. commandBuffer is reused for every pass.
+        bool run(VkCommandBuffer commandBuffer, const TSubmitFunc &submit, TDefragStats *stats);
+
+    private:
+        typedef struct SResource {
+            VkBuffer buffer;
+            VkBufferCreateInfo bufferCI;
+            TBufferMovedFunc bufferMoved;
+            VkImage image;
+            VkImageCreateInfo imageCI;
+            VkImageLayout layout;
+            VkImageAspectFlags aspect;
+            TImageMovedFunc imageMoved;
+        } TResource;
+
+        typedef struct SMove {
+            VmaAllocation allocation;
+            VkBuffer oldBuffer;
+            VkBuffer newBuffer;
+            VkImage oldImage;
+            VkImage newImage;
+        } TMove;
+
+        VkDevice device = VK_NULL_HANDLE;
+        VmaAllocator vmaAllocator = VK_NULL_HANDLE;
+        std::mutex mutex{};
+        std::unordered_map<VmaAllocation, TResource> resources{};
+
+        bool recordBufferMove(VkCommandBuffer commandBuffer, const TResource &resource,
+                              const VmaDefragmentationMove &move, TMove *result);
+
+        bool recordImageMove(VkCommandBuffer commandBuffer, const TResource &resource,
+                             const VmaDefragmentationMove &move, TMove *result);
+    };
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vulkan/vulkan.hpp>
+#include <common/vk_mem_alloc.h>
+
+
+namespace REF_VK {
+
+    enum EDeferredObjectType {
+        DEFERRED_BUFFER,
+        DEFERRED_IMAGE,
+        DEFERRED_IMAGE_VIEW,
+        DEFERRED_SAMPLER,
+        DEFERRED_PIPELINE,
+        DEFERRED_DESCRIPTOR_SET,
+        DEFERRED_FRAMEBUFFER,
+        DEFERRED_SHADER_MODULE,
+        DEFERRED_SEMAPHORE,
+        DEFERRED_SWAPCHAIN,
+    };
+
+    typedef struct SDeferredObject {
+        // Last frame that may still use the object
+        uint64_t frame;
+        EDeferredObjectType type;
+        union {
+            VkBuffer buffer;
+            VkImage image;
+            VkImageView imageView;
+            VkSampler sampler;
+            VkPipeline pipeline;
+            VkDescriptorSet descriptorSet;
+            VkFramebuffer frameBuffer;
+            VkShaderModule shaderModule;
+            VkSemaphore semaphore;
+            VkSwapchainKHR swapchain;
+        };
+        // Owner memory or pool, depending on the type
+        VmaAllocation allocation;
+        VkDescriptorPool descriptorPool;
+    } TDeferredObject;
+
+    // Central queue of objects waiting for the frames that use them to finish on the GPU.
+    // Entries are keyed by frame number and released lazily at the start of each frame.
+    class CDeletionQueue {
+    public:
+        void setContext(VkDevice logicDevice, VmaAllocator allocator);
+
+        void destroyBuffer(VkBuffer buffer, VmaAllocation allocation, uint64_t frame);
+
+        void destroyImage(VkImage image, VmaAllocation allocation, uint64_t frame);
+
+        void destroyImageView(VkImageView imageView, uint64_t frame);
+
+        void destroySampler(VkSampler sampler, uint64_t frame);
+
+        void destroyPipeline(VkPipeline pipeline, uint64_t frame);
+
+        // The pool must be created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+        void freeDescriptorSet(VkDescriptorPool pool, VkDescriptorSet descriptorSet, uint64_t frame);
+
+        void destroyFramebuffer(VkFramebuffer frameBuffer, uint64_t frame);
+
+        void destroyShaderModule(VkShaderModule shaderModule, uint64_t frame);
+
+        void destroySemaphore(VkSemaphore semaphore, uint64_t frame);
+
+        void destroySwapchain(VkSwapchainKHR swapchain, uint64_t frame);
+
+        // Destroy every object whose frame has completed, returns the number released
+        uint32_t flush(uint64_t completedFrame);
+
+        void flushAll();
+
+        size_t pendingCount();
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        VmaAllocator vmaAllocator = VK_NULL_HANDLE;
+        std::mutex mutex{};
+        std::deque<TDeferredObject> pending{};
+
+        void push(const TDeferredObject &object);
+
+        void release(const TDeferredObject &object);
+    };
+
+}
@@ -29,7 +29,8 @@ namespace REF_VK {
 
         VkResult createLogicalDevice(VkPhysicalDeviceFeatures enableFeatures, std::vector<const char*> enableExtensions,
                                      void *pNextChain, bool useSwapChain = true,
-                                     VkQueueFlags requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+                                     VkQueueFlags requestedQueueTypes =
+                                     VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
 
 //    private:
         uint32_t getQueueFamilyIndex(VkQueueFlags queueFlags);
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace REF_VK {
+
+    // Read only bytes of a file, points straight into the mapping
+    typedef struct SFileSpan {
+        const uint8_t *data;
+        size_t size;
+    } TFileSpan;
+
+    // A whole file mapped read only, unmapped on close or destruction
+    class CMappedFile {
+    public:
+        CMappedFile() = default;
+
+        ~CMappedFile();
+
+        CMappedFile(const CMappedFile &) = delete;
+
+        CMappedFile &operator=(const CMappedFile &) = delete;
+
+        bool open(const std::string &path);
+
+        void close();
+
+        TFileSpan getSpan() const;
+
+    private:
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+#if defined(_WIN32)
+        void *mapping = nullptr;
+#endif
+    };
+
+    // Read only virtual file system over loose directories and PAK / PK3 archives. Every file of a
+    // mount is entered into one hashed index, later mounts override earlier ones like game directories
+    // do. Files are never copied, open hands out spans into the mappings.
+    class CFileSystem {
+    public:
+        ~CFileSystem();
+
+        // Directories are walked recursively, archives are recognized by their header.
+        // An underlay only adds files no other mount provides, whenever it is mounted.
+        bool mount(const std::string &path, bool underlay = false);
+
+        bool mountDirectory(const std::string &path, bool underlay = false);
+
+        bool mountArchive(const std::string &path, bool underlay = false);
+
+        // Invalidates every span handed out so far
+        void unmountAll();
+
+        // Paths are case insensitive and accept either slash. The span stays valid until unmountAll.
+        bool open(const char *path, TFileSpan *span);
+
+        bool exists(const char *path) const;
+
+        size_t getFileCount() const;
+
+    private:
+        typedef struct SEntry {
+            // Normalized path, compared when two paths share a hash
+            std::string name;
+            // Loose file, mapped on first open
+            std::string diskPath;
+            std::unique_ptr<CMappedFile> looseFile;
+            // Archive member, offset into the archive's mapping
+            int32_t archive;
+            size_t offset;
+            size_t size;
+        } TEntry;
+
+        mutable std::mutex mutex{};
+        std::vector<std::unique_ptr<CMappedFile>> archives{};
+        std::vector<TEntry> entries{};
+        // Path hash to entry index
+        std::unordered_map<uint64_t, uint32_t> index{};
+
+        // FNV-1a of the normalized path
+        static uint64_t hashPath(const char *path);
+
+        static std::string normalizePath(const char *path);
+
+        // Adds or overrides, an underlay entry never overrides. Call with the mutex held.
+        void insertEntry(TEntry &&entry, bool underlay);
+
+        const TEntry *findEntry(const char *path) const;
+
+        bool indexPak(const TFileSpan &archive, int32_t archiveIndex, const std::string &path, bool underlay);
+
+        bool indexPk3(const TFileSpan &archive, int32_t archiveIndex, const std::string &path, bool underlay);
+    };
+
+}
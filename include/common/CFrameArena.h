@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+namespace REF_VK {
+
+    // Bump allocator for everything built and thrown away within one frame: draw lists,
+    // sort keys, visible surfaces, entity buckets. Allocation is lock free from any thread,
+    // reset releases everything at once and no destructors are run.
+    class CFrameArena {
+    public:
+        bool create(size_t capacity);
+
+        void destroy();
+
+        // Never fails, past the block it falls back to the heap until the next reset grows it
+        void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+        template<typename T>
+        T *allocateArray(size_t count) {
+            return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        template<typename T, typename... TArgs>
+        T *create(TArgs &&... args) {
+            return new(allocate(sizeof(T), alignof(T))) T(std::forward<TArgs>(args)...);
+        }
+
+        // Only when no allocation of this frame is referenced anymore
+        void reset();
+
+        size_t getUsedBytes() const;
+
+        size_t getCapacity() const;
+
+    private:
+        uint8_t *block = nullptr;
+        size_t capacity = 0;
+        std::atomic<size_t> used{0};
+
+        // Requests that did not fit, the block is resized to cover them at reset
+        std::mutex overflowMutex{};
+        std::vector<void *> overflowBlocks{};
+        size_t overflowBytes = 0;
+    };
+
+    // Per thread stack allocator for temporaries inside one function, see CScratchScope
+    class CScratchArena {
+    public:
+        typedef struct SMarker {
+            size_t offset;
+            size_t overflowCount;
+        } TMarker;
+
+        // The calling thread's arena, its block is allocated on first use
+        static CScratchArena &get();
+
+        ~CScratchArena();
+
+        void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+        TMarker getMarker() const;
+
+        void rewind(const TMarker &marker);
+
+    private:
+        static const size_t SCRATCH_SIZE = 1024 * 1024;
+
+        uint8_t *block = nullptr;
+        size_t offset = 0;
+        std::vector<void *> overflowBlocks{};
+    };
+
+    // Everything allocated from the thread's scratch arena while the scope lives is freed with it
+    class CScratchScope {
+    public:
+        CScratchScope() : arena(CScratchArena::get()), marker(arena.getMarker()) {}
+
+        ~CScratchScope() {
+            arena.rewind(marker);
+        }
+
+        CScratchScope(const CScratchScope &) = delete;
+
+        CScratchScope &operator=(const CScratchScope &) = delete;
+
+        CScratchArena *getArena() {
+            return &arena;
+        }
+
+    private:
+        CScratchArena &arena;
+        CScratchArena::TMarker marker;
+    };
+
+    // STL allocator over an arena, deallocation is a no-op until the arena is reset or rewound
+    template<typename T, typename TArena = CFrameArena>
+    class TArenaAllocator {
+    public:
+        typedef T value_type;
+
+        explicit TArenaAllocator(TArena *owner) noexcept: arena(owner) {}
+
+        template<typename U>
+        TArenaAllocator(const TArenaAllocator<U, TArena> &other) noexcept: arena(other.arena) {}
+
+        T *allocate(size_t count) {
+            return static_cast<T *>(arena->allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        void deallocate(T *, size_t) noexcept {}
+
+        template<typename U>
+        bool operator==(const TArenaAllocator<U, TArena> &other) const noexcept {
+            return arena == other.arena;
+        }
+
+        template<typename U>
+        bool operator!=(const TArenaAllocator<U, TArena> &other) const noexcept {
+            return arena != other.arena;
+        }
+
+    private:
+        template<typename U, typename UArena>
+        friend class TArenaAllocator;
+
+        TArena *arena;
+    };
+
+    template<typename T>
+    using TFrameVector = std::vector<T, TArenaAllocator<T, CFrameArena>>;
+
+    template<typename T>
+    using TScratchVector = std::vector<T, TArenaAllocator<T, CScratchArena>>;
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <common/Typedef.h>
+
+
+namespace REF_VK {
+
+    // CPU side frame limiter and latency bookkeeping.
+    // The limiter runs right before the engine samples input, so the sleep shortens
+    // the input to photon time instead of adding to it.
+    class CFramePacer {
+    public:
+        void setMaxFps(int fps);
+
+        // Sleep until the next frame may start
+        void limit();
+
+        void markInputSample(uint64_t frame);
+
+        bool hasInputSample(uint64_t frame) const;
+
+        void markAcquire(uint64_t frame);
+
+        void markPresent(uint64_t frame);
+
+        // Presentation finished, reported by VK_KHR_present_wait
+        void markDisplayed(uint64_t frame);
+
+        void setPresentWait(bool enable);
+
+        const TLatencyStats &getStats() const;
+
+    private:
+        typedef std::chrono::steady_clock TClock;
+
+        typedef struct SFrameTimes {
+            uint64_t frame;
+            TClock::time_point inputSample;
+            TClock::time_point acquire;
+            TClock::time_point present;
+        } TFrameTimes;
+
+        static const uint32_t HISTORY_SIZE = 8;
+
+        TClock::duration targetFrameTime{};
+        TClock::time_point lastFrameStart{};
+        std::array<TFrameTimes, HISTORY_SIZE> history{};
+        TLatencyStats stats{};
+
+        TFrameTimes &times(uint64_t frame);
+    };
+
+}
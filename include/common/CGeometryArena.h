@@ -0,0 +1,111 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <common/vk_mem_alloc.h>
+#include <common/CUploader.h>
+#include <common/CDeletionQueue.h>
+#include <common/CDefragmenter.h>
+
+
+namespace REF_VK {
+
+    // Stable reference to a mesh, survives compaction, 0 is never a valid handle
+    typedef uint32_t TGeometryHandle;
+    const TGeometryHandle INVALID_GEOMETRY = 0;
+
+    // All meshes of one vertex layout packed into a few big vertex and index buffers.
+    // Ranges are sub-allocated with VMA virtual blocks counted in vertices and indices,
+    // so meshes of a page share one bind and draws differ only by firstIndex and vertexOffset.
+    class CGeometryArena {
+    public:
+        typedef struct SMeshRange {
+            uint32_t page;
+            int32_t vertexOffset;
+            uint32_t vertexCount;
+            uint32_t firstIndex;
+            uint32_t indexCount;
+            // Draws must skip the mesh until the uploader made it available
+            TUploadToken token;
+        } TMeshRange;
+
+        // Pages are registered with the defragmenter when one is given
+        bool create(VmaAllocator allocator, CUploader *meshUploader, uint32_t stride, uint32_t verticesPerPage,
+                    uint32_t indicesPerPage, CDefragmenter *memoryDefragmenter = nullptr);
+
+        void destroy();
+
+        // Sub-allocate and upload a mesh, a new page is opened when the current ones are full
+        TGeometryHandle allocate(const void *vertexData, uint32_t vertexCount, const uint32_t *indexData,
+                                 uint32_t indexCount);
+
+        // Draws stop using the mesh now, its range is reused once frame has finished on the GPU
+        void free(TGeometryHandle handle, uint64_t frame);
+
+        void collect(uint64_t completedFrame);
+
+        // Pack every live mesh into as few fresh pages as possible. The copies are recorded into
+        // commandBuffer, which must be submitted before any draw using the new ranges. Old pages
+        // are released through the deletion queue after frame. False without copies when no mesh
+        // was freed since the last compaction.
+        bool compact(VkCommandBuffer commandBuffer, CDeletionQueue &deletionQueue, uint64_t frame);
+
+        // Copy of the mesh's current range, false for freed or invalid handles
+        bool getRange(TGeometryHandle handle, TMeshRange *range) const;
+
+        // Safe from the recording jobs while the render thread allocates
+        void bindPage(VkCommandBuffer commandBuffer, uint32_t page) const;
+
+        uint32_t getPageCount() const;
+
+        uint32_t getLiveMeshCount() const;
+
+    private:
+        typedef struct SPage {
+            VkBuffer vertexBuffer;
+            VmaAllocation vertexAllocation;
+            VkBuffer indexBuffer;
+            VmaAllocation indexAllocation;
+            VmaVirtualBlock vertexBlock;
+            VmaVirtualBlock indexBlock;
+        } TPage;
+
+        typedef struct SMesh {
+            TMeshRange range;
+            VmaVirtualAllocation vertexRange;
+            VmaVirtualAllocation indexRange;
+            bool live;
+        } TMesh;
+
+        typedef struct SPendingFree {
+            TGeometryHandle handle;
+            uint64_t frame;
+        } TPendingFree;
+
+        VmaAllocator vmaAllocator = VK_NULL_HANDLE;
+        CUploader *uploader = nullptr;
+        CDefragmenter *defragmenter = nullptr;
+        uint32_t vertexStride = 0;
+        uint32_t pageVertices = 0;
+        uint32_t pageIndices = 0;
+
+        mutable std::mutex mutex{};
+        std::vector<TPage> pages{};
+        // Indexed by handle - 1
+        std::vector<TMesh> meshes{};
+        std::vector<TGeometryHandle> freeHandles{};
+        std::vector<TPendingFree> pendingFrees{};
+        // Ranges returned to the pages since the last compaction
+        uint32_t collectedFrees = 0;
+
+        // index is the page's position once it is in use, moved buffers are patched there
+        bool createPage(TPage *page, uint32_t index);
+
+        void destroyPage(TPage &page, CDeletionQueue *deletionQueue, uint64_t frame);
+
+        // Place a range in an existing page or a new one, pages is the list to search
+        bool placeMesh(std::vector<TPage> &targetPages, uint32_t vertexCount, uint32_t indexCount, TMesh *mesh);
+    };
+
+}
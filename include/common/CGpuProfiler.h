@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <vulkan/vulkan.hpp>
+#include <common/Typedef.h>
+#include <common/CDevice.h>
+
+
+namespace REF_VK {
+
+    // Query pool backed GPU profiler, one pool set per frame slot.
+    // Results of a slot are read when the slot is reused, the frame ring latency guarantees
+    // they are ready, so reading never stalls.
+    // Scopes are written into the primary command buffer on the render thread, each at most once per frame.
+    class CGpuProfiler {
+    public:
+        bool create(CDevice *device, uint32_t slotCount);
+
+        void destroy();
+
+        // Resolve the previous use of the slot and reset its queries, must be outside a render pass
+        void beginFrame(VkCommandBuffer commandBuffer, uint32_t slot);
+
+        void beginScope(VkCommandBuffer commandBuffer, EGpuScope scope);
+
+        void endScope(VkCommandBuffer commandBuffer, EGpuScope scope);
+
+        // Statistics secondary command buffers executed inside a scope have to inherit, 0 without statistics
+        VkQueryPipelineStatisticFlags getInheritedStatistics() const;
+
+        const TGpuScopeStats &getScopeStats(EGpuScope scope) const;
+
+        // r_speeds style text, one scope per line
+        bool speedsMessage(char *out, size_t size) const;
+
+    private:
+        typedef struct SQuerySlot {
+            VkQueryPool timestampPool;
+            VkQueryPool statisticsPool;
+            // Queries are uninitialized until the first reset
+            bool recorded;
+        } TQuerySlot;
+
+        // Statistics values per query, see statisticFlags
+        static const uint32_t STATISTIC_COUNT = 3;
+
+        VkDevice device = VK_NULL_HANDLE;
+        float timestampPeriod = 1.0f;
+        uint64_t timestampMask = ~0ull;
+        bool timestampsSupported = false;
+        bool statisticsSupported = false;
+        VkQueryPipelineStatisticFlags statisticFlags = 0;
+
+        std::vector<TQuerySlot> slots{};
+        uint32_t currentSlot = 0;
+        // Statistics queries of the same pool cannot nest, scope owning the active one or -1
+        int statisticsScope = -1;
+        std::array<TGpuScopeStats, GPU_SCOPE_COUNT> scopeStats{};
+
+        void resolveSlot(uint32_t slot);
+    };
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+
+namespace REF_VK {
+
+    // Counts calls to the global operator new per thread. Only builds with REF_VK_HEAP_COUNTER replace
+    // the global allocation functions, elsewhere the count stays zero. On Windows the replacement only
+    // covers allocations made by the renderer DLL itself.
+    class CHeapCounter {
+    public:
+        static bool isEnabled();
+
+        // Allocations of the calling thread, workers and compile threads keep their own count
+        static uint64_t getAllocations();
+    };
+
+}
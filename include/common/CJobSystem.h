@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace REF_VK {
+
+    struct SJob;
+
+    typedef void (*TJobFunc)(SJob *job, void *data);
+
+    // One unit of work. A job is finished when it and all of its children have run,
+    // waiting on a parent therefore waits for the whole tree.
+    typedef struct alignas(64) SJob {
+        TJobFunc func;
+        SJob *parent;
+        std::atomic<int32_t> unfinished;
+        // Small closures live inline, no heap allocation per job
+        alignas(8) unsigned char data[40];
+    } TJob;
+
+    static_assert(sizeof(TJob) == 64, "A job must fill exactly one cache line");
+
+    // Work-stealing scheduler. Every thread, including the engine thread that created it,
+    // owns a job pool and a Chase-Lev deque: pushing and popping its own work never takes a lock,
+    // idle threads steal from the other end of someone else's deque.
+    class CJobSystem {
+    public:
+        // Capacity of each thread's job pool and deque, jobs of a thread are recycled round robin.
+        // Recycling a job that has not finished waits for it.
+        static const uint32_t MAX_JOBS_PER_THREAD = 4096;
+
+        // workerCount threads are started in addition to the calling thread
+        bool create(uint32_t workerCount);
+
+        void destroy();
+
+        // Threads taking part in the work, the creating thread is index 0
+        uint32_t getThreadCount() const;
+
+        // Index of the calling thread, only valid on threads of this system
+        static uint32_t getThreadIndex();
+
+        // Job system the calling thread belongs to, nullptr outside of one
+        static CJobSystem *getCurrent();
+
+        // Jobs are created, run and waited on only by threads of this system
+        TJob *createJob(TJobFunc func, TJob *parent = nullptr);
+
+        // Store a callable in the job, it must fit the inline data and be trivially destructible
+        template<typename TFunc>
+        TJob *createJob(TFunc &&func, TJob *parent = nullptr) {
+            typedef typename std::decay<TFunc>::type TClosure;
+            static_assert(sizeof(TClosure) <= sizeof(TJob::data), "Job closure too large");
+            static_assert(std::is_trivially_destructible<TClosure>::value, "Job closure must be trivially destructible");
+            TJob *job = createJob(&invokeClosure<TClosure>, parent);
+            new(job->data) TClosure(std::forward<TFunc>(func));
+            return job;
+        }
+
+        // Make the job visible to the other threads
+        void run(TJob *job);
+
+        // Help with any work until the job and its children are finished
+        void wait(const TJob *job);
+
+        bool isFinished(const TJob *job) const;
+
+        // Split [0, count) into ranges of at most batchSize and call func(begin, end) on each.
+        // Blocks until every range is done, the calling thread works on ranges as well.
+        template<typename TFunc>
+        void parallelFor(uint32_t count, uint32_t batchSize, const TFunc &func) {
+            if (count == 0) {
+                return;
+            }
+            batchSize = batchSize == 0 ? 1 : batchSize;
+            TParallelForData<TFunc> forData{&func, batchSize};
+            TJob *root = createJob(&parallelForSplit<TFunc>, nullptr);
+            TRange range{0, count, &forData};
+            new(root->data) TRange(range);
+            run(root);
+            wait(root);
+        }
+
+    private:
+        typedef struct alignas(64) SWorkQueue {
+            std::atomic<int64_t> top;
+            // Owner end, padded so thieves reading top do not share its cache line
+            alignas(64) std::atomic<int64_t> bottom;
+            alignas(64) std::atomic<TJob *> jobs[MAX_JOBS_PER_THREAD];
+        } TWorkQueue;
+
+        typedef struct SThreadData {
+            TWorkQueue *queue;
+            TJob *jobPool;
+            uint32_t allocated;
+            uint32_t stealSeed;
+        } TThreadData;
+
+        template<typename TFunc>
+        struct TParallelForData {
+            const TFunc *func;
+            uint32_t batchSize;
+        };
+
+        typedef struct SRange {
+            uint32_t begin;
+            uint32_t end;
+            const void *forData;
+        } TRange;
+
+        std::vector<TThreadData> threads{};
+        std::vector<std::thread> workers{};
+        std::atomic<bool> quit{false};
+
+        // Workers with nothing to do sleep here, run() only touches the mutex when someone sleeps
+        std::mutex sleepMutex{};
+        std::condition_variable wakeUp{};
+        std::atomic<uint32_t> sleeping{0};
+
+        void workerMain(uint32_t threadIndex);
+
+        bool push(TWorkQueue *queue, TJob *job);
+
+        TJob *pop(TWorkQueue *queue);
+
+        TJob *steal(TWorkQueue *queue);
+
+        TJob *getJob();
+
+        void execute(TJob *job);
+
+        void finish(TJob *job);
+
+        template<typename TClosure>
+        static void invokeClosure(TJob *job, void *data) {
+            (*reinterpret_cast<TClosure *>(data))();
+        }
+
+        template<typename TFunc>
+        static void parallelForSplit(TJob *job, void *data);
+    };
+
+    // Ranges larger than the batch split in half into child jobs, leaves call the function
+    template<typename TFunc>
+    void CJobSystem::parallelForSplit(TJob *job, void *data) {
+        const TRange &range = *reinterpret_cast<const TRange *>(data);
+        const auto &forData = *reinterpret_cast<const TParallelForData<TFunc> *>(range.forData);
+
+        if (range.end - range.begin > forData.batchSize) {
+            CJobSystem *jobSystem = getCurrent();
+            uint32_t middle = range.begin + (range.end - range.begin) / 2;
+
+            TJob *left = jobSystem->createJob(&parallelForSplit<TFunc>, job);
+            new(left->data) TRange{range.begin, middle, range.forData};
+            jobSystem->run(left);
+
+            TJob *right = jobSystem->createJob(&parallelForSplit<TFunc>, job);
+            new(right->data) TRange{middle, range.end, range.forData};
+            jobSystem->run(right);
+        } else {
+            (*forData.func)(range.begin, range.end);
+        }
+    }
+
+}
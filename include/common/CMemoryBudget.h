@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vulkan/vulkan.hpp>
+#include <common/Typedef.h>
+#include <common/vk_mem_alloc.h>
+
+
+namespace REF_VK {
+
+    // Heap budgets of the allocator and the memory held by each EMemoryCategory.
+    // Allocations carry their category in pUserData and are named after it, so the
+    // VMA JSON dump shows them too. Counters are process wide, there is one allocator.
+    class CMemoryBudget {
+    public:
+        // Value for VmaAllocationCreateInfo::pUserData
+        static void *tag(EMemoryCategory category);
+
+        // Call right after the allocation was created with a tag
+        static void track(VmaAllocator allocator, VmaAllocation allocation);
+
+        // Call right before the allocation is destroyed, untagged allocations are ignored
+        static void untrack(VmaAllocator allocator, VmaAllocation allocation);
+
+        static TMemoryCategoryStats getCategoryStats(EMemoryCategory category);
+
+        void create(VmaAllocator allocator, bool budgetExtension);
+
+        uint32_t getHeapCount() const;
+
+        bool getHeapStats(uint32_t heap, TMemoryHeapStats *stats) const;
+
+        // Console report, one line per heap then per category
+        bool report(char *out, size_t size) const;
+
+        // Full vmaBuildStatsString output including every allocation
+        bool dumpJson(const std::string &path) const;
+
+    private:
+        static const char *CATEGORY_NAMES[MEMORY_CATEGORY_COUNT];
+        static std::array<std::atomic<uint32_t>, MEMORY_CATEGORY_COUNT> categoryAllocations;
+        static std::array<std::atomic<uint64_t>, MEMORY_CATEGORY_COUNT> categoryBytes;
+
+        VmaAllocator vmaAllocator = VK_NULL_HANDLE;
+        bool budgetSupported = false;
+    };
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vulkan/vulkan.hpp>
+#include <common/Typedef.h>
+#include <common/CDevice.h>
+
+
+namespace REF_VK {
+
+    // VkPipelineCache persisted between runs. The blob is only fed back to the driver when our
+    // header matches the device, driver version and cache UUID, anything else starts empty.
+    class CPipelineCache {
+    public:
+        bool create(CDevice *device, const std::string &filePath);
+
+        // Saves first
+        void destroy();
+
+        // Written to a temporary file and renamed over the old one, a crash never leaves half a cache
+        bool save();
+
+        // Saves when pipelines were compiled since the last save. Reads the whole blob and writes a file,
+        // only for level loads, never per frame.
+        void saveIfDirty();
+
+        // vkCreateGraphicsPipelines with timing and creation feedback, safe from any thread
+        VkResult createGraphicsPipeline(const VkGraphicsPipelineCreateInfo &createInfo, VkPipeline *pipeline);
+
+        VkPipelineCache getHandle() const;
+
+        TPipelineCacheStats getStats() const;
+
+    private:
+        typedef struct SFileHeader {
+            char magic[4];
+            uint32_t version;
+            uint32_t vendorID;
+            uint32_t deviceID;
+            uint32_t driverVersion;
+            uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t dataSize;
+            // FNV-1a of the blob, catches truncated and corrupted files
+            uint64_t dataHash;
+        } TFileHeader;
+
+        static const uint32_t FILE_VERSION = 1;
+
+        VkDevice logicDevice = VK_NULL_HANDLE;
+        VkPhysicalDeviceProperties properties{};
+        VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+        std::string path{};
+        // Creation feedback is core in 1.3, the extension is not enabled
+        bool feedbackSupported = false;
+
+        mutable std::mutex statsMutex{};
+        TPipelineCacheStats stats{};
+        // Pipelines compiled without a cache hit since the last save
+        std::atomic<bool> dirty{false};
+
+        static uint64_t hashData(const uint8_t *data, size_t size);
+
+        void fillHeader(TFileHeader *header) const;
+    };
+
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <common/CPipelineCache.h>
+
+
+namespace REF_VK {
+
+    // Xash entity render modes, same values as kRenderNormal .. kRenderTransAdd
+    enum ERenderMode {
+        RENDER_MODE_NORMAL,
+        RENDER_MODE_TRANS_COLOR,
+        RENDER_MODE_TRANS_TEXTURE,
+        RENDER_MODE_GLOW,
+        RENDER_MODE_TRANS_ALPHA,
+        RENDER_MODE_TRANS_ADD,
+        RENDER_MODE_COUNT
+    };
+
+    // Vertex layouts of VertexLayout.h
+    enum EVertexFormat {
+        VERTEX_FORMAT_COLOR,
+        VERTEX_FORMAT_COUNT
+    };
+
+    // Everything a draw can vary in its pipeline
+    typedef struct SPipelineState {
+        ERenderMode renderMode;
+        EVertexFormat vertexFormat;
+        VkCullModeFlags cullMode;
+        bool depthTest;
+        bool depthWrite;
+        // Uber-shader features, baked in with specialization constants
+        bool alphaTest;
+        bool fog;
+        bool fullbright;
+    } TPipelineState;
+
+    // TPipelineState packed into 32 bits, 0 is never a valid key
+    typedef uint32_t TPipelineKey;
+
+    // Every pipeline the renderer uses, created on first use. Lookups never block: a state seen for
+    // the first time is queued for the compile threads and the draw uses the fallback pipeline of its
+    // vertex format until the real one is ready.
+    // With VK_EXT_graphics_pipeline_library pipelines are linked from vertex input, pre-rasterization,
+    // fragment shader and fragment output libraries compiled once each. Cull mode, depth test, depth
+    // write and blending are then dynamic state set by bind(), so states differing only in those share
+    // a pipeline.
+    class CPipelineRegistry {
+    public:
+        static TPipelineKey pack(const TPipelineState &state);
+
+        static TPipelineState unpack(TPipelineKey key);
+
+        // State of an entity drawn with renderMode, blending, depth and features come from the render mode table
+        static TPipelineState makeState(ERenderMode renderMode, EVertexFormat vertexFormat, VkCullModeFlags cullMode,
+                                        bool fog);
+
+        // Pipelines target dynamic rendering passes with these attachment formats. pipelineLibrary needs
+        // VK_EXT_graphics_pipeline_library and the color blend enable and equation features of
+        // VK_EXT_extended_dynamic_state3 enabled on the device.
+        bool create(VkDevice device, CPipelineCache *cache, VkPipelineLayout layout, VkFormat colorFormat,
+                    VkFormat depthFormat, uint32_t compileThreadCount, bool pipelineLibrary);
+
+        // Waits for running compiles, then destroys every pipeline and shader module
+        void destroy();
+
+        // Takes ownership of the modules and builds the format's fallback pipeline right away
+        bool setShaders(EVertexFormat format, VkShaderModule vertexShader, VkShaderModule fragmentShader);
+
+        // Safe from any thread, VK_NULL_HANDLE only for formats without shaders
+        VkPipeline get(TPipelineKey key);
+
+        // Binds the pipeline of key, linked pipelines also get their dynamic cull, depth and blend state
+        void bind(VkCommandBuffer commandBuffer, TPipelineKey key);
+
+        // Queue a compile ahead of the first draw, for loading screens
+        void request(TPipelineKey key);
+
+        // Queue the variants of every render mode and cull mode a map uses for each vertex format with shaders,
+        // at level load before waitIdle. Cull modes share a pipeline when cull mode is dynamic state.
+        void prewarm(const ERenderMode *renderModes, uint32_t count, const VkCullModeFlags *cullModes,
+                     uint32_t cullModeCount, bool fog);
+
+        // Blocks until nothing is queued or compiling
+        void waitIdle();
+
+        uint32_t getPipelineCount() const;
+
+        uint32_t getPendingCount() const;
+
+        // Builds every render mode, fog and cull variant of each format both monolithic and linked from
+        // libraries, bypassing the pipeline cache, and destroys them again. Only while nothing compiles.
+        void benchmark(TPipelineBuildStats *stats);
+
+    private:
+        // Open addressing with linear probing, slots are never removed so lookups need no lock
+        static const uint32_t CAPACITY = 1024;
+
+        enum ESlotStatus {
+            SLOT_STATUS_PENDING,
+            SLOT_STATUS_READY,
+            SLOT_STATUS_FAILED
+        };
+
+        typedef struct SSlot {
+            std::atomic<TPipelineKey> key;
+            // Written by the compile thread before status is released
+            VkPipeline pipeline;
+            std::atomic<uint32_t> status;
+        } TSlot;
+
+        // Parts of a linked pipeline, in VkGraphicsPipelineLibraryFlagBitsEXT order
+        enum ELibraryPart {
+            LIBRARY_PART_VERTEX_INPUT,
+            LIBRARY_PART_PRE_RASTERIZATION,
+            LIBRARY_PART_FRAGMENT_SHADER,
+            LIBRARY_PART_FRAGMENT_OUTPUT,
+            LIBRARY_PART_COUNT
+        };
+
+        // Library part in the top byte, the key bits the part depends on below
+        typedef std::unordered_map<uint32_t, VkPipeline> TLibraryMap;
+
+        typedef struct SShaders {
+            VkShaderModule vertexShader;
+            VkShaderModule fragmentShader;
+            VkPipeline fallback;
+        } TShaders;
+
+        VkDevice logicDevice = VK_NULL_HANDLE;
+        CPipelineCache *pipelineCache = nullptr;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkFormat colorAttachmentFormat = VK_FORMAT_UNDEFINED;
+        VkFormat depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+        bool pipelineLibrary = false;
+        PFN_vkCmdSetColorBlendEnableEXT cmdSetColorBlendEnable = nullptr;
+        PFN_vkCmdSetColorBlendEquationEXT cmdSetColorBlendEquation = nullptr;
+        std::array<TShaders, VERTEX_FORMAT_COUNT> shaders{};
+
+        std::array<TSlot, CAPACITY> slots{};
+        std::atomic<uint32_t> pipelineCount{0};
+
+        // Slots waiting for a compile thread, every slot is queued at most once so the ring never overflows
+        mutable std::mutex queueMutex{};
+        std::condition_variable queueChanged{};
+        std::array<uint32_t, CAPACITY> queue{};
+        uint32_t queueHead = 0;
+        uint32_t queueTail = 0;
+        uint32_t compiling = 0;
+        bool quit = false;
+        std::vector<std::thread> compileThreads{};
+
+        // Shared by every linked pipeline, compile threads build missing parts outside the lock
+        std::mutex libraryMutex{};
+        TLibraryMap libraries{};
+
+        // Drops the key bits that are dynamic state on the library path
+        TPipelineKey toSlotKey(TPipelineKey key) const;
+
+        // Returns the slot of key, inserted tells whether this call claimed it
+        TSlot *findOrInsert(TPipelineKey key, bool *inserted);
+
+        void enqueue(uint32_t slotIndex);
+
+        void compileMain();
+
+        VkPipeline buildPipeline(const TPipelineState &state);
+
+        // Uncached builds are only for the benchmark, so it measures real compiles
+        VkPipeline buildMonolithic(const TPipelineState &state, bool cached) const;
+
+        VkPipeline buildLibrary(ELibraryPart part, const TPipelineState &state, bool cached) const;
+
+        // Finds or builds the part of state in map
+        VkPipeline getLibrary(ELibraryPart part, const TPipelineState &state, TLibraryMap *map, bool cached);
+
+        VkPipeline linkLibraries(const std::array<VkPipeline, LIBRARY_PART_COUNT> &parts, bool cached) const;
+
+        VkPipeline createPipeline(const VkGraphicsPipelineCreateInfo &createInfo, bool cached) const;
+
+        // Library and link half of benchmark
+        void benchmarkLibraries(const std::vector<TPipelineState> &states, TPipelineBuildStats *stats);
+    };
+
+}
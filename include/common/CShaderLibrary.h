@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace REF_VK {
+
+    typedef struct SEmbeddedShader {
+        uint64_t hash;
+        const char *name;
+        const uint32_t *code;
+        // Bytes, as VkShaderModuleCreateInfo::codeSize expects
+        size_t size;
+    } TEmbeddedShader;
+
+    // SPIR-V compiled from assets/ at build time and linked into the library, see cmake/Shaders.cmake
+    class CShaderLibrary {
+    public:
+        // FNV-1a of the shader's path below assets/, the table keys are computed by the compiler
+        static constexpr uint64_t hash(const char *name) {
+            uint64_t value = 14695981039346656037ull;
+            for (; *name; ++name) {
+                value ^= static_cast<uint8_t>(*name);
+                value *= 1099511628211ull;
+            }
+            return value;
+        }
+
+        // nullptr when no shader of that name was embedded
+        static const TEmbeddedShader *find(const char *name);
+
+        static uint32_t getCount();
+    };
+
+}
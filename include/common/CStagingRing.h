@@ -0,0 +1,59 @@
+#pragma once
+
+#include <deque>
+#include <vulkan/vulkan.hpp>
+#include <common/vk_mem_alloc.h>
+
+
+namespace REF_VK {
+
+    // One persistently mapped staging buffer, sub-allocated linearly and wrapping around.
+    // Every allocation is tagged with the timeline value of the submission reading it,
+    // space is reclaimed in order once that value is reached.
+    class CStagingRing {
+    public:
+        typedef struct SStagingAllocation {
+            VkBuffer buffer;
+            VkDeviceSize offset;
+            uint8_t *mapped;
+        } TStagingAllocation;
+
+        bool create(VmaAllocator allocator, VkDeviceSize size, VkDeviceSize alignment);
+
+        void destroy();
+
+        // Fails without waiting when the ring has no room, the caller falls back to a dedicated buffer
+        bool allocate(VkDeviceSize size, uint64_t value, TStagingAllocation *allocation);
+
+        // Make CPU writes visible when the memory is not host coherent
+        void flush(const TStagingAllocation &allocation, VkDeviceSize size);
+
+        // Release every allocation whose submission reached completedValue
+        void reclaim(uint64_t completedValue);
+
+        VkDeviceSize getCapacity() const;
+
+        VkDeviceSize getUsedBytes() const;
+
+    private:
+        typedef struct SRegion {
+            // Bytes taken from the ring, padding and wasted tail included
+            VkDeviceSize consumed;
+            uint64_t value;
+        } TRegion;
+
+        VmaAllocator vmaAllocator = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        uint8_t *mapped = nullptr;
+        VkDeviceSize capacity = 0;
+        VkDeviceSize alignment = 1;
+
+        // Next free byte, the used bytes end right before it
+        VkDeviceSize head = 0;
+        VkDeviceSize used = 0;
+        // Oldest first, merged while they share a value
+        std::deque<TRegion> regions{};
+    };
+
+}
@@ -12,12 +12,18 @@ namespace REF_VK {
         VkImageView view;
     } TSwapChainBuffer;
 
+    // Swap chain replaced by a re-create, still owned by frames in flight
+    typedef struct SRetiredSwapChain {
+        VkSwapchainKHR swapchain;
+        std::vector<VkImageView> views;
+    } TRetiredSwapChain;
+
     class CSwapChain {
     private:
         VkInstance instance;
         VkDevice device;
         VkPhysicalDevice physicalDevice;
-        VkSurfaceKHR surface;
+        VkSurfaceKHR surface{};
 
     public:
         VkFormat colorFormat;
@@ -27,12 +33,20 @@ namespace REF_VK {
         std::vector<VkImage> images={};
         std::vector<TSwapChainBuffer> buffers={};
         uint32_t queueNodeIndex = UINT32_MAX;
+        // Present policy, applied by the next create
+        uint32_t requestedImageCount = 0;
+        bool allowTearing = false;
+        VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
 
         void setContext(VkInstance instance, VkPhysicalDevice phyDevice, VkDevice logicDevice);
 
         bool initSurface(SDL_Window *window);
 
-        void create(int *width, int *height, bool vsync = false, bool fullscreen = false);
+        // With retired set the old swap chain is handed back instead of destroyed
+        void create(int *width, int *height, bool vsync = false, bool fullscreen = false,
+                    TRetiredSwapChain *retired = nullptr);
+
+        void cleanup();
 
     };
 
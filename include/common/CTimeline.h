@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vulkan/vulkan.hpp>
+
+
+namespace REF_VK {
+
+    // Timeline semaphore tracking the progress of one queue.
+    // Every submission signals the next 64-bit value, so "GPU has finished submission N"
+    // is a plain comparison instead of a fence per resource.
+    class CTimeline {
+    public:
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+
+        // Values up to initialValue count as reached from the start
+        bool create(VkDevice logicDevice, uint64_t initialValue = 0);
+
+        void destroy();
+
+        // Submit work signaling the next value. submitInfo's timeline signal value for this semaphore must be read
+        // from signalValue, which is filled in first. The value only counts as submitted when the submit succeeds,
+        // and submissions reach the queue in value order. queueMutex guards a queue shared with other submitters.
+        VkResult submit(VkQueue queue, const VkSubmitInfo &submitInfo, uint64_t *signalValue,
+                        std::mutex *queueMutex = nullptr);
+
+        // Last value handed to a submission
+        uint64_t submittedValue() const;
+
+        // Last value known to be reached by the GPU, refreshed from the driver
+        uint64_t completedValue();
+
+        bool isComplete(uint64_t value);
+
+        bool wait(uint64_t value, uint64_t timeout = UINT64_MAX);
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        std::mutex submitMutex{};
+        std::atomic<uint64_t> lastSubmitted{0};
+        std::atomic<uint64_t> lastCompleted{0};
+    };
+
+}
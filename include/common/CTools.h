@@ -2,11 +2,15 @@
 
 #include <vulkan/vulkan.hpp>
 #include <iostream>
+#include <common/CFileSystem.h>
 
 namespace REF_VK {
 
     const long DEFAULT_FENCE_TIMEOUT = 999999999;
 
+    // Upper bound for vkWaitForPresentKHR, a dropped present must not stall input sampling
+    const uint64_t PRESENT_WAIT_TIMEOUT = 50000000;
+
     enum LOG_ERRORS {
         NORMAL,
         ERR,
@@ -30,5 +34,8 @@ namespace REF_VK {
 
     VkShaderModule loadSPIRVShader(VkDevice device, std::string fileName);
 
+    // SPIR-V already in memory, usually a span from CFileSystem
+    VkShaderModule loadSPIRVShader(VkDevice device, const TFileSpan &code, const char *name);
+
     std::string getBasedAssetsPath();
 }
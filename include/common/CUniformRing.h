@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <vulkan/vulkan.hpp>
+#include <common/vk_mem_alloc.h>
+
+
+namespace REF_VK {
+
+    // Per-frame linear allocator for uniform data, bound with UNIFORM_BUFFER_DYNAMIC offsets.
+    // One mapped buffer holds a region per frame slot, so a single descriptor set serves every
+    // draw of every frame and only the dynamic offset changes between draws.
+    class CUniformRing {
+    public:
+        // Returned by push when the slot's region is exhausted
+        static const uint32_t INVALID_OFFSET = UINT32_MAX;
+
+        bool create(VmaAllocator allocator, VkDeviceSize minOffsetAlignment, uint32_t slotCount,
+                    VkDeviceSize slotSize);
+
+        void destroy();
+
+        // Start writing the slot's region, the GPU must be done with its previous frame
+        void beginFrame(uint32_t slot);
+
+        // Flush the written part of the slot when the memory is not host coherent
+        void endFrame();
+
+        // Copy data into the current slot and return its dynamic offset, safe from any thread
+        uint32_t push(const void *data, VkDeviceSize size);
+
+        template<typename T>
+        uint32_t push(const T &data) {
+            return push(&data, sizeof(T));
+        }
+
+        VkBuffer getBuffer() const;
+
+        VkDeviceSize getUsedBytes() const;
+
+    private:
+        VmaAllocator vmaAllocator = VK_NULL_HANDLE;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        uint8_t *mapped = nullptr;
+        VkDeviceSize alignment = 256;
+        VkDeviceSize regionSize = 0;
+
+        VkDeviceSize regionBase = 0;
+        // Bytes used in the current slot, bumped atomically by the recording jobs
+        std::atomic<VkDeviceSize> used{0};
+    };
+
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <common/CDevice.h>
+#include <common/CTimeline.h>
+#include <common/CStagingRing.h>
+#include <common/Typedef.h>
+#include <common/vk_mem_alloc.h>
+
+
+namespace REF_VK {
+
+    // Transfer timeline value of the batch carrying an upload
+    typedef uint64_t TUploadToken;
+
+    // Batches copies onto the transfer queue, a dedicated DMA queue when the device has one.
+    // Uploads may be recorded from any thread. Submission and the graphics side ownership
+    // acquire happen on the thread that owns the graphics queue, so nothing there blocks on a copy.
+    class CUploader {
+    public:
+        // Token of data written in place, available from the start
+        static const TUploadToken WRITTEN_TOKEN = 1;
+
+        // Progress of the transfer submissions, graphics submissions wait on it
+        CTimeline timeline{};
+
+        // queueMutex guards transferQueue when it is also the graphics queue, null for a queue of its own
+        bool create(CDevice *device, VmaAllocator allocator, VkQueue transferQueue, std::mutex *queueMutex);
+
+        void destroy();
+
+        // Transfer and graphics families differ, resources change owner after the copy
+        bool hasDedicatedQueue() const;
+
+        // Copy into a buffer read by the graphics queue at dstStage with dstAccess
+        TUploadToken uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size,
+                                  VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+        // Write in place when the allocation is device local and host visible, otherwise copy like above.
+        // Offset is relative to the buffer, which must own the whole allocation.
+        TUploadToken uploadBuffer(VkBuffer buffer, VmaAllocation allocation, VkDeviceSize offset, const void *data,
+                                  VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+        // Copy tightly packed texels into mip 0, layer 0, the image ends up SHADER_READ_ONLY_OPTIMAL
+        TUploadToken uploadImage(VkImage image, VkImageAspectFlags aspect, uint32_t width, uint32_t height,
+                                 const void *data, VkDeviceSize size, VkPipelineStageFlags dstStage);
+
+        // Submit the open batch, nothing is done when it is empty. Safe from any thread.
+        bool flush();
+
+        // Record the ownership acquires of every submitted batch into a graphics command buffer.
+        // Returns the timeline value that submission must wait for at waitStage, 0 when nothing is pending.
+        uint64_t acquire(VkCommandBuffer commandBuffer, VkPipelineStageFlags *waitStage);
+
+        // Acquired by a graphics submission, draws recorded from now on may use the data
+        bool isAvailable(TUploadToken token) const;
+
+        // Copy finished on the transfer queue
+        bool isComplete(TUploadToken token);
+
+        // Block until the copy is done, only for loading screens
+        bool wait(TUploadToken token);
+
+        // Release the staging memory of finished batches
+        void collect();
+
+        TUploadStats getStats() const;
+
+    private:
+        typedef struct SStagingBuffer {
+            VkBuffer buffer;
+            VmaAllocation allocation;
+        } TStagingBuffer;
+
+        typedef struct SBatch {
+            VkCommandPool commandPool;
+            VkCommandBuffer commandBuffer;
+            // Timeline value signaled by the batch, 0 until its first submission
+            uint64_t value;
+            bool open;
+            std::vector<TStagingBuffer> staging;
+        } TBatch;
+
+        // Graphics side half of an ownership transfer
+        typedef struct SAcquire {
+            uint64_t value;
+            VkBuffer buffer;
+            VkDeviceSize offset;
+            VkDeviceSize size;
+            VkImage image;
+            VkImageAspectFlags aspect;
+            VkPipelineStageFlags dstStage;
+            VkAccessFlags dstAccess;
+        } TAcquire;
+
+        // Batches in flight before recording has to wait for the transfer queue
+        static const uint32_t BATCH_COUNT = 4;
+        static const VkDeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;
+        // Acquires reserved up front so recording them does not allocate during frames
+        static const size_t RESERVED_ACQUIRES = 1024;
+
+        CDevice *device = nullptr;
+        VkDevice logicDevice = VK_NULL_HANDLE;
+        VmaAllocator vmaAllocator = VK_NULL_HANDLE;
+        VkQueue queue = VK_NULL_HANDLE;
+        std::mutex *sharedQueueMutex = nullptr;
+        uint32_t transferFamily = 0;
+        uint32_t graphicsFamily = 0;
+
+        std::mutex mutex{};
+        std::array<TBatch, BATCH_COUNT> batches{};
+        CStagingRing stagingRing{};
+        uint32_t currentBatch = 0;
+        // Acquires recorded into the open batch, then those of submitted batches
+        std::vector<TAcquire> recordedAcquires{};
+        std::vector<TAcquire> submittedAcquires{};
+        // Reused by acquire, cleared instead of freed
+        std::vector<VkBufferMemoryBarrier> bufferBarriers{};
+        std::vector<VkImageMemoryBarrier> imageBarriers{};
+        // Highest token acquired by a graphics submission
+        std::atomic<uint64_t> acquiredValue{WRITTEN_TOKEN};
+
+        std::atomic<uint32_t> directUploads{0};
+        std::atomic<uint64_t> directBytes{0};
+        std::atomic<uint32_t> stagedUploads{0};
+        std::atomic<uint64_t> stagedBytes{0};
+
+        TBatch &openBatch();
+
+        // Copy the data into the ring, or into a dedicated buffer owned by the batch
+        bool writeStaging(TBatch &batch, uint64_t value, const void *data, VkDeviceSize size,
+                          CStagingRing::TStagingAllocation *staging);
+
+        bool createStaging(const void *data, VkDeviceSize size, TStagingBuffer *staging);
+
+        void releaseStaging(TBatch &batch);
+    };
+
+}
@@ -7,7 +7,135 @@ namespace REF_VK {
 
     typedef struct SVertex {
         float position[3];
-        float color[3];
+        // RGBA, read by the shaders as unorm, alpha is unused
+        unsigned char color[4];
     } Vertex;
 
+    typedef struct SFrameStats {
+        unsigned int frameCount;
+        float lastFrameMs;
+        float minFrameMs;
+        float avgFrameMs;
+        float maxFrameMs;
+        // Objects waiting in the deferred deletion queue
+        unsigned int pendingDestroys;
+        // Frame arena bytes used by the last frame
+        unsigned int frameArenaBytes;
+        // Heap allocations the render thread made in the last frame, only counted with REF_VK_HEAP_COUNTER
+        unsigned int heapAllocations;
+    } TFrameStats;
+
+    typedef struct SPresentConfig {
+        qboolean vsync;
+        // Prefer IMMEDIATE over MAILBOX when vsync is off
+        qboolean allowTearing;
+        // 0 keeps the surface minimum plus one
+        int swapchainImages;
+        // 0 disables the CPU frame limiter
+        int maxFps;
+        // Frames allowed between input sampling and display, 1 is the lowest latency
+        int maxQueuedFrames;
+    } TPresentConfig;
+
+    typedef struct SLatencyStats {
+        // CPU time from image acquire to the present call
+        float acquireToPresentMs;
+        // Input sample to present completion with VK_KHR_present_wait, to the present call otherwise
+        float inputToPresentMs;
+        float limiterWaitMs;
+        qboolean presentWait;
+    } TLatencyStats;
+
+    typedef struct SUploadStats {
+        // Written in place into host visible device memory, UMA and resizable BAR
+        unsigned int directUploads;
+        unsigned long long directBytes;
+        // Copied from staging memory by the transfer queue
+        unsigned int stagedUploads;
+        unsigned long long stagedBytes;
+    } TUploadStats;
+
+    // What a VMA allocation holds, reported per category by the memory budget
+    enum EMemoryCategory {
+        MEMORY_CATEGORY_OTHER,
+        MEMORY_CATEGORY_TEXTURE,
+        MEMORY_CATEGORY_LIGHTMAP,
+        MEMORY_CATEGORY_GEOMETRY,
+        MEMORY_CATEGORY_STAGING,
+        MEMORY_CATEGORY_UNIFORM,
+        MEMORY_CATEGORY_RENDER_TARGET,
+        MEMORY_CATEGORY_COUNT
+    };
+
+    typedef struct SMemoryCategoryStats {
+        const char *name;
+        unsigned int allocations;
+        unsigned long long bytes;
+    } TMemoryCategoryStats;
+
+    typedef struct SMemoryHeapStats {
+        // Driver reported with VK_EXT_memory_budget, a fraction of the heap size otherwise
+        unsigned long long budget;
+        unsigned long long usage;
+        // Device memory blocks held by the allocator and the part handed out to resources
+        unsigned long long blockBytes;
+        unsigned long long allocationBytes;
+        unsigned int allocationCount;
+        qboolean deviceLocal;
+    } TMemoryHeapStats;
+
+    typedef struct SDefragStats {
+        unsigned int passes;
+        unsigned int allocationsMoved;
+        unsigned long long bytesMoved;
+        // Device memory blocks released once emptied
+        unsigned int blocksFreed;
+        unsigned long long bytesFreed;
+        float ms;
+    } TDefragStats;
+
+    typedef struct SPipelineCacheStats {
+        // Blob accepted from disk at startup, 0 when missing or stale
+        unsigned long long loadedBytes;
+        unsigned int pipelinesCreated;
+        // Creation feedback reported the pipeline came from the cache
+        unsigned int cacheHits;
+        // Created without creation feedback, hit or miss is unknown
+        unsigned int unknownHits;
+        float totalCompileMs;
+        float maxCompileMs;
+        unsigned int saves;
+    } TPipelineCacheStats;
+
+    typedef struct SPipelineBuildStats {
+        // Graphics pipeline library path available, library and link fields stay 0 otherwise
+        qboolean pipelineLibrary;
+        unsigned int monolithicPipelines;
+        float monolithicMs;
+        // Parts shared by the linked pipelines, compiled once
+        unsigned int libraries;
+        float libraryMs;
+        unsigned int linkedPipelines;
+        float linkMs;
+    } TPipelineBuildStats;
+
+    // Named GPU profiler scopes, one timestamp pair and one statistics query each.
+    // Studio models and translucent draws share the world's rendering pass and are counted in it.
+    enum EGpuScope {
+        GPU_SCOPE_FRAME,
+        GPU_SCOPE_WORLD,
+        GPU_SCOPE_2D,
+        GPU_SCOPE_COUNT
+    };
+
+    typedef struct SGpuScopeStats {
+        const char *name;
+        // Last resolved frame and exponential average
+        float gpuMs;
+        float avgGpuMs;
+        unsigned long long inputPrimitives;
+        unsigned long long vertexInvocations;
+        unsigned long long fragmentInvocations;
+    } TGpuScopeStats;
+
 }
\ No newline at end of file
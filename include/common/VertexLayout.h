@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+#include <common/Typedef.h>
+
+
+namespace REF_VK {
+
+    // Vertex input format of an attribute type, a type without one does not compile
+    template<typename T>
+    struct TVertexFormat;
+
+    template<>
+    struct TVertexFormat<float[2]> {
+        static constexpr VkFormat format = VK_FORMAT_R32G32_SFLOAT;
+    };
+
+    template<>
+    struct TVertexFormat<float[3]> {
+        static constexpr VkFormat format = VK_FORMAT_R32G32B32_SFLOAT;
+    };
+
+    template<>
+    struct TVertexFormat<float[4]> {
+        static constexpr VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    };
+
+    // Colors in [0, 1], a quarter of the fp32 size
+    template<>
+    struct TVertexFormat<unsigned char[4]> {
+        static constexpr VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+    };
+
+    template<typename TMember, uint32_t Offset>
+    struct TVertexAttribute {
+        static constexpr VkFormat format = TVertexFormat<TMember>::format;
+        static constexpr uint32_t offset = Offset;
+    };
+
+    // Format and offset both come from the struct member
+#define VERTEX_ATTRIBUTE(vertex, member) \
+    REF_VK::TVertexAttribute<decltype(vertex::member), static_cast<uint32_t>(offsetof(vertex, member))>
+
+    // Binding and attribute descriptions of a vertex struct, shader locations follow the attribute order
+    template<typename TVertex, typename... TAttributes>
+    struct TVertexLayout {
+        static constexpr uint32_t ATTRIBUTE_COUNT = sizeof...(TAttributes);
+
+        static constexpr VkVertexInputBindingDescription binding(uint32_t binding = 0,
+                                                                 VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_VERTEX) {
+            return {binding, static_cast<uint32_t>(sizeof(TVertex)), rate};
+        }
+
+        static constexpr std::array<VkVertexInputAttributeDescription, ATTRIBUTE_COUNT>
+        attributes(uint32_t binding = 0, uint32_t firstLocation = 0) {
+            uint32_t location = firstLocation;
+            return {{{location++, binding, TAttributes::format, TAttributes::offset}...}};
+        }
+    };
+
+    // Debug geometry, fp32 positions and packed colors, 16 bytes instead of 24
+    typedef TVertexLayout<Vertex,
+            VERTEX_ATTRIBUTE(Vertex, position),
+            VERTEX_ATTRIBUTE(Vertex, color)> TColorVertexLayout;
+
+}
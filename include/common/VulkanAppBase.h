@@ -2,6 +2,7 @@
 
 #include <ref_vk.h>
 #include <iostream>
+#include <mutex>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_vulkan.h>
@@ -10,6 +11,12 @@
 #include <common/CTools.h>
 #include <common/CDevice.h>
 #include <common/CSwapChain.h>
+#include <common/CTimeline.h>
+#include <common/CDeletionQueue.h>
+#include <common/CUploader.h>
+#include <common/CMemoryBudget.h>
+#include <common/CDefragmenter.h>
+#include <common/CPipelineCache.h>
 #include <common/vk_mem_alloc.h>
 
 #if defined(_WIN32)
@@ -19,14 +26,40 @@
 
 #endif
 
+// Frame ring capacity, the active depth is selected at runtime between MIN and MAX
+#define MIN_CONCURRENT_FRAMES 2
+#define MAX_CONCURRENT_FRAMES 4
+
 namespace REF_VK {
 
+    // Attachments of one dynamic rendering pass, picked when the pass is recorded
+    typedef struct SRenderTarget {
+        VkImage colorImage;
+        VkImageView colorView;
+        VkImage depthImage;
+        VkImageView depthView;
+        VkExtent2D extent;
+        // Color layout once the last pass into the target has ended
+        VkImageLayout finalLayout;
+    } TRenderTarget;
+
+    // Color and depth images rendered to and then sampled, for mirrors and monitors
+    typedef struct SRenderTexture {
+        TRenderTarget target;
+        VmaAllocation colorAllocation;
+        VmaAllocation depthAllocation;
+        // Frame that last used a destroyed texture, its slot is free once that frame completed
+        uint64_t retireFrame;
+    } TRenderTexture;
+
     class VulkanAppBase {
     public:
         // Window
         SDL_Window *window;
         const char *winTitle = "Test Window";
         int winWidth = 800, winHeight = 600;
+        // Render into offscreen images, no window, surface or swap chain
+        bool headless = false;
 
         // Vulkan
         VkInstance instance{};
@@ -36,33 +69,68 @@ namespace REF_VK {
         VkDevice logicDevice{};
         REF_VK::CDevice *device{};
         VkPhysicalDeviceFeatures enableFeatures{};
+        VkPhysicalDeviceVulkan12Features enableVulkan12Features{};
+        VkPhysicalDeviceVulkan13Features enableVulkan13Features{};
+        VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+        bool presentWaitSupported = false;
+        bool memoryBudgetSupported = false;
+        // Pipelines linked from precompiled parts, with cull, depth and blend state set at draw time
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures{};
+        VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extendedDynamicState3Features{};
+        bool pipelineLibrarySupported = false;
+        PFN_vkWaitForPresentKHR vkWaitForPresent = nullptr;
         std::vector<const char *> enableDeviceExtensions{};
         void *deviceCreateNextChain = nullptr;
         VkBool32 requiresStencil{};
         VkFormat depthFormat{};
+        VkFormat colorFormat{};
         CSwapChain swapChain{};
-        struct {
-            // Swap chain image presentation
-            VkSemaphore presentComplete;
-            // Command buffer submit and execution
-            VkSemaphore renderComplete;
-        } semaphores;
-        VkSubmitInfo submitInfo{};
-        VkPipelineStageFlags submitPipelineStageFlags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        bool vsync = false;
+        // First frame presented to the current swap chain, present ids before it belong to a retired one
+        uint64_t swapChainFirstFrame = 1;
+        // Color targets used instead of the swap chain images in headless mode
+        typedef struct SOffscreenTarget {
+            VkImage image;
+            VmaAllocation allocation;
+            VkImageView view;
+        } TOffscreenTarget;
+        std::vector<TOffscreenTarget> offscreenTargets{};
         VkCommandPool cmdPool{};
-        std::vector<VkCommandBuffer> drawCmdBuffers{};
         VkQueue queue{};
-        std::vector<VkFence> waitFences{};
+        VkQueue transferQueue{};
+        // Held for every submit and present on the graphics queue, the uploader shares it without a transfer family
+        std::mutex queueMutex{};
+        // GPU progress of every submission to the graphics queue
+        CTimeline graphicsTimeline{};
         struct {
             VkImage image;
             VmaAllocation allocation;
             VkImageView imageView;
         } depthStencil;
-        VkRenderPass renderPass{};
-        VkPipelineCache pipelineCache{};
+        // Persisted next to the working directory, reused when the device and driver match
+        CPipelineCache pipelineCache{};
+        std::string pipelineCachePath = "ref_vk_pipelines.bin";
         VmaAllocator vmaAllocator;
-        std::vector<VkFramebuffer> frameBuffers{};
         VkDescriptorPool descriptorPool{};
+        // Signaled by the submit and waited by the present, one per swap chain image
+        std::vector<VkSemaphore> renderCompleteSemaphores{};
+        // Set when present reports the swap chain no longer matches the surface
+        bool swapChainDirty = false;
+        // Replaced swap chains and their present semaphores. The graphics timeline says nothing about
+        // queued presents, so they wait for the first image acquired from the new swap chain.
+        std::vector<TRetiredSwapChain> retiredSwapChains{};
+        std::vector<VkSemaphore> retiredSemaphores{};
+
+        // Frame being recorded and the last one known to be finished on the GPU
+        uint64_t frameNumber = 1;
+        uint64_t completedFrameNumber = 0;
+        // Objects released once completedFrameNumber reaches the last frame using them
+        CDeletionQueue deletionQueue{};
+        // Buffer and image copies on the transfer queue
+        CUploader uploader{};
+        CMemoryBudget memoryBudget{};
+        CDefragmenter defragmenter{};
 
 
         bool init();
@@ -77,17 +145,41 @@ namespace REF_VK {
 
         void createCommandPool();
 
-        bool createCommandBuffers();
-
-        void createSynchronizationPrimitives();
+        bool submitAndWait(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore = VK_NULL_HANDLE,
+                           uint64_t waitValue = 0, VkPipelineStageFlags waitStage = 0);
 
         void setupDepthStencil();
 
-        void setupRenderPass();
-
         void createPipelineCache();
 
-        void setupFrameBuffer();
+        void setupOffscreenTargets();
+
+        void setupRenderCompleteSemaphores();
+
+        bool recreateSwapChain();
+
+        // Hand the retired presentation objects to the deletion queue, after a successful acquire
+        void releaseRetiredSwapChains();
+
+        uint32_t getColorTargetCount() const;
+
+        // Swap chain image or offscreen target plus the shared depth buffer, sized to the window
+        TRenderTarget getColorTarget(uint32_t index) const;
+
+        bool createRenderTexture(uint32_t width, uint32_t height, TRenderTexture *texture);
+
+        // Released once the frames in flight that may sample it are done
+        void destroyRenderTexture(TRenderTexture *texture);
+
+        // Begins a pass whose draws come from secondary command buffers. A cleared pass discards the
+        // previous contents, a continued one loads color and waits for the previous pass to finish.
+        // Depth is never kept between passes. Without clearColor a cleared pass leaves color undefined,
+        // for scenes whose draws cover every pixel.
+        void beginRendering(VkCommandBuffer commandBuffer, const TRenderTarget &target, bool clear,
+                            bool clearColor = true);
+
+        // The last pass into a target moves its color to finalLayout
+        void endRendering(VkCommandBuffer commandBuffer, const TRenderTarget &target, bool lastPass);
 
     private:
 
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <cstddef>
 #include <common/Typedef.h>
 
+#if defined(_WIN32)
 #define EXPORT_DLL __declspec(dllexport)
+#else
+#define EXPORT_DLL __attribute__((visibility("default")))
+#endif
 
 
 extern "C" {
@@ -13,4 +18,92 @@ EXPORT_DLL void R_Shutdown(void);
 
 EXPORT_DLL const char *R_GetConfigName(void);
 
+// Render into offscreen images without a window, must be called before R_Init
+EXPORT_DLL void R_SetHeadless(REF_VK::qboolean enable, int width, int height);
+
+// Game directory or PAK / PK3 archive for shaders and assets, later mounts override earlier ones
+EXPORT_DLL REF_VK::qboolean R_MountPath(const char *path);
+
+EXPORT_DLL void R_GetFrameStats(REF_VK::TFrameStats *stats);
+
+// GPU time and pipeline statistics of one REF_VK::EGpuScope, a few frames behind
+EXPORT_DLL REF_VK::qboolean R_GetGpuScopeStats(int scope, REF_VK::TGpuScopeStats *stats);
+
+// r_speeds overlay text for the engine to draw
+EXPORT_DLL REF_VK::qboolean R_SpeedsMessage(char *out, size_t size);
+
+// Present mode, swap chain image count, frame limiter and queue depth, applied on the next frame
+EXPORT_DLL void R_SetPresentConfig(const REF_VK::TPresentConfig *config);
+
+// Call right before sampling input, waits for the frame queue and the frame limiter
+EXPORT_DLL void R_WaitForInputSample(void);
+
+EXPORT_DLL void R_GetLatencyStats(REF_VK::TLatencyStats *stats);
+
+// Bytes written in place versus copied through staging memory since R_Init
+EXPORT_DLL void R_GetUploadStats(REF_VK::TUploadStats *stats);
+
+// Pipelines created since R_Init, how many came from the on-disk cache and the time spent compiling
+EXPORT_DLL void R_GetPipelineCacheStats(REF_VK::TPipelineCacheStats *stats);
+
+// Full compiles of every pipeline variant against library compiles plus links, without the pipeline cache
+EXPORT_DLL void R_BenchmarkPipelines(REF_VK::TPipelineBuildStats *stats);
+
+EXPORT_DLL int R_GetMemoryHeapCount(void);
+
+// Budget and usage of one memory heap
+EXPORT_DLL REF_VK::qboolean R_GetMemoryHeapStats(int heap, REF_VK::TMemoryHeapStats *stats);
+
+// Memory held by one REF_VK::EMemoryCategory
+EXPORT_DLL REF_VK::qboolean R_GetMemoryCategoryStats(int category, REF_VK::TMemoryCategoryStats *stats);
+
+// Text of the memory console command, heaps then categories
+EXPORT_DLL REF_VK::qboolean R_MemoryReport(char *out, size_t size);
+
+// Write the allocator's JSON statistics with every allocation to path
+EXPORT_DLL REF_VK::qboolean R_DumpMemoryJson(const char *path);
+
+// Number of frames the CPU may record ahead of the GPU, clamped to [2, 4]. During a frame it applies after R_EndFrame.
+EXPORT_DLL void R_SetFramesInFlight(int count);
+
+// Entity render modes (kRenderNormal .. kRenderTransAdd) the next map uses, compiled during R_NewMap
+EXPORT_DLL void R_SetMapRenderModes(const int *renderModes, int count);
+
+// Exponential squared fog, a shader variant of every pipeline
+EXPORT_DLL void R_SetFog(REF_VK::qboolean enable, const float color[3], float density);
+
+// Level change, packs the surviving meshes of the geometry arena into fresh pages
+EXPORT_DLL void R_NewMap(void);
+
+// Copy a mesh into the geometry arena, returns its handle or 0
+EXPORT_DLL int R_UploadMesh(const REF_VK::Vertex *vertices, int vertexCount, const unsigned int *indices,
+                            int indexCount);
+
+// Release a mesh, usually the previous map's before R_NewMap. Its range is reused once in-flight frames are done.
+EXPORT_DLL void R_FreeMesh(int mesh);
+
+// Run VMA defragmentation at the end of R_NewMap, off by default
+EXPORT_DLL void R_SetDefragmentation(REF_VK::qboolean enable);
+
+// Bytes moved and time spent by the last R_NewMap defragmentation
+EXPORT_DLL void R_GetDefragStats(REF_VK::TDefragStats *stats);
+
+EXPORT_DLL void R_BeginFrame(REF_VK::qboolean clearScene);
+
+EXPORT_DLL void R_RenderScene(void);
+
+// Color and depth target for mirrors and monitors, returns its handle or -1
+EXPORT_DLL int R_CreateRenderTexture(int width, int height);
+
+EXPORT_DLL void R_FreeRenderTexture(int texture);
+
+// Draw the scene into the texture this frame, before the main view. Between R_BeginFrame and R_EndFrame.
+// view is a column-major world to camera matrix, null uses the main view; the projection fits the texture.
+EXPORT_DLL void R_RenderSceneToTexture(int texture, const float view[16]);
+
+EXPORT_DLL void R_EndFrame(void);
+
+// Color of one pixel of the last finished frame, only in headless mode and outside a frame. Waits for the GPU.
+EXPORT_DLL REF_VK::qboolean R_ReadPixel(int x, int y, unsigned char rgba[4]);
+
 }
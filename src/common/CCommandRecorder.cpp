@@ -0,0 +1,163 @@
+#include <common/CCommandRecorder.h>
+#include <common/CTools.h>
+
+
+namespace REF_VK {
+
+    bool CCommandRecorder::create(VkDevice logicDevice, uint32_t queueFamilyIndex, uint32_t slotCount,
+                                  CJobSystem *jobs, VkQueryPipelineStatisticFlags pipelineStatistics) {
+        device = logicDevice;
+        jobSystem = jobs;
+        inheritedStatistics = pipelineStatistics;
+
+        VkCommandPoolCreateInfo commandPoolCI{};
+        commandPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        commandPoolCI.queueFamilyIndex = queueFamilyIndex;
+        // Buffers are short lived, the whole pool is reset once per frame instead of each buffer
+        commandPoolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        threadSlots.resize(jobSystem->getThreadCount());
+        for (auto &slots: threadSlots) {
+            slots.resize(slotCount);
+            for (auto &slot: slots) {
+                slot.usedCount = 0;
+                if (!VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCI, nullptr, &slot.commandPool),
+                                     "Cannot create thread command pool!")) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void CCommandRecorder::destroy() {
+        // Destroying a pool frees its command buffers
+        for (auto &slots: threadSlots) {
+            for (auto &slot: slots) {
+                if (slot.commandPool != VK_NULL_HANDLE) {
+                    vkDestroyCommandPool(device, slot.commandPool, nullptr);
+                }
+            }
+        }
+        threadSlots.clear();
+    }
+
+    void CCommandRecorder::beginFrame(uint32_t slot, VkFormat colorFormat, VkFormat depthFormat) {
+        currentSlot = slot;
+        entryCount = 0;
+
+        colorAttachmentFormat = colorFormat;
+        renderingInheritanceInfo = {};
+        renderingInheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+        renderingInheritanceInfo.colorAttachmentCount = 1;
+        renderingInheritanceInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+        renderingInheritanceInfo.depthAttachmentFormat = depthFormat;
+        renderingInheritanceInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        inheritanceInfo = {};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.pNext = &renderingInheritanceInfo;
+        inheritanceInfo.pipelineStatistics = inheritedStatistics;
+
+        for (auto &slots: threadSlots) {
+            TThreadSlot &threadSlot = slots[slot];
+            VK_CHECK_RESULT(vkResetCommandPool(device, threadSlot.commandPool, 0), "Cannot reset thread command pool!");
+            threadSlot.usedCount = 0;
+        }
+
+        // Empty parent job, finished once every recording job of the frame has run
+        frameJob = jobSystem->createJob([] {});
+    }
+
+    void CCommandRecorder::record(ECommandBucket bucket, TRecordFunc func, uint32_t pass) {
+        if (entryCount == MAX_RECORD_JOBS) {
+            LOG(ERR, "Too many command recording jobs in one frame!");
+            return;
+        }
+
+        uint32_t index = entryCount++;
+        entries[index].bucket = bucket;
+        entries[index].pass = pass;
+        entries[index].func = std::move(func);
+        entries[index].commandBuffer = VK_NULL_HANDLE;
+
+        CCommandRecorder *recorder = this;
+        jobSystem->run(jobSystem->createJob([recorder, index] { recorder->recordEntry(index); }, frameJob));
+    }
+
+    void CCommandRecorder::wait() {
+        // The engine thread records too while it waits
+        jobSystem->run(frameJob);
+        jobSystem->wait(frameJob);
+    }
+
+    void CCommandRecorder::execute(VkCommandBuffer primary, uint32_t pass, ECommandBucket firstBucket,
+                                   ECommandBucket lastBucket) {
+        // Bounded by MAX_RECORD_JOBS, the frame path never touches the heap here
+        std::array<VkCommandBuffer, MAX_RECORD_JOBS> commandBuffers{};
+        uint32_t commandBufferCount = 0;
+        for (uint32_t bucket = firstBucket; bucket <= lastBucket; ++bucket) {
+            // Within a bucket the buffers keep the order they were queued in
+            for (uint32_t i = 0; i < entryCount; ++i) {
+                if (entries[i].bucket == bucket && entries[i].pass == pass &&
+                    entries[i].commandBuffer != VK_NULL_HANDLE) {
+                    commandBuffers[commandBufferCount++] = entries[i].commandBuffer;
+                }
+            }
+        }
+        if (commandBufferCount > 0) {
+            vkCmdExecuteCommands(primary, commandBufferCount, commandBuffers.data());
+        }
+    }
+
+    bool CCommandRecorder::hasRecorded(uint32_t pass, ECommandBucket firstBucket, ECommandBucket lastBucket) const {
+        for (uint32_t i = 0; i < entryCount; ++i) {
+            if (entries[i].pass == pass && entries[i].bucket >= firstBucket && entries[i].bucket <= lastBucket &&
+                entries[i].commandBuffer != VK_NULL_HANDLE) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    VkCommandBuffer CCommandRecorder::acquireCommandBuffer(TThreadSlot &slot) {
+        if (slot.usedCount == slot.commandBuffers.size()) {
+            VkCommandBuffer commandBuffer{};
+            VkCommandBufferAllocateInfo allocateInfo{};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocateInfo.commandPool = slot.commandPool;
+            allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocateInfo.commandBufferCount = 1;
+            if (!VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer),
+                                 "Cannot allocate secondary command buffer!")) {
+                return VK_NULL_HANDLE;
+            }
+            slot.commandBuffers.push_back(commandBuffer);
+        }
+        return slot.commandBuffers[slot.usedCount++];
+    }
+
+    void CCommandRecorder::recordEntry(uint32_t index) {
+        TRecordEntry &entry = entries[index];
+        // Pools are per thread, so no two jobs ever record from the same pool at once
+        TThreadSlot &slot = threadSlots[CJobSystem::getThreadIndex()][currentSlot];
+        VkCommandBuffer commandBuffer = acquireCommandBuffer(slot);
+        if (commandBuffer == VK_NULL_HANDLE) {
+            return;
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                          VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+        if (!VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo), "Cannot begin secondary command buffer!")) {
+            return;
+        }
+        entry.func(commandBuffer);
+        if (VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer), "Cannot end secondary command buffer!")) {
+            entry.commandBuffer = commandBuffer;
+        }
+    }
+
+}
@@ -0,0 +1,263 @@
+#include <common/CDefragmenter.h>
+#include <common/CTools.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <vector>
+
+
+namespace REF_VK {
+
+    void CDefragmenter::create(VkDevice logicDevice, VmaAllocator allocator) {
+        device = logicDevice;
+        vmaAllocator = allocator;
+    }
+
+    void CDefragmenter::registerBuffer(VmaAllocation allocation, VkBuffer buffer, const VkBufferCreateInfo &createInfo,
+                                       TBufferMovedFunc moved) {
+        TResource resource{};
+        resource.buffer = buffer;
+        resource.bufferCI = createInfo;
+        // Chained structures and family lists are not kept alive, exclusive buffers do not need them
+        resource.bufferCI.pNext = nullptr;
+        resource.bufferCI.queueFamilyIndexCount = 0;
+        resource.bufferCI.pQueueFamilyIndices = nullptr;
+        resource.bufferMoved = std::move(moved);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        resources[allocation] = resource;
+    }
+
+    void CDefragmenter::registerImage(VmaAllocation allocation, VkImage image, const VkImageCreateInfo &createInfo,
+                                      VkImageLayout layout, VkImageAspectFlags aspect, TImageMovedFunc moved) {
+        TResource resource{};
+        resource.image = image;
+        resource.imageCI = createInfo;
+        resource.imageCI.pNext = nullptr;
+        resource.imageCI.queueFamilyIndexCount = 0;
+        resource.imageCI.pQueueFamilyIndices = nullptr;
+        resource.imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        resource.layout = layout;
+        resource.aspect = aspect;
+        resource.imageMoved = std::move(moved);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        resources[allocation] = resource;
+    }
+
+    void CDefragmenter::unregister(VmaAllocation allocation) {
+        std::lock_guard<std::mutex> lock(mutex);
+        resources.erase(allocation);
+    }
+
+    bool CDefragmenter::run(VkCommandBuffer commandBuffer, const TSubmitFunc &submit, TDefragStats *stats) {
+        auto start = std::chrono::steady_clock::now();
+
+        VmaDefragmentationInfo defragInfo{};
+        defragInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FULL_BIT;
+        VmaDefragmentationContext context{};
+        if (!VK_CHECK_RESULT(vmaBeginDefragmentation(vmaAllocator, &defragInfo, &context),
+                             "Cannot begin defragmentation!")) {
+            return false;
+        }
+
+        bool success = true;
+        uint32_t passes = 0;
+        for (;;) {
+            VmaDefragmentationPassMoveInfo passInfo{};
+            VkResult result = vmaBeginDefragmentationPass(vmaAllocator, context, &passInfo);
+            if (result == VK_SUCCESS) {
+                break;
+            }
+            if (result != VK_INCOMPLETE) {
+                VK_CHECK_RESULT(result, "Cannot begin defragmentation pass!");
+                success = false;
+                break;
+            }
+            passes++;
+
+            std::vector<TMove> moves{};
+            std::vector<std::pair<TBufferMovedFunc, VkBuffer>> movedBuffers{};
+            std::vector<std::pair<TImageMovedFunc, VkImage>> movedImages{};
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                VkCommandBufferBeginInfo beginInfo{};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+                // Everything written before the pass must be readable by the copies
+                VkMemoryBarrier memoryBarrier{};
+                memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                memoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+                for (uint32_t i = 0; i < passInfo.moveCount; ++i) {
+                    VmaDefragmentationMove &move = passInfo.pMoves[i];
+                    auto it = resources.find(move.srcAllocation);
+                    TMove recordedMove{};
+                    bool recorded = false;
+                    if (it != resources.end()) {
+                        recorded = it->second.buffer != VK_NULL_HANDLE
+                                   ? recordBufferMove(commandBuffer, it->second, move, &recordedMove)
+                                   : recordImageMove(commandBuffer, it->second, move, &recordedMove);
+                    }
+                    if (recorded) {
+                        moves.push_back(recordedMove);
+                    } else {
+                        // Unknown owner or the copy could not be recreated, leave it in place
+                        move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                    }
+                }
+
+                // The moved data is read by every later submission on the queue
+                memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                     0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+                VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+
+                bool submitted = moves.empty() || submit(commandBuffer);
+                for (auto &move: moves) {
+                    TResource &resource = resources[move.allocation];
+                    if (!submitted) {
+                        // Keep the old resources, the new ones never received their data
+                        vkDestroyBuffer(device, move.newBuffer, nullptr);
+                        vkDestroyImage(device, move.newImage, nullptr);
+                        continue;
+                    }
+                    vkDestroyBuffer(device, move.oldBuffer, nullptr);
+                    vkDestroyImage(device, move.oldImage, nullptr);
+                    if (move.newBuffer != VK_NULL_HANDLE) {
+                        resource.buffer = move.newBuffer;
+                        movedBuffers.emplace_back(resource.bufferMoved, move.newBuffer);
+                    } else {
+                        resource.image = move.newImage;
+                        movedImages.emplace_back(resource.imageMoved, move.newImage);
+                    }
+                }
+                if (!submitted) {
+                    for (uint32_t i = 0; i < passInfo.moveCount; ++i) {
+                        passInfo.pMoves[i].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                    }
+                    success = false;
+                }
+            }
+
+            // Owners take the lock of their own structures, so they are called without ours
+            for (auto &moved: movedBuffers) {
+                if (moved.first) {
+                    moved.first(moved.second);
+                }
+            }
+            for (auto &moved: movedImages) {
+                if (moved.first) {
+                    moved.first(moved.second);
+                }
+            }
+
+            result = vmaEndDefragmentationPass(vmaAllocator, context, &passInfo);
+            if (result == VK_SUCCESS || !success) {
+                break;
+            }
+        }
+
+        VmaDefragmentationStats defragStats{};
+        vmaEndDefragmentation(vmaAllocator, context, &defragStats);
+        stats->passes = passes;
+        stats->allocationsMoved = defragStats.allocationsMoved;
+        stats->bytesMoved = defragStats.bytesMoved;
+        stats->blocksFreed = defragStats.deviceMemoryBlocksFreed;
+        stats->bytesFreed = defragStats.bytesFreed;
+        stats->ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return success;
+    }
+
+    bool CDefragmenter::recordBufferMove(VkCommandBuffer commandBuffer, const TResource &resource,
+                                         const VmaDefragmentationMove &move, TMove *result) {
+        VkBuffer buffer{};
+        if (!VK_CHECK_RESULT(vkCreateBuffer(device, &resource.bufferCI, nullptr, &buffer),
+                             "Cannot recreate buffer for defragmentation!")) {
+            return false;
+        }
+        if (!VK_CHECK_RESULT(vmaBindBufferMemory(vmaAllocator, move.dstTmpAllocation, buffer),
+                             "Cannot bind defragmented buffer!")) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            return false;
+        }
+
+        VkBufferCopy copyRegion{};
+        copyRegion.size = resource.bufferCI.size;
+        vkCmdCopyBuffer(commandBuffer, resource.buffer, buffer, 1, &copyRegion);
+
+        result->allocation = move.srcAllocation;
+        result->oldBuffer = resource.buffer;
+        result->newBuffer = buffer;
+        return true;
+    }
+
+    bool CDefragmenter::recordImageMove(VkCommandBuffer commandBuffer, const TResource &resource,
+                                        const VmaDefragmentationMove &move, TMove *result) {
+        VkImage image{};
+        if (!VK_CHECK_RESULT(vkCreateImage(device, &resource.imageCI, nullptr, &image),
+                             "Cannot recreate image for defragmentation!")) {
+            return false;
+        }
+        if (!VK_CHECK_RESULT(vmaBindImageMemory(vmaAllocator, move.dstTmpAllocation, image),
+                             "Cannot bind defragmented image!")) {
+            vkDestroyImage(device, image, nullptr);
+            return false;
+        }
+
+        VkImageSubresourceRange range{resource.aspect, 0, resource.imageCI.mipLevels, 0,
+                                      resource.imageCI.arrayLayers};
+        std::array<VkImageMemoryBarrier, 2> imageBarriers{};
+        imageBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        imageBarriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imageBarriers[0].oldLayout = resource.layout;
+        imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarriers[0].image = resource.image;
+        imageBarriers[0].subresourceRange = range;
+        imageBarriers[1] = imageBarriers[0];
+        imageBarriers[1].srcAccessMask = 0;
+        imageBarriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarriers[1].image = image;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
+                             nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+        // Every mip with all its layers
+        std::vector<VkImageCopy> copyRegions(resource.imageCI.mipLevels);
+        for (uint32_t mip = 0; mip < resource.imageCI.mipLevels; ++mip) {
+            VkImageCopy &copyRegion = copyRegions[mip];
+            copyRegion.srcSubresource = {resource.aspect, mip, 0, resource.imageCI.arrayLayers};
+            copyRegion.dstSubresource = copyRegion.srcSubresource;
+            copyRegion.extent = {std::max(resource.imageCI.extent.width >> mip, 1u),
+                                 std::max(resource.imageCI.extent.height >> mip, 1u),
+                                 std::max(resource.imageCI.extent.depth >> mip, 1u)};
+        }
+        vkCmdCopyImage(commandBuffer, resource.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()),
+                       copyRegions.data());
+
+        // Back to the layout the owner's descriptors expect
+        imageBarriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarriers[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarriers[1].newLayout = resource.layout;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0,
+                             nullptr, 0, nullptr, 1, &imageBarriers[1]);
+
+        result->allocation = move.srcAllocation;
+        result->oldImage = resource.image;
+        result->newImage = image;
+        return true;
+    }
+
+}
@@ -0,0 +1,163 @@
+#include <common/CDeletionQueue.h>
+#include <common/CMemoryBudget.h>
+
+
+namespace REF_VK {
+
+    void CDeletionQueue::setContext(VkDevice logicDevice, VmaAllocator allocator) {
+        device = logicDevice;
+        vmaAllocator = allocator;
+    }
+
+    void CDeletionQueue::push(const TDeferredObject &object) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(object);
+    }
+
+    void CDeletionQueue::destroyBuffer(VkBuffer buffer, VmaAllocation allocation, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_BUFFER;
+        object.buffer = buffer;
+        object.allocation = allocation;
+        push(object);
+    }
+
+    void CDeletionQueue::destroyImage(VkImage image, VmaAllocation allocation, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_IMAGE;
+        object.image = image;
+        object.allocation = allocation;
+        push(object);
+    }
+
+    void CDeletionQueue::destroyImageView(VkImageView imageView, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_IMAGE_VIEW;
+        object.imageView = imageView;
+        push(object);
+    }
+
+    void CDeletionQueue::destroySampler(VkSampler sampler, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_SAMPLER;
+        object.sampler = sampler;
+        push(object);
+    }
+
+    void CDeletionQueue::destroyPipeline(VkPipeline pipeline, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_PIPELINE;
+        object.pipeline = pipeline;
+        push(object);
+    }
+
+    void CDeletionQueue::freeDescriptorSet(VkDescriptorPool pool, VkDescriptorSet descriptorSet, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_DESCRIPTOR_SET;
+        object.descriptorSet = descriptorSet;
+        object.descriptorPool = pool;
+        push(object);
+    }
+
+    void CDeletionQueue::destroyFramebuffer(VkFramebuffer frameBuffer, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_FRAMEBUFFER;
+        object.frameBuffer = frameBuffer;
+        push(object);
+    }
+
+    void CDeletionQueue::destroyShaderModule(VkShaderModule shaderModule, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_SHADER_MODULE;
+        object.shaderModule = shaderModule;
+        push(object);
+    }
+
+    void CDeletionQueue::destroySemaphore(VkSemaphore semaphore, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_SEMAPHORE;
+        object.semaphore = semaphore;
+        push(object);
+    }
+
+    void CDeletionQueue::destroySwapchain(VkSwapchainKHR swapchain, uint64_t frame) {
+        TDeferredObject object{};
+        object.frame = frame;
+        object.type = DEFERRED_SWAPCHAIN;
+        object.swapchain = swapchain;
+        push(object);
+    }
+
+    void CDeletionQueue::release(const TDeferredObject &object) {
+        switch (object.type) {
+            case DEFERRED_BUFFER:
+                CMemoryBudget::untrack(vmaAllocator, object.allocation);
+                vmaDestroyBuffer(vmaAllocator, object.buffer, object.allocation);
+                break;
+            case DEFERRED_IMAGE:
+                CMemoryBudget::untrack(vmaAllocator, object.allocation);
+                vmaDestroyImage(vmaAllocator, object.image, object.allocation);
+                break;
+            case DEFERRED_IMAGE_VIEW:
+                vkDestroyImageView(device, object.imageView, nullptr);
+                break;
+            case DEFERRED_SAMPLER:
+                vkDestroySampler(device, object.sampler, nullptr);
+                break;
+            case DEFERRED_PIPELINE:
+                vkDestroyPipeline(device, object.pipeline, nullptr);
+                break;
+            case DEFERRED_DESCRIPTOR_SET:
+                vkFreeDescriptorSets(device, object.descriptorPool, 1, &object.descriptorSet);
+                break;
+            case DEFERRED_FRAMEBUFFER:
+                vkDestroyFramebuffer(device, object.frameBuffer, nullptr);
+                break;
+            case DEFERRED_SHADER_MODULE:
+                vkDestroyShaderModule(device, object.shaderModule, nullptr);
+                break;
+            case DEFERRED_SEMAPHORE:
+                vkDestroySemaphore(device, object.semaphore, nullptr);
+                break;
+            case DEFERRED_SWAPCHAIN:
+                vkDestroySwapchainKHR(device, object.swapchain, nullptr);
+                break;
+        }
+    }
+
+    uint32_t CDeletionQueue::flush(uint64_t completedFrame) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Entries are pushed in frame order, stop at the first one still in use
+        uint32_t released = 0;
+        while (!pending.empty() && pending.front().frame <= completedFrame) {
+            release(pending.front());
+            pending.pop_front();
+            released++;
+        }
+        return released;
+    }
+
+    void CDeletionQueue::flushAll() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &object: pending) {
+            release(object);
+        }
+        pending.clear();
+    }
+
+    size_t CDeletionQueue::pendingCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending.size();
+    }
+
+}
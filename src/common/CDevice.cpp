@@ -52,15 +52,25 @@ namespace REF_VK {
 
         const float defaultQueuePriority = 0.0f;
 
-        // Graphics queue
-        if (requestedQueueTypes & VK_QUEUE_GRAPHICS_BIT) {
-            queueFamilyIndices.graphics = getQueueFamilyIndex(VK_QUEUE_GRAPHICS_BIT);
+        // A family may only appear once in the create infos, even when it serves several queue types
+        auto addQueueFamily = [&queueCreateInofs, &defaultQueuePriority](uint32_t familyIndex) {
+            for (auto &queueInfo: queueCreateInofs) {
+                if (queueInfo.queueFamilyIndex == familyIndex) {
+                    return;
+                }
+            }
             VkDeviceQueueCreateInfo queueInfo{};
             queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueInfo.queueFamilyIndex = queueFamilyIndices.graphics;
+            queueInfo.queueFamilyIndex = familyIndex;
             queueInfo.queueCount = 1;
             queueInfo.pQueuePriorities = &defaultQueuePriority;
             queueCreateInofs.push_back(queueInfo);
+        };
+
+        // Graphics queue
+        if (requestedQueueTypes & VK_QUEUE_GRAPHICS_BIT) {
+            queueFamilyIndices.graphics = getQueueFamilyIndex(VK_QUEUE_GRAPHICS_BIT);
+            addQueueFamily(queueFamilyIndices.graphics);
         } else {
             queueFamilyIndices.graphics = 0;
         }
@@ -68,25 +78,15 @@ namespace REF_VK {
         // Compute queue
         if (requestedQueueTypes & VK_QUEUE_COMPUTE_BIT) {
             queueFamilyIndices.compute = getQueueFamilyIndex(VK_QUEUE_COMPUTE_BIT);
-            VkDeviceQueueCreateInfo queueInfo{};
-            queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueInfo.queueFamilyIndex = queueFamilyIndices.compute;
-            queueInfo.queueCount = 1;
-            queueInfo.pQueuePriorities = &defaultQueuePriority;
-            queueCreateInofs.push_back(queueInfo);
+            addQueueFamily(queueFamilyIndices.compute);
         } else {
             queueFamilyIndices.compute = queueFamilyIndices.graphics;
         }
 
-        // Transfer queue
+        // Transfer queue, a dedicated DMA family when the device has one
         if (requestedQueueTypes & VK_QUEUE_TRANSFER_BIT) {
-            queueFamilyIndices.compute = getQueueFamilyIndex(VK_QUEUE_TRANSFER_BIT);
-            VkDeviceQueueCreateInfo queueInfo{};
-            queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueInfo.queueFamilyIndex = queueFamilyIndices.transfer;
-            queueInfo.queueCount = 1;
-            queueInfo.pQueuePriorities = &defaultQueuePriority;
-            queueCreateInofs.push_back(queueInfo);
+            queueFamilyIndices.transfer = getQueueFamilyIndex(VK_QUEUE_TRANSFER_BIT);
+            addQueueFamily(queueFamilyIndices.transfer);
         } else {
             queueFamilyIndices.transfer = queueFamilyIndices.graphics;
         }
@@ -0,0 +1,418 @@
+#include <common/CFileSystem.h>
+#include <common/CTools.h>
+#include <cstring>
+#include <filesystem>
+
+#if defined(_WIN32)
+
+#include <Windows.h>
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+
+namespace REF_VK {
+
+    // Quake PAK, 64 byte directory entries
+    const char PAK_MAGIC[4] = {'P', 'A', 'C', 'K'};
+    const size_t PAK_HEADER_SIZE = 12;
+    const size_t PAK_ENTRY_SIZE = 64;
+    const size_t PAK_NAME_SIZE = 56;
+
+    // PK3 is a zip, only the central directory and the local headers are read
+    const uint32_t ZIP_LOCAL_SIGNATURE = 0x04034b50;
+    const uint32_t ZIP_CENTRAL_SIGNATURE = 0x02014b50;
+    const uint32_t ZIP_END_SIGNATURE = 0x06054b50;
+    const size_t ZIP_LOCAL_SIZE = 30;
+    const size_t ZIP_CENTRAL_SIZE = 46;
+    const size_t ZIP_END_SIZE = 22;
+    const size_t ZIP_MAX_COMMENT = 0xffff;
+    const uint16_t ZIP_METHOD_STORED = 0;
+
+    static uint16_t readU16(const uint8_t *data) {
+        return static_cast<uint16_t>(data[0] | (data[1] << 8));
+    }
+
+    static uint32_t readU32(const uint8_t *data) {
+        return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+               (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    static const char *skipRoot(const char *path) {
+        for (;;) {
+            if (path[0] == '/' || path[0] == '\\') {
+                path++;
+            } else if (path[0] == '.' && (path[1] == '/' || path[1] == '\\')) {
+                path += 2;
+            } else {
+                return path;
+            }
+        }
+    }
+
+    static char normalizeChar(char c) {
+        if (c == '\\') {
+            return '/';
+        }
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    CMappedFile::~CMappedFile() {
+        close();
+    }
+
+    bool CMappedFile::open(const std::string &path) {
+        close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize{};
+        GetFileSizeEx(file, &fileSize);
+        size = static_cast<size_t>(fileSize.QuadPart);
+        // Empty files cannot be mapped, they open as an empty span
+        if (size > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                data = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            }
+        }
+        CloseHandle(file);
+        if (size > 0 && !data) {
+            close();
+            return false;
+        }
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+        struct stat fileStat{};
+        if (fstat(file, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+            ::close(file);
+            return false;
+        }
+        size = static_cast<size_t>(fileStat.st_size);
+        // Empty files cannot be mapped, they open as an empty span
+        if (size > 0) {
+            void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            data = memory == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(memory);
+        }
+        // The mapping keeps the file alive
+        ::close(file);
+        if (size > 0 && !data) {
+            size = 0;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    void CMappedFile::close() {
+#if defined(_WIN32)
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+#else
+        if (data) {
+            munmap(const_cast<uint8_t *>(data), size);
+        }
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    TFileSpan CMappedFile::getSpan() const {
+        return {data, size};
+    }
+
+    CFileSystem::~CFileSystem() {
+        unmountAll();
+    }
+
+    bool CFileSystem::mount(const std::string &path, bool underlay) {
+        std::error_code error{};
+        if (std::filesystem::is_directory(path, error)) {
+            return mountDirectory(path, underlay);
+        }
+        return mountArchive(path, underlay);
+    }
+
+    bool CFileSystem::mountDirectory(const std::string &path, bool underlay) {
+        std::error_code error{};
+        std::filesystem::path root(path);
+        std::filesystem::recursive_directory_iterator iterator(root, error);
+        if (error) {
+            LOG(ERR, ("Cannot mount directory " + path).c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t fileCount = 0;
+        for (; iterator != std::filesystem::recursive_directory_iterator(); iterator.increment(error)) {
+            if (error) {
+                break;
+            }
+            if (!iterator->is_regular_file(error)) {
+                continue;
+            }
+            TEntry entry{};
+            entry.name = normalizePath(iterator->path().lexically_relative(root).generic_string().c_str());
+            entry.diskPath = iterator->path().string();
+            entry.archive = -1;
+            entry.size = static_cast<size_t>(iterator->file_size(error));
+            insertEntry(std::move(entry), underlay);
+            fileCount++;
+        }
+        LOG(NORMAL, ("Mounted " + path + ", " + std::to_string(fileCount) + " files").c_str());
+        return true;
+    }
+
+    bool CFileSystem::mountArchive(const std::string &path, bool underlay) {
+        auto archive = std::make_unique<CMappedFile>();
+        if (!archive->open(path)) {
+            LOG(ERR, ("Cannot open archive " + path).c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        TFileSpan span = archive->getSpan();
+        auto archiveIndex = static_cast<int32_t>(archives.size());
+        bool indexed{};
+        if (span.size >= PAK_HEADER_SIZE && memcmp(span.data, PAK_MAGIC, sizeof(PAK_MAGIC)) == 0) {
+            indexed = indexPak(span, archiveIndex, path, underlay);
+        } else {
+            indexed = indexPk3(span, archiveIndex, path, underlay);
+        }
+        if (!indexed) {
+            return false;
+        }
+        archives.push_back(std::move(archive));
+        return true;
+    }
+
+    void CFileSystem::unmountAll() {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        entries.clear();
+        archives.clear();
+    }
+
+    bool CFileSystem::open(const char *path, TFileSpan *span) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto *entry = const_cast<TEntry *>(findEntry(path));
+        if (!entry) {
+            return false;
+        }
+
+        if (entry->archive >= 0) {
+            *span = {archives[entry->archive]->getSpan().data + entry->offset, entry->size};
+            return true;
+        }
+        if (!entry->looseFile) {
+            auto looseFile = std::make_unique<CMappedFile>();
+            if (!looseFile->open(entry->diskPath)) {
+                LOG(ERR, ("Cannot map " + entry->diskPath).c_str());
+                return false;
+            }
+            entry->looseFile = std::move(looseFile);
+        }
+        *span = entry->looseFile->getSpan();
+        return true;
+    }
+
+    bool CFileSystem::exists(const char *path) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return findEntry(path) != nullptr;
+    }
+
+    size_t CFileSystem::getFileCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.size();
+    }
+
+    uint64_t CFileSystem::hashPath(const char *path) {
+        uint64_t hash = 14695981039346656037ull;
+        for (const char *c = skipRoot(path); *c; ++c) {
+            hash ^= static_cast<uint8_t>(normalizeChar(*c));
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string CFileSystem::normalizePath(const char *path) {
+        std::string name(skipRoot(path));
+        for (auto &c: name) {
+            c = normalizeChar(c);
+        }
+        return name;
+    }
+
+    void CFileSystem::insertEntry(TEntry &&entry, bool underlay) {
+        uint64_t hash = hashPath(entry.name.c_str());
+        auto found = index.find(hash);
+        if (found != index.end() && entries[found->second].name != entry.name) {
+            LOG(ERR, ("Path hash collision between " + entries[found->second].name + " and " + entry.name).c_str());
+            return;
+        }
+        if (found != index.end() && underlay) {
+            return;
+        }
+        // An overridden entry stays in the list so its spans remain valid
+        index[hash] = static_cast<uint32_t>(entries.size());
+        entries.push_back(std::move(entry));
+    }
+
+    const CFileSystem::TEntry *CFileSystem::findEntry(const char *path) const {
+        if (!path) {
+            return nullptr;
+        }
+        auto found = index.find(hashPath(path));
+        if (found == index.end()) {
+            return nullptr;
+        }
+
+        // Compare without building the normalized string
+        const TEntry &entry = entries[found->second];
+        const char *c = skipRoot(path);
+        size_t i = 0;
+        for (; c[i] && i < entry.name.size(); ++i) {
+            if (normalizeChar(c[i]) != entry.name[i]) {
+                return nullptr;
+            }
+        }
+        return (c[i] == 0 && i == entry.name.size()) ? &entry : nullptr;
+    }
+
+    bool CFileSystem::indexPak(const TFileSpan &archive, int32_t archiveIndex, const std::string &path,
+                               bool underlay) {
+        size_t directoryOffset = readU32(archive.data + 4);
+        size_t directorySize = readU32(archive.data + 8);
+        if (directoryOffset > archive.size || directorySize > archive.size - directoryOffset ||
+            directorySize % PAK_ENTRY_SIZE != 0) {
+            LOG(ERR, ("Corrupt PAK directory in " + path).c_str());
+            return false;
+        }
+
+        size_t fileCount = directorySize / PAK_ENTRY_SIZE;
+        for (size_t i = 0; i < fileCount; ++i) {
+            const uint8_t *record = archive.data + directoryOffset + i * PAK_ENTRY_SIZE;
+            TEntry entry{};
+            const char *name = reinterpret_cast<const char *>(record);
+            entry.name = normalizePath(std::string(name, strnlen(name, PAK_NAME_SIZE)).c_str());
+            entry.archive = archiveIndex;
+            entry.offset = readU32(record + PAK_NAME_SIZE);
+            entry.size = readU32(record + PAK_NAME_SIZE + 4);
+            if (entry.offset > archive.size || entry.size > archive.size - entry.offset) {
+                LOG(ERR, ("Corrupt PAK entry " + entry.name + " in " + path).c_str());
+                continue;
+            }
+            insertEntry(std::move(entry), underlay);
+        }
+        LOG(NORMAL, ("Mounted " + path + ", " + std::to_string(fileCount) + " files").c_str());
+        return true;
+    }
+
+    bool CFileSystem::indexPk3(const TFileSpan &archive, int32_t archiveIndex, const std::string &path,
+                               bool underlay) {
+        if (archive.size < ZIP_END_SIZE) {
+            LOG(ERR, ("Unknown archive format " + path).c_str());
+            return false;
+        }
+
+        // The end record sits behind the central directory, followed only by the archive comment
+        const uint8_t *end = nullptr;
+        size_t searchStart = archive.size > ZIP_END_SIZE + ZIP_MAX_COMMENT ? archive.size - ZIP_END_SIZE - ZIP_MAX_COMMENT
+                                                                           : 0;
+        for (size_t offset = archive.size - ZIP_END_SIZE + 1; offset-- > searchStart;) {
+            if (readU32(archive.data + offset) == ZIP_END_SIGNATURE) {
+                end = archive.data + offset;
+                break;
+            }
+        }
+        if (!end) {
+            LOG(ERR, ("Unknown archive format " + path).c_str());
+            return false;
+        }
+
+        size_t fileCount = readU16(end + 10);
+        size_t directorySize = readU32(end + 12);
+        size_t directoryOffset = readU32(end + 16);
+        if (directoryOffset > archive.size || directorySize > archive.size - directoryOffset) {
+            LOG(ERR, ("Corrupt PK3 directory in " + path).c_str());
+            return false;
+        }
+
+        const uint8_t *record = archive.data + directoryOffset;
+        const uint8_t *directoryEnd = record + directorySize;
+        size_t indexedCount = 0;
+        size_t compressedCount = 0;
+        for (size_t i = 0; i < fileCount; ++i) {
+            if (record + ZIP_CENTRAL_SIZE > directoryEnd || readU32(record) != ZIP_CENTRAL_SIGNATURE) {
+                LOG(ERR, ("Corrupt PK3 directory in " + path).c_str());
+                return false;
+            }
+            uint16_t method = readU16(record + 10);
+            size_t compressedSize = readU32(record + 20);
+            size_t uncompressedSize = readU32(record + 24);
+            size_t nameLength = readU16(record + 28);
+            size_t extraLength = readU16(record + 30);
+            size_t commentLength = readU16(record + 32);
+            size_t localOffset = readU32(record + 42);
+            const char *name = reinterpret_cast<const char *>(record + ZIP_CENTRAL_SIZE);
+            if (record + ZIP_CENTRAL_SIZE + nameLength > directoryEnd) {
+                LOG(ERR, ("Corrupt PK3 directory in " + path).c_str());
+                return false;
+            }
+            record += ZIP_CENTRAL_SIZE + nameLength + extraLength + commentLength;
+
+            // Directories have no data
+            if (nameLength == 0 || name[nameLength - 1] == '/') {
+                continue;
+            }
+            // Only stored members can be handed out without a copy
+            if (method != ZIP_METHOD_STORED || compressedSize != uncompressedSize) {
+                compressedCount++;
+                continue;
+            }
+            // The local header repeats the name and may carry a different extra field
+            if (localOffset > archive.size || archive.size - localOffset < ZIP_LOCAL_SIZE ||
+                readU32(archive.data + localOffset) != ZIP_LOCAL_SIGNATURE) {
+                continue;
+            }
+            size_t dataOffset = localOffset + ZIP_LOCAL_SIZE + readU16(archive.data + localOffset + 26) +
+                                readU16(archive.data + localOffset + 28);
+            if (dataOffset > archive.size || compressedSize > archive.size - dataOffset) {
+                continue;
+            }
+
+            TEntry entry{};
+            entry.name = normalizePath(std::string(name, nameLength).c_str());
+            entry.archive = archiveIndex;
+            entry.offset = dataOffset;
+            entry.size = compressedSize;
+            insertEntry(std::move(entry), underlay);
+            indexedCount++;
+        }
+
+        if (compressedCount > 0) {
+            LOG(ERR, (path + ": " + std::to_string(compressedCount) +
+                      " compressed files skipped, repack them stored").c_str());
+        }
+        LOG(NORMAL, ("Mounted " + path + ", " + std::to_string(indexedCount) + " files").c_str());
+        return true;
+    }
+
+}
@@ -0,0 +1,124 @@
+#include <common/CFrameArena.h>
+#include <common/CTools.h>
+#include <cassert>
+#include <cstdlib>
+
+
+namespace REF_VK {
+
+    // Every overflow block uses the same alignment so it can be released without remembering it
+    static const size_t OVERFLOW_ALIGNMENT = 64;
+
+    static size_t alignUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    bool CFrameArena::create(size_t size) {
+        block = static_cast<uint8_t *>(std::malloc(size));
+        capacity = block ? size : 0;
+        used = 0;
+        if (!block) {
+            LOG(ERR, "Cannot allocate frame arena!");
+            return false;
+        }
+        return true;
+    }
+
+    void CFrameArena::destroy() {
+        reset();
+        std::free(block);
+        block = nullptr;
+        capacity = 0;
+    }
+
+    void *CFrameArena::allocate(size_t size, size_t alignment) {
+        size_t offset = used.load(std::memory_order_relaxed);
+        for (;;) {
+            // Offsets are aligned relative to the block, which malloc aligns for every fundamental type
+            size_t aligned = alignUp(offset, alignment);
+            if (aligned + size > capacity) {
+                break;
+            }
+            if (used.compare_exchange_weak(offset, aligned + size, std::memory_order_relaxed)) {
+                return block + aligned;
+            }
+        }
+
+        assert(alignment <= OVERFLOW_ALIGNMENT);
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        void *memory = ::operator new(size, std::align_val_t(OVERFLOW_ALIGNMENT));
+        overflowBlocks.push_back(memory);
+        overflowBytes += size + alignment;
+        return memory;
+    }
+
+    void CFrameArena::reset() {
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        for (auto memory: overflowBlocks) {
+            ::operator delete(memory, std::align_val_t(OVERFLOW_ALIGNMENT));
+        }
+        overflowBlocks.clear();
+
+        // Grow once so the same frame fits next time, steady state never reaches the heap
+        if (overflowBytes > 0 && block) {
+            size_t newCapacity = (capacity + overflowBytes) * 3 / 2;
+            uint8_t *newBlock = static_cast<uint8_t *>(std::malloc(newCapacity));
+            if (newBlock) {
+                std::free(block);
+                block = newBlock;
+                capacity = newCapacity;
+                LOG(NORMAL, ("Frame arena grown to " + std::to_string(capacity / 1024) + " KB").c_str());
+            }
+        }
+        overflowBytes = 0;
+        used = 0;
+    }
+
+    size_t CFrameArena::getUsedBytes() const {
+        return used.load();
+    }
+
+    size_t CFrameArena::getCapacity() const {
+        return capacity;
+    }
+
+    CScratchArena &CScratchArena::get() {
+        thread_local CScratchArena arena{};
+        return arena;
+    }
+
+    CScratchArena::~CScratchArena() {
+        rewind({0, 0});
+        std::free(block);
+    }
+
+    void *CScratchArena::allocate(size_t size, size_t alignment) {
+        if (!block) {
+            block = static_cast<uint8_t *>(std::malloc(SCRATCH_SIZE));
+        }
+        size_t aligned = alignUp(offset, alignment);
+        if (block && aligned + size <= SCRATCH_SIZE) {
+            offset = aligned + size;
+            return block + aligned;
+        }
+
+        // Too large for the scratch block, lives until the scope that made it ends
+        assert(alignment <= OVERFLOW_ALIGNMENT);
+        void *memory = ::operator new(size, std::align_val_t(OVERFLOW_ALIGNMENT));
+        overflowBlocks.push_back(memory);
+        return memory;
+    }
+
+    CScratchArena::TMarker CScratchArena::getMarker() const {
+        return {offset, overflowBlocks.size()};
+    }
+
+    void CScratchArena::rewind(const TMarker &marker) {
+        while (overflowBlocks.size() > marker.overflowCount) {
+            ::operator delete(overflowBlocks.back(), std::align_val_t(OVERFLOW_ALIGNMENT));
+            overflowBlocks.pop_back();
+        }
+        offset = marker.offset;
+    }
+
+}
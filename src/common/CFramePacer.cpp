@@ -0,0 +1,85 @@
+#include <common/CFramePacer.h>
+#include <thread>
+
+
+namespace REF_VK {
+
+    static float toMs(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<float, std::milli>(duration).count();
+    }
+
+    void CFramePacer::setMaxFps(int fps) {
+        if (fps > 0) {
+            targetFrameTime = std::chrono::duration_cast<TClock::duration>(std::chrono::duration<double>(1.0 / fps));
+        } else {
+            targetFrameTime = TClock::duration::zero();
+        }
+    }
+
+    void CFramePacer::limit() {
+        TClock::time_point start = TClock::now();
+        if (targetFrameTime > TClock::duration::zero() && lastFrameStart.time_since_epoch().count() != 0) {
+            TClock::time_point deadline = lastFrameStart + targetFrameTime;
+            // Sleep coarsely, then spin the last millisecond, OS sleeps overshoot
+            TClock::time_point coarse = deadline - std::chrono::milliseconds(1);
+            if (start < coarse) {
+                std::this_thread::sleep_until(coarse);
+            }
+            while (TClock::now() < deadline) {
+                std::this_thread::yield();
+            }
+        }
+        TClock::time_point now = TClock::now();
+        stats.limiterWaitMs = toMs(now - start);
+        lastFrameStart = now;
+    }
+
+    CFramePacer::TFrameTimes &CFramePacer::times(uint64_t frame) {
+        TFrameTimes &entry = history[frame % HISTORY_SIZE];
+        if (entry.frame != frame) {
+            entry = {};
+            entry.frame = frame;
+        }
+        return entry;
+    }
+
+    void CFramePacer::markInputSample(uint64_t frame) {
+        times(frame).inputSample = TClock::now();
+    }
+
+    bool CFramePacer::hasInputSample(uint64_t frame) const {
+        const TFrameTimes &entry = history[frame % HISTORY_SIZE];
+        return entry.frame == frame && entry.inputSample.time_since_epoch().count() != 0;
+    }
+
+    void CFramePacer::markAcquire(uint64_t frame) {
+        times(frame).acquire = TClock::now();
+    }
+
+    void CFramePacer::markPresent(uint64_t frame) {
+        TFrameTimes &entry = times(frame);
+        entry.present = TClock::now();
+        stats.acquireToPresentMs = toMs(entry.present - entry.acquire);
+        if (!stats.presentWait) {
+            stats.inputToPresentMs = toMs(entry.present - entry.inputSample);
+        }
+    }
+
+    void CFramePacer::markDisplayed(uint64_t frame) {
+        const TFrameTimes &entry = history[frame % HISTORY_SIZE];
+        if (entry.frame != frame) {
+            // Too old, the history already wrapped
+            return;
+        }
+        stats.inputToPresentMs = toMs(TClock::now() - entry.inputSample);
+    }
+
+    void CFramePacer::setPresentWait(bool enable) {
+        stats.presentWait = enable;
+    }
+
+    const TLatencyStats &CFramePacer::getStats() const {
+        return stats;
+    }
+
+}
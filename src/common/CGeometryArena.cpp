@@ -0,0 +1,354 @@
+#include <common/CGeometryArena.h>
+#include <common/CTools.h>
+#include <common/CMemoryBudget.h>
+#include <algorithm>
+#include <map>
+
+
+namespace REF_VK {
+
+    bool CGeometryArena::create(VmaAllocator allocator, CUploader *meshUploader, uint32_t stride,
+                                uint32_t verticesPerPage, uint32_t indicesPerPage,
+                                CDefragmenter *memoryDefragmenter) {
+        vmaAllocator = allocator;
+        uploader = meshUploader;
+        defragmenter = memoryDefragmenter;
+        vertexStride = stride;
+        pageVertices = verticesPerPage;
+        pageIndices = indicesPerPage;
+
+        // Open the first page up front so a failure shows at startup instead of at the first mesh
+        TPage page{};
+        if (!createPage(&page, 0)) {
+            return false;
+        }
+        pages.push_back(page);
+        return true;
+    }
+
+    void CGeometryArena::destroy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &page: pages) {
+            destroyPage(page, nullptr, 0);
+        }
+        pages.clear();
+        meshes.clear();
+        freeHandles.clear();
+        pendingFrees.clear();
+        collectedFrees = 0;
+    }
+
+    TGeometryHandle CGeometryArena::allocate(const void *vertexData, uint32_t vertexCount, const uint32_t *indexData,
+                                             uint32_t indexCount) {
+        if (vertexCount == 0 || indexCount == 0 || vertexCount > pageVertices || indexCount > pageIndices) {
+            LOG(ERR, "Mesh does not fit a geometry arena page!");
+            return INVALID_GEOMETRY;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        TMesh mesh{};
+        if (!placeMesh(pages, vertexCount, indexCount, &mesh)) {
+            return INVALID_GEOMETRY;
+        }
+
+        const TPage &page = pages[mesh.range.page];
+        VkDeviceSize vertexOffset = static_cast<VkDeviceSize>(mesh.range.vertexOffset) * vertexStride;
+        VkDeviceSize indexOffset = static_cast<VkDeviceSize>(mesh.range.firstIndex) * sizeof(uint32_t);
+        TUploadToken vertexToken = uploader->uploadBuffer(page.vertexBuffer, page.vertexAllocation, vertexOffset,
+                                                          vertexData,
+                                                          static_cast<VkDeviceSize>(vertexCount) * vertexStride,
+                                                          VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                                          VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+        TUploadToken indexToken = uploader->uploadBuffer(page.indexBuffer, page.indexAllocation, indexOffset,
+                                                         indexData,
+                                                         static_cast<VkDeviceSize>(indexCount) * sizeof(uint32_t),
+                                                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+        // A failed upload leaves token 0, the mesh then never becomes drawable
+        mesh.range.token = vertexToken && indexToken ? std::max(vertexToken, indexToken) : 0;
+        mesh.live = true;
+
+        TGeometryHandle handle{};
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            meshes[handle - 1] = mesh;
+        } else {
+            meshes.push_back(mesh);
+            handle = static_cast<TGeometryHandle>(meshes.size());
+        }
+        return handle;
+    }
+
+    void CGeometryArena::free(TGeometryHandle handle, uint64_t frame) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (handle == INVALID_GEOMETRY || handle > meshes.size() || !meshes[handle - 1].live) {
+            return;
+        }
+        // The ranges stay allocated until the frames that drew the mesh are done
+        meshes[handle - 1].live = false;
+        pendingFrees.push_back({handle, frame});
+    }
+
+    void CGeometryArena::collect(uint64_t completedFrame) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::remove_if(pendingFrees.begin(), pendingFrees.end(), [&](const TPendingFree &pending) {
+            if (pending.frame > completedFrame) {
+                return false;
+            }
+            const TMesh &mesh = meshes[pending.handle - 1];
+            const TPage &page = pages[mesh.range.page];
+            vmaVirtualFree(page.vertexBlock, mesh.vertexRange);
+            vmaVirtualFree(page.indexBlock, mesh.indexRange);
+            freeHandles.push_back(pending.handle);
+            ++collectedFrees;
+            return true;
+        });
+        pendingFrees.erase(it, pendingFrees.end());
+    }
+
+    bool CGeometryArena::compact(VkCommandBuffer commandBuffer, CDeletionQueue &deletionQueue, uint64_t frame) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Every page is still densely packed, copying would only move the same layout
+        if (collectedFrees == 0 && pendingFrees.empty()) {
+            return false;
+        }
+
+        // Plan the new layout first, nothing is recorded if it does not fit
+        std::vector<TPage> newPages{};
+        std::vector<TMesh> newMeshes = meshes;
+        for (auto &mesh: newMeshes) {
+            if (!mesh.live) {
+                continue;
+            }
+            if (!placeMesh(newPages, mesh.range.vertexCount, mesh.range.indexCount, &mesh)) {
+                for (auto &page: newPages) {
+                    destroyPage(page, nullptr, 0);
+                }
+                return false;
+            }
+        }
+
+        // Copies grouped by source and destination page
+        std::map<std::pair<uint32_t, uint32_t>, std::vector<VkBufferCopy>> vertexCopies{};
+        std::map<std::pair<uint32_t, uint32_t>, std::vector<VkBufferCopy>> indexCopies{};
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            if (!meshes[i].live) {
+                continue;
+            }
+            const TMeshRange &oldRange = meshes[i].range;
+            const TMeshRange &newRange = newMeshes[i].range;
+            auto key = std::make_pair(oldRange.page, newRange.page);
+
+            VkBufferCopy vertexCopy{};
+            vertexCopy.srcOffset = static_cast<VkDeviceSize>(oldRange.vertexOffset) * vertexStride;
+            vertexCopy.dstOffset = static_cast<VkDeviceSize>(newRange.vertexOffset) * vertexStride;
+            vertexCopy.size = static_cast<VkDeviceSize>(oldRange.vertexCount) * vertexStride;
+            vertexCopies[key].push_back(vertexCopy);
+
+            VkBufferCopy indexCopy{};
+            indexCopy.srcOffset = static_cast<VkDeviceSize>(oldRange.firstIndex) * sizeof(uint32_t);
+            indexCopy.dstOffset = static_cast<VkDeviceSize>(newRange.firstIndex) * sizeof(uint32_t);
+            indexCopy.size = static_cast<VkDeviceSize>(oldRange.indexCount) * sizeof(uint32_t);
+            indexCopies[key].push_back(indexCopy);
+        }
+        for (auto &copies: vertexCopies) {
+            vkCmdCopyBuffer(commandBuffer, pages[copies.first.first].vertexBuffer,
+                            newPages[copies.first.second].vertexBuffer,
+                            static_cast<uint32_t>(copies.second.size()), copies.second.data());
+        }
+        for (auto &copies: indexCopies) {
+            vkCmdCopyBuffer(commandBuffer, pages[copies.first.first].indexBuffer,
+                            newPages[copies.first.second].indexBuffer,
+                            static_cast<uint32_t>(copies.second.size()), copies.second.data());
+        }
+
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+                             1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        for (auto &page: pages) {
+            destroyPage(page, &deletionQueue, frame);
+        }
+        pages.swap(newPages);
+        meshes.swap(newMeshes);
+        // Pending ranges were left behind in the old pages, which outlive every frame using them
+        for (auto &pending: pendingFrees) {
+            freeHandles.push_back(pending.handle);
+        }
+        pendingFrees.clear();
+        collectedFrees = 0;
+
+        // Keep one page open for the next map's first mesh
+        if (pages.empty()) {
+            TPage page{};
+            if (createPage(&page, 0)) {
+                pages.push_back(page);
+            }
+        }
+        return true;
+    }
+
+    bool CGeometryArena::getRange(TGeometryHandle handle, TMeshRange *range) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (handle == INVALID_GEOMETRY || handle > meshes.size() || !meshes[handle - 1].live) {
+            return false;
+        }
+        *range = meshes[handle - 1].range;
+        return true;
+    }
+
+    void CGeometryArena::bindPage(VkCommandBuffer commandBuffer, uint32_t page) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        VkDeviceSize offsets[1]{0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &pages[page].vertexBuffer, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, pages[page].indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    }
+
+    uint32_t CGeometryArena::getPageCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<uint32_t>(pages.size());
+    }
+
+    uint32_t CGeometryArena::getLiveMeshCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<uint32_t>(std::count_if(meshes.begin(), meshes.end(),
+                                                   [](const TMesh &mesh) { return mesh.live; }));
+    }
+
+    bool CGeometryArena::createPage(TPage *page, uint32_t index) {
+        // Host visible device memory is preferred when it exists, meshes are then written in place
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                          VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT;
+        allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_GEOMETRY);
+
+        // Compaction copies out of old pages, so both ends of a transfer are allowed
+        VkBufferCreateInfo bufferCI{};
+        bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        bufferCI.size = static_cast<VkDeviceSize>(pageVertices) * vertexStride;
+        bufferCI.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        if (!VK_CHECK_RESULT(vmaCreateBuffer(vmaAllocator, &bufferCI, &allocInfo, &page->vertexBuffer,
+                                             &page->vertexAllocation, nullptr),
+                             "Cannot create geometry arena vertex buffer!")) {
+            return false;
+        }
+        CMemoryBudget::track(vmaAllocator, page->vertexAllocation);
+        VkBufferCreateInfo vertexBufferCI = bufferCI;
+
+        bufferCI.size = static_cast<VkDeviceSize>(pageIndices) * sizeof(uint32_t);
+        bufferCI.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        if (!VK_CHECK_RESULT(vmaCreateBuffer(vmaAllocator, &bufferCI, &allocInfo, &page->indexBuffer,
+                                             &page->indexAllocation, nullptr),
+                             "Cannot create geometry arena index buffer!")) {
+            CMemoryBudget::untrack(vmaAllocator, page->vertexAllocation);
+            vmaDestroyBuffer(vmaAllocator, page->vertexBuffer, page->vertexAllocation);
+            return false;
+        }
+        CMemoryBudget::track(vmaAllocator, page->indexAllocation);
+
+        // Draws bind pages by index, a defragmented page only needs its handle replaced
+        if (defragmenter) {
+            defragmenter->registerBuffer(page->vertexAllocation, page->vertexBuffer, vertexBufferCI,
+                                         [this, index](VkBuffer buffer) {
+                                             std::lock_guard<std::mutex> lock(mutex);
+                                             pages[index].vertexBuffer = buffer;
+                                         });
+            defragmenter->registerBuffer(page->indexAllocation, page->indexBuffer, bufferCI,
+                                         [this, index](VkBuffer buffer) {
+                                             std::lock_guard<std::mutex> lock(mutex);
+                                             pages[index].indexBuffer = buffer;
+                                         });
+        }
+
+        // Virtual blocks count whole vertices and indices, so offsets are directly usable in draws
+        VmaVirtualBlockCreateInfo blockCI{};
+        blockCI.size = pageVertices;
+        if (!VK_CHECK_RESULT(vmaCreateVirtualBlock(&blockCI, &page->vertexBlock),
+                             "Cannot create geometry arena vertex block!")) {
+            destroyPage(*page, nullptr, 0);
+            return false;
+        }
+        blockCI.size = pageIndices;
+        if (!VK_CHECK_RESULT(vmaCreateVirtualBlock(&blockCI, &page->indexBlock),
+                             "Cannot create geometry arena index block!")) {
+            destroyPage(*page, nullptr, 0);
+            return false;
+        }
+        return true;
+    }
+
+    void CGeometryArena::destroyPage(TPage &page, CDeletionQueue *deletionQueue, uint64_t frame) {
+        if (defragmenter) {
+            defragmenter->unregister(page.vertexAllocation);
+            defragmenter->unregister(page.indexAllocation);
+        }
+        // A page whose creation failed may lack its blocks
+        if (page.vertexBlock) {
+            vmaClearVirtualBlock(page.vertexBlock);
+            vmaDestroyVirtualBlock(page.vertexBlock);
+        }
+        if (page.indexBlock) {
+            vmaClearVirtualBlock(page.indexBlock);
+            vmaDestroyVirtualBlock(page.indexBlock);
+        }
+
+        if (deletionQueue) {
+            deletionQueue->destroyBuffer(page.vertexBuffer, page.vertexAllocation, frame);
+            deletionQueue->destroyBuffer(page.indexBuffer, page.indexAllocation, frame);
+        } else {
+            CMemoryBudget::untrack(vmaAllocator, page.vertexAllocation);
+            CMemoryBudget::untrack(vmaAllocator, page.indexAllocation);
+            vmaDestroyBuffer(vmaAllocator, page.vertexBuffer, page.vertexAllocation);
+            vmaDestroyBuffer(vmaAllocator, page.indexBuffer, page.indexAllocation);
+        }
+    }
+
+    bool CGeometryArena::placeMesh(std::vector<TPage> &targetPages, uint32_t vertexCount, uint32_t indexCount,
+                                   TMesh *mesh) {
+        VmaVirtualAllocationCreateInfo vertexAllocCI{};
+        vertexAllocCI.size = vertexCount;
+        VmaVirtualAllocationCreateInfo indexAllocCI{};
+        indexAllocCI.size = indexCount;
+
+        for (uint32_t pass = 0; pass < 2; ++pass) {
+            for (uint32_t i = 0; i < targetPages.size(); ++i) {
+                TPage &page = targetPages[i];
+                VkDeviceSize vertexOffset{}, firstIndex{};
+                if (vmaVirtualAllocate(page.vertexBlock, &vertexAllocCI, &mesh->vertexRange, &vertexOffset) !=
+                    VK_SUCCESS) {
+                    continue;
+                }
+                if (vmaVirtualAllocate(page.indexBlock, &indexAllocCI, &mesh->indexRange, &firstIndex) !=
+                    VK_SUCCESS) {
+                    vmaVirtualFree(page.vertexBlock, mesh->vertexRange);
+                    continue;
+                }
+                mesh->range.page = i;
+                mesh->range.vertexOffset = static_cast<int32_t>(vertexOffset);
+                mesh->range.vertexCount = vertexCount;
+                mesh->range.firstIndex = static_cast<uint32_t>(firstIndex);
+                mesh->range.indexCount = indexCount;
+                return true;
+            }
+
+            // Every page is full, open another one and try again
+            TPage page{};
+            if (pass > 0 || !createPage(&page, static_cast<uint32_t>(targetPages.size()))) {
+                break;
+            }
+            targetPages.push_back(page);
+        }
+
+        LOG(ERR, "Geometry arena is out of memory!");
+        return false;
+    }
+
+}
@@ -0,0 +1,198 @@
+#include <common/CGpuProfiler.h>
+#include <common/CTools.h>
+#include <cstdio>
+
+
+namespace REF_VK {
+
+    static const char *GPU_SCOPE_NAMES[GPU_SCOPE_COUNT] = {
+            "frame",
+            "world",
+            "2d",
+    };
+
+    bool CGpuProfiler::create(CDevice *cDevice, uint32_t slotCount) {
+        device = cDevice->device;
+        timestampPeriod = cDevice->properties.limits.timestampPeriod;
+
+        uint32_t validBits = cDevice->queueFamilyProperties[cDevice->queueFamilyIndices.graphics].timestampValidBits;
+        timestampsSupported = validBits > 0 && cDevice->properties.limits.timestampComputeAndGraphics;
+        timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+        // The queries stay active while the primary executes secondaries, which must inherit them
+        statisticsSupported = cDevice->enableFeatures.pipelineStatisticsQuery &&
+                              cDevice->enableFeatures.inheritedQueries;
+        statisticFlags = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+                         VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                         VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+        for (int i = 0; i < GPU_SCOPE_COUNT; ++i) {
+            scopeStats[i].name = GPU_SCOPE_NAMES[i];
+        }
+
+        if (!timestampsSupported) {
+            LOG(NORMAL, "GPU timestamps are not supported on the graphics queue, profiler disabled");
+        }
+
+        slots.resize(slotCount);
+        for (auto &slot: slots) {
+            slot = {};
+            if (timestampsSupported) {
+                // Begin and end timestamp per scope
+                VkQueryPoolCreateInfo queryPoolCI{};
+                queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                queryPoolCI.queryCount = GPU_SCOPE_COUNT * 2;
+                if (!VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &slot.timestampPool),
+                                     "Cannot create timestamp query pool!")) {
+                    return false;
+                }
+            }
+            if (statisticsSupported) {
+                VkQueryPoolCreateInfo queryPoolCI{};
+                queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                queryPoolCI.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+                queryPoolCI.queryCount = GPU_SCOPE_COUNT;
+                queryPoolCI.pipelineStatistics = statisticFlags;
+                if (!VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &slot.statisticsPool),
+                                     "Cannot create pipeline statistics query pool!")) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void CGpuProfiler::destroy() {
+        for (auto &slot: slots) {
+            if (slot.timestampPool) {
+                vkDestroyQueryPool(device, slot.timestampPool, nullptr);
+            }
+            if (slot.statisticsPool) {
+                vkDestroyQueryPool(device, slot.statisticsPool, nullptr);
+            }
+        }
+        slots.clear();
+    }
+
+    void CGpuProfiler::resolveSlot(uint32_t slot) {
+        TQuerySlot &querySlot = slots[slot];
+
+        if (querySlot.timestampPool) {
+            // Value and availability pairs, scopes not recorded in that frame stay unavailable
+            std::array<uint64_t, GPU_SCOPE_COUNT * 2 * 2> timestamps{};
+            VkResult result = vkGetQueryPoolResults(device, querySlot.timestampPool, 0, GPU_SCOPE_COUNT * 2,
+                                                    sizeof(timestamps), timestamps.data(), sizeof(uint64_t) * 2,
+                                                    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+            if (result == VK_SUCCESS || result == VK_NOT_READY) {
+                for (int i = 0; i < GPU_SCOPE_COUNT; ++i) {
+                    const uint64_t *begin = &timestamps[i * 4];
+                    const uint64_t *end = &timestamps[i * 4 + 2];
+                    if (!begin[1] || !end[1]) {
+                        continue;
+                    }
+                    uint64_t ticks = ((end[0] & timestampMask) - (begin[0] & timestampMask)) & timestampMask;
+                    float ms = static_cast<float>(ticks) * timestampPeriod / 1000000.0f;
+                    scopeStats[i].gpuMs = ms;
+                    scopeStats[i].avgGpuMs = scopeStats[i].avgGpuMs * 0.9f + ms * 0.1f;
+                }
+            }
+        }
+
+        if (querySlot.statisticsPool) {
+            std::array<uint64_t, GPU_SCOPE_COUNT * (STATISTIC_COUNT + 1)> statistics{};
+            VkResult result = vkGetQueryPoolResults(device, querySlot.statisticsPool, 0, GPU_SCOPE_COUNT,
+                                                    sizeof(statistics), statistics.data(),
+                                                    sizeof(uint64_t) * (STATISTIC_COUNT + 1),
+                                                    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+            if (result == VK_SUCCESS || result == VK_NOT_READY) {
+                for (int i = 0; i < GPU_SCOPE_COUNT; ++i) {
+                    // Values are ordered by flag bit, availability comes last
+                    const uint64_t *values = &statistics[i * (STATISTIC_COUNT + 1)];
+                    if (!values[STATISTIC_COUNT]) {
+                        continue;
+                    }
+                    scopeStats[i].inputPrimitives = values[0];
+                    scopeStats[i].vertexInvocations = values[1];
+                    scopeStats[i].fragmentInvocations = values[2];
+                }
+            }
+        }
+    }
+
+    void CGpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t slot) {
+        if (slots.empty()) {
+            return;
+        }
+        currentSlot = slot;
+        TQuerySlot &querySlot = slots[slot];
+        if (querySlot.recorded) {
+            resolveSlot(slot);
+        }
+        querySlot.recorded = true;
+
+        if (querySlot.timestampPool) {
+            vkCmdResetQueryPool(commandBuffer, querySlot.timestampPool, 0, GPU_SCOPE_COUNT * 2);
+        }
+        if (querySlot.statisticsPool) {
+            vkCmdResetQueryPool(commandBuffer, querySlot.statisticsPool, 0, GPU_SCOPE_COUNT);
+        }
+    }
+
+    void CGpuProfiler::beginScope(VkCommandBuffer commandBuffer, EGpuScope scope) {
+        if (slots.empty()) {
+            return;
+        }
+        TQuerySlot &querySlot = slots[currentSlot];
+        if (querySlot.timestampPool) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, querySlot.timestampPool, scope * 2);
+        }
+        // The frame scope encloses the others, it only gets timestamps
+        if (querySlot.statisticsPool && scope != GPU_SCOPE_FRAME && statisticsScope == -1) {
+            statisticsScope = scope;
+            vkCmdBeginQuery(commandBuffer, querySlot.statisticsPool, scope, 0);
+        }
+    }
+
+    void CGpuProfiler::endScope(VkCommandBuffer commandBuffer, EGpuScope scope) {
+        if (slots.empty()) {
+            return;
+        }
+        TQuerySlot &querySlot = slots[currentSlot];
+        if (querySlot.statisticsPool && scope != GPU_SCOPE_FRAME && statisticsScope == scope) {
+            statisticsScope = -1;
+            vkCmdEndQuery(commandBuffer, querySlot.statisticsPool, scope);
+        }
+        if (querySlot.timestampPool) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, querySlot.timestampPool,
+                                scope * 2 + 1);
+        }
+    }
+
+    VkQueryPipelineStatisticFlags CGpuProfiler::getInheritedStatistics() const {
+        return statisticsSupported ? statisticFlags : 0;
+    }
+
+    const TGpuScopeStats &CGpuProfiler::getScopeStats(EGpuScope scope) const {
+        return scopeStats[scope];
+    }
+
+    bool CGpuProfiler::speedsMessage(char *out, size_t size) const {
+        if (!out || size == 0 || !timestampsSupported) {
+            return false;
+        }
+
+        size_t used = 0;
+        for (const auto &stats: scopeStats) {
+            int written = snprintf(out + used, size - used, "%-10s %6.2f ms (avg %6.2f) %8llu prims %10llu frags\n",
+                                   stats.name, stats.gpuMs, stats.avgGpuMs, stats.inputPrimitives,
+                                   stats.fragmentInvocations);
+            if (written < 0 || static_cast<size_t>(written) >= size - used) {
+                break;
+            }
+            used += written;
+        }
+        return true;
+    }
+
+}
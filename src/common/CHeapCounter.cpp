@@ -0,0 +1,147 @@
+#include <common/CHeapCounter.h>
+#include <cstdlib>
+#include <new>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+
+#if defined(REF_VK_HEAP_COUNTER)
+
+// Per thread, so the render thread's check does not see the workers or the engine's other threads
+static thread_local uint64_t heapAllocations = 0;
+
+static void *alignedAlloc(size_t size, std::align_val_t alignment) {
+    size_t align = static_cast<size_t>(alignment);
+#if defined(_WIN32)
+    return _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc wants a multiple of the alignment
+    size = (size + align - 1) & ~(align - 1);
+    return std::aligned_alloc(align, size ? size : align);
+#endif
+}
+
+static void alignedFree(void *memory) {
+#if defined(_WIN32)
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+
+// Every form is replaced, the standard library does not route the aligned ones through the plain one
+void *operator new(size_t size) {
+    ++heapAllocations;
+    void *memory = std::malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void *operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    ++heapAllocations;
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+    return ::operator new(size, tag);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
+
+// Over-aligned types, the frame arena's overflow blocks among them
+void *operator new(size_t size, std::align_val_t alignment) {
+    ++heapAllocations;
+    void *memory = alignedAlloc(size, alignment);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return ::operator new(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    ++heapAllocations;
+    return alignedAlloc(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept {
+    return ::operator new(size, alignment, tag);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+    alignedFree(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+    alignedFree(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+    alignedFree(memory);
+}
+
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+    alignedFree(memory);
+}
+
+void operator delete(void *memory, std::align_val_t, const std::nothrow_t &) noexcept {
+    alignedFree(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t, const std::nothrow_t &) noexcept {
+    alignedFree(memory);
+}
+
+#endif
+
+namespace REF_VK {
+
+    bool CHeapCounter::isEnabled() {
+#if defined(REF_VK_HEAP_COUNTER)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    uint64_t CHeapCounter::getAllocations() {
+#if defined(REF_VK_HEAP_COUNTER)
+        return heapAllocations;
+#else
+        return 0;
+#endif
+    }
+
+}
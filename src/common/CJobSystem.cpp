@@ -0,0 +1,241 @@
+#include <common/CJobSystem.h>
+#include <cassert>
+#include <chrono>
+
+
+namespace REF_VK {
+
+    static thread_local uint32_t threadIndex = 0;
+    static thread_local CJobSystem *threadJobSystem = nullptr;
+
+    // Failed attempts to find work before a worker goes to sleep
+    static const uint32_t IDLE_SPIN_COUNT = 64;
+
+    bool CJobSystem::create(uint32_t workerCount) {
+        quit = false;
+        sleeping = 0;
+
+        threads.resize(workerCount + 1);
+        for (uint32_t i = 0; i < threads.size(); ++i) {
+            TThreadData &thread = threads[i];
+            thread.queue = new TWorkQueue();
+            thread.queue->top = 0;
+            thread.queue->bottom = 0;
+            thread.jobPool = new TJob[MAX_JOBS_PER_THREAD];
+            for (uint32_t j = 0; j < MAX_JOBS_PER_THREAD; ++j) {
+                thread.jobPool[j].unfinished.store(0, std::memory_order_relaxed);
+            }
+            thread.allocated = 0;
+            thread.stealSeed = i * 2654435761u + 1;
+        }
+
+        // The creating thread takes part as index 0
+        threadIndex = 0;
+        threadJobSystem = this;
+
+        workers.reserve(workerCount);
+        for (uint32_t i = 1; i <= workerCount; ++i) {
+            workers.emplace_back(&CJobSystem::workerMain, this, i);
+        }
+
+        return true;
+    }
+
+    void CJobSystem::destroy() {
+        quit = true;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeUp.notify_all();
+
+        for (auto &worker: workers) {
+            worker.join();
+        }
+        workers.clear();
+
+        for (auto &thread: threads) {
+            delete thread.queue;
+            delete[] thread.jobPool;
+        }
+        threads.clear();
+
+        if (threadJobSystem == this) {
+            threadJobSystem = nullptr;
+        }
+    }
+
+    uint32_t CJobSystem::getThreadCount() const {
+        return static_cast<uint32_t>(threads.size());
+    }
+
+    uint32_t CJobSystem::getThreadIndex() {
+        return threadIndex;
+    }
+
+    CJobSystem *CJobSystem::getCurrent() {
+        return threadJobSystem;
+    }
+
+    TJob *CJobSystem::createJob(TJobFunc func, TJob *parent) {
+        // Other threads would share index 0 with the creating thread
+        assert(getCurrent() == this);
+        // Only the owning thread allocates from its pool, no synchronization needed
+        TThreadData &thread = threads[threadIndex];
+        TJob *job = &thread.jobPool[thread.allocated++ & (MAX_JOBS_PER_THREAD - 1)];
+        // The pool wrapped around onto a job still in flight, help until it is done
+        wait(job);
+        job->func = func;
+        job->parent = parent;
+        job->unfinished.store(1, std::memory_order_relaxed);
+        if (parent) {
+            parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    void CJobSystem::run(TJob *job) {
+        assert(getCurrent() == this);
+        if (!push(threads[threadIndex].queue, job)) {
+            // Queue full, running it here keeps the tree making progress
+            execute(job);
+            return;
+        }
+        if (sleeping.load(std::memory_order_relaxed) > 0) {
+            wakeUp.notify_one();
+        }
+    }
+
+    void CJobSystem::wait(const TJob *job) {
+        assert(getCurrent() == this);
+        while (!isFinished(job)) {
+            TJob *next = getJob();
+            if (next) {
+                execute(next);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool CJobSystem::isFinished(const TJob *job) const {
+        return job->unfinished.load(std::memory_order_acquire) == 0;
+    }
+
+    void CJobSystem::workerMain(uint32_t index) {
+        threadIndex = index;
+        threadJobSystem = this;
+
+        uint32_t idle = 0;
+        while (!quit.load(std::memory_order_relaxed)) {
+            TJob *job = getJob();
+            if (job) {
+                execute(job);
+                idle = 0;
+            } else if (++idle < IDLE_SPIN_COUNT) {
+                std::this_thread::yield();
+            } else {
+                // The timeout covers a push racing with going to sleep
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                sleeping.fetch_add(1);
+                wakeUp.wait_for(lock, std::chrono::milliseconds(1));
+                sleeping.fetch_sub(1);
+                idle = 0;
+            }
+        }
+    }
+
+    // Chase-Lev deque: the owner pushes and pops at the bottom, thieves take from the top
+
+    bool CJobSystem::push(TWorkQueue *queue, TJob *job) {
+        int64_t bottom = queue->bottom.load(std::memory_order_relaxed);
+        int64_t top = queue->top.load(std::memory_order_acquire);
+        if (bottom - top >= static_cast<int64_t>(MAX_JOBS_PER_THREAD)) {
+            return false;
+        }
+        queue->jobs[bottom & (MAX_JOBS_PER_THREAD - 1)].store(job, std::memory_order_relaxed);
+        // Publishes the job to thieves that acquire bottom
+        queue->bottom.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    TJob *CJobSystem::pop(TWorkQueue *queue) {
+        int64_t bottom = queue->bottom.load(std::memory_order_relaxed) - 1;
+        queue->bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = queue->top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            // Empty
+            queue->bottom.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        TJob *job = queue->jobs[bottom & (MAX_JOBS_PER_THREAD - 1)].load(std::memory_order_relaxed);
+        if (top == bottom) {
+            // Last job, race the thieves for it
+            if (!queue->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed)) {
+                job = nullptr;
+            }
+            queue->bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    TJob *CJobSystem::steal(TWorkQueue *queue) {
+        int64_t top = queue->top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = queue->bottom.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return nullptr;
+        }
+
+        TJob *job = queue->jobs[top & (MAX_JOBS_PER_THREAD - 1)].load(std::memory_order_relaxed);
+        if (!queue->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            // Another thief or the owner got it first
+            return nullptr;
+        }
+        return job;
+    }
+
+    TJob *CJobSystem::getJob() {
+        TThreadData &thread = threads[threadIndex];
+        TJob *job = pop(thread.queue);
+        if (job) {
+            return job;
+        }
+
+        // Start at a random victim so thieves spread over the queues
+        uint32_t count = static_cast<uint32_t>(threads.size());
+        thread.stealSeed ^= thread.stealSeed << 13;
+        thread.stealSeed ^= thread.stealSeed >> 17;
+        thread.stealSeed ^= thread.stealSeed << 5;
+        uint32_t start = thread.stealSeed % count;
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t victim = (start + i) % count;
+            if (victim == threadIndex) {
+                continue;
+            }
+            job = steal(threads[victim].queue);
+            if (job) {
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void CJobSystem::execute(TJob *job) {
+        job->func(job, job->data);
+        finish(job);
+    }
+
+    void CJobSystem::finish(TJob *job) {
+        // Once unfinished reaches zero the slot may be recycled, so the parent is read before
+        TJob *parent = job->parent;
+        // The last of the job and its children to finish completes the parent
+        if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1 && parent) {
+            finish(parent);
+        }
+    }
+
+}
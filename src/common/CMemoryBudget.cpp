@@ -0,0 +1,148 @@
+#include <common/CMemoryBudget.h>
+#include <common/CTools.h>
+#include <cstdio>
+#include <fstream>
+
+
+namespace REF_VK {
+
+    const char *CMemoryBudget::CATEGORY_NAMES[MEMORY_CATEGORY_COUNT]{
+            "other",
+            "texture",
+            "lightmap",
+            "geometry",
+            "staging",
+            "uniform",
+            "rendertarget"
+    };
+    std::array<std::atomic<uint32_t>, MEMORY_CATEGORY_COUNT> CMemoryBudget::categoryAllocations{};
+    std::array<std::atomic<uint64_t>, MEMORY_CATEGORY_COUNT> CMemoryBudget::categoryBytes{};
+
+    void *CMemoryBudget::tag(EMemoryCategory category) {
+        // Offset by one so a null pUserData stays untagged
+        return reinterpret_cast<void *>(static_cast<uintptr_t>(category) + 1);
+    }
+
+    void CMemoryBudget::track(VmaAllocator allocator, VmaAllocation allocation) {
+        VmaAllocationInfo allocInfo{};
+        vmaGetAllocationInfo(allocator, allocation, &allocInfo);
+        uintptr_t value = reinterpret_cast<uintptr_t>(allocInfo.pUserData);
+        if (value == 0 || value > MEMORY_CATEGORY_COUNT) {
+            return;
+        }
+
+        vmaSetAllocationName(allocator, allocation, CATEGORY_NAMES[value - 1]);
+        categoryAllocations[value - 1]++;
+        categoryBytes[value - 1] += allocInfo.size;
+    }
+
+    void CMemoryBudget::untrack(VmaAllocator allocator, VmaAllocation allocation) {
+        if (allocation == VK_NULL_HANDLE) {
+            return;
+        }
+        VmaAllocationInfo allocInfo{};
+        vmaGetAllocationInfo(allocator, allocation, &allocInfo);
+        uintptr_t value = reinterpret_cast<uintptr_t>(allocInfo.pUserData);
+        if (value == 0 || value > MEMORY_CATEGORY_COUNT) {
+            return;
+        }
+
+        categoryAllocations[value - 1]--;
+        categoryBytes[value - 1] -= allocInfo.size;
+    }
+
+    TMemoryCategoryStats CMemoryBudget::getCategoryStats(EMemoryCategory category) {
+        TMemoryCategoryStats stats{};
+        stats.name = CATEGORY_NAMES[category];
+        stats.allocations = categoryAllocations[category].load();
+        stats.bytes = categoryBytes[category].load();
+        return stats;
+    }
+
+    void CMemoryBudget::create(VmaAllocator allocator, bool budgetExtension) {
+        vmaAllocator = allocator;
+        budgetSupported = budgetExtension;
+        if (!budgetSupported) {
+            LOG(NORMAL, "VK_EXT_memory_budget unavailable, heap budgets are estimates");
+        }
+    }
+
+    uint32_t CMemoryBudget::getHeapCount() const {
+        const VkPhysicalDeviceMemoryProperties *memoryProperties = nullptr;
+        vmaGetMemoryProperties(vmaAllocator, &memoryProperties);
+        return memoryProperties->memoryHeapCount;
+    }
+
+    bool CMemoryBudget::getHeapStats(uint32_t heap, TMemoryHeapStats *stats) const {
+        const VkPhysicalDeviceMemoryProperties *memoryProperties = nullptr;
+        vmaGetMemoryProperties(vmaAllocator, &memoryProperties);
+        if (heap >= memoryProperties->memoryHeapCount) {
+            return false;
+        }
+
+        // Budgets are refreshed by vmaSetCurrentFrameIndex, once per frame
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+        vmaGetHeapBudgets(vmaAllocator, budgets.data());
+        stats->budget = budgets[heap].budget;
+        stats->usage = budgets[heap].usage;
+        stats->blockBytes = budgets[heap].statistics.blockBytes;
+        stats->allocationBytes = budgets[heap].statistics.allocationBytes;
+        stats->allocationCount = budgets[heap].statistics.allocationCount;
+        stats->deviceLocal = (memoryProperties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        return true;
+    }
+
+    bool CMemoryBudget::report(char *out, size_t size) const {
+        if (!out || size == 0) {
+            return false;
+        }
+        out[0] = '\0';
+
+        const double mb = 1024.0 * 1024.0;
+        size_t used = 0;
+        auto append = [&](int written) {
+            if (written < 0 || static_cast<size_t>(written) >= size - used) {
+                return false;
+            }
+            used += written;
+            return true;
+        };
+
+        TMemoryHeapStats heapStats{};
+        for (uint32_t heap = 0; getHeapStats(heap, &heapStats); ++heap) {
+            if (!append(snprintf(out + used, size - used, "heap %u %-6s %8.1f / %8.1f MB used, %8.1f MB in %u allocs\n",
+                                 heap, heapStats.deviceLocal ? "device" : "host", heapStats.usage / mb,
+                                 heapStats.budget / mb, heapStats.allocationBytes / mb,
+                                 heapStats.allocationCount))) {
+                return true;
+            }
+        }
+        for (uint32_t category = 0; category < MEMORY_CATEGORY_COUNT; ++category) {
+            TMemoryCategoryStats categoryStats = getCategoryStats(static_cast<EMemoryCategory>(category));
+            if (!append(snprintf(out + used, size - used, "%-12s %8.1f MB in %u allocs\n", categoryStats.name,
+                                 categoryStats.bytes / mb, categoryStats.allocations))) {
+                return true;
+            }
+        }
+        return true;
+    }
+
+    bool CMemoryBudget::dumpJson(const std::string &path) const {
+        char *statsString = nullptr;
+        vmaBuildStatsString(vmaAllocator, &statsString, VK_TRUE);
+
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        bool written = false;
+        if (file.is_open()) {
+            file << statsString;
+            written = file.good();
+        }
+        vmaFreeStatsString(vmaAllocator, statsString);
+
+        if (!written) {
+            LOG(ERR, ("Cannot write memory dump " + path).c_str());
+        }
+        return written;
+    }
+
+}
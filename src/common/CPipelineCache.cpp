@@ -0,0 +1,203 @@
+#include <common/CPipelineCache.h>
+#include <common/CTools.h>
+#include <common/CFileSystem.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+
+namespace REF_VK {
+
+    const char PIPELINE_CACHE_MAGIC[4] = {'R', 'V', 'P', 'C'};
+
+    bool CPipelineCache::create(CDevice *device, const std::string &filePath) {
+        logicDevice = device->device;
+        properties = device->properties;
+        path = filePath;
+        stats = {};
+        feedbackSupported = properties.apiVersion >= VK_API_VERSION_1_3;
+
+        // The driver checks its own header too, but not the driver version and not for truncation
+        TFileSpan initialData{};
+        CMappedFile file{};
+        if (file.open(path)) {
+            TFileSpan span = file.getSpan();
+            TFileHeader header{};
+            TFileHeader expected{};
+            fillHeader(&expected);
+            bool valid = span.size >= sizeof(TFileHeader);
+            if (valid) {
+                memcpy(&header, span.data, sizeof(TFileHeader));
+                valid = memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+                        header.version == expected.version &&
+                        header.vendorID == expected.vendorID &&
+                        header.deviceID == expected.deviceID &&
+                        header.driverVersion == expected.driverVersion &&
+                        memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+                        header.dataSize == span.size - sizeof(TFileHeader) &&
+                        header.dataHash == hashData(span.data + sizeof(TFileHeader), header.dataSize);
+            }
+            if (valid) {
+                initialData = {span.data + sizeof(TFileHeader), static_cast<size_t>(header.dataSize)};
+            } else {
+                LOG(NORMAL, ("Discarding stale pipeline cache " + path).c_str());
+            }
+        }
+
+        VkPipelineCacheCreateInfo pipelineCacheCI{};
+        pipelineCacheCI.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        pipelineCacheCI.initialDataSize = initialData.size;
+        pipelineCacheCI.pInitialData = initialData.data;
+        VkResult result = vkCreatePipelineCache(logicDevice, &pipelineCacheCI, nullptr, &pipelineCache);
+        if (result != VK_SUCCESS && initialData.size > 0) {
+            // Rejected by the driver, start over with an empty cache
+            initialData = {};
+            pipelineCacheCI.initialDataSize = 0;
+            pipelineCacheCI.pInitialData = nullptr;
+            result = vkCreatePipelineCache(logicDevice, &pipelineCacheCI, nullptr, &pipelineCache);
+        }
+        if (!VK_CHECK_RESULT(result, "Cannot create pipeline cache!")) {
+            return false;
+        }
+
+        stats.loadedBytes = initialData.size;
+        if (initialData.size > 0) {
+            LOG(NORMAL, ("Pipeline cache loaded, " + std::to_string(initialData.size / 1024) + " KB").c_str());
+        }
+        return true;
+    }
+
+    void CPipelineCache::destroy() {
+        if (pipelineCache == VK_NULL_HANDLE) {
+            return;
+        }
+        if (dirty) {
+            save();
+        }
+        vkDestroyPipelineCache(logicDevice, pipelineCache, nullptr);
+        pipelineCache = VK_NULL_HANDLE;
+    }
+
+    bool CPipelineCache::save() {
+        if (pipelineCache == VK_NULL_HANDLE || path.empty()) {
+            return false;
+        }
+        dirty = false;
+
+        size_t dataSize = 0;
+        if (!VK_CHECK_RESULT(vkGetPipelineCacheData(logicDevice, pipelineCache, &dataSize, nullptr),
+                             "Cannot read pipeline cache size!")) {
+            return false;
+        }
+        std::vector<uint8_t> data(dataSize);
+        // VK_INCOMPLETE only if the cache grew in between, the prefix is still a valid blob
+        VkResult result = vkGetPipelineCacheData(logicDevice, pipelineCache, &dataSize, data.data());
+        if (result != VK_SUCCESS && result != VK_INCOMPLETE) {
+            VK_CHECK_RESULT(result, "Cannot read pipeline cache data!");
+            return false;
+        }
+
+        TFileHeader header{};
+        fillHeader(&header);
+        header.dataSize = dataSize;
+        header.dataHash = hashData(data.data(), dataSize);
+
+        std::string tempPath = path + ".tmp";
+        FILE *file = fopen(tempPath.c_str(), "wb");
+        if (!file) {
+            LOG(ERR, ("Cannot write pipeline cache " + tempPath).c_str());
+            return false;
+        }
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                       (dataSize == 0 || fwrite(data.data(), dataSize, 1, file) == 1);
+        written = fclose(file) == 0 && written;
+
+        std::error_code error{};
+        if (written) {
+            std::filesystem::rename(tempPath, path, error);
+        }
+        if (!written || error) {
+            std::filesystem::remove(tempPath, error);
+            LOG(ERR, ("Cannot write pipeline cache " + path).c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.saves++;
+        return true;
+    }
+
+    void CPipelineCache::saveIfDirty() {
+        if (dirty) {
+            save();
+        }
+    }
+
+    VkResult CPipelineCache::createGraphicsPipeline(const VkGraphicsPipelineCreateInfo &createInfo,
+                                                    VkPipeline *pipeline) {
+        // Feedback goes in front of whatever the caller chained
+        VkPipelineCreationFeedback pipelineFeedback{};
+        VkPipelineCreationFeedbackCreateInfo feedbackCI{};
+        feedbackCI.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+        feedbackCI.pNext = createInfo.pNext;
+        feedbackCI.pPipelineCreationFeedback = &pipelineFeedback;
+        VkGraphicsPipelineCreateInfo pipelineCI = createInfo;
+        if (feedbackSupported) {
+            pipelineCI.pNext = &feedbackCI;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        VkResult result = vkCreateGraphicsPipelines(logicDevice, pipelineCache, 1, &pipelineCI, nullptr, pipeline);
+        float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        // Without valid feedback the pipeline counts as unknown and the cache as changed
+        bool known = (pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) != 0;
+        bool hit = known &&
+                   (pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT);
+        if (!hit) {
+            dirty = true;
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.pipelinesCreated++;
+        stats.cacheHits += hit ? 1 : 0;
+        stats.unknownHits += known ? 0 : 1;
+        stats.totalCompileMs += ms;
+        stats.maxCompileMs = std::max(stats.maxCompileMs, ms);
+        return result;
+    }
+
+    VkPipelineCache CPipelineCache::getHandle() const {
+        return pipelineCache;
+    }
+
+    TPipelineCacheStats CPipelineCache::getStats() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return stats;
+    }
+
+    uint64_t CPipelineCache::hashData(const uint8_t *data, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void CPipelineCache::fillHeader(TFileHeader *header) const {
+        *header = {};
+        memcpy(header->magic, PIPELINE_CACHE_MAGIC, sizeof(header->magic));
+        header->version = FILE_VERSION;
+        header->vendorID = properties.vendorID;
+        header->deviceID = properties.deviceID;
+        header->driverVersion = properties.driverVersion;
+        memcpy(header->pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    }
+
+}
@@ -0,0 +1,717 @@
+#include <common/CPipelineRegistry.h>
+#include <common/CTools.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <common/VertexLayout.h>
+
+
+namespace REF_VK {
+
+    // Key layout: render mode 3 bits, vertex format 2, cull mode 2, then one bit per flag, valid bit 31
+    const uint32_t KEY_RENDER_MODE_SHIFT = 0;
+    const uint32_t KEY_VERTEX_FORMAT_SHIFT = 3;
+    const uint32_t KEY_CULL_MODE_SHIFT = 5;
+    const uint32_t KEY_DEPTH_TEST_SHIFT = 7;
+    const uint32_t KEY_DEPTH_WRITE_SHIFT = 8;
+    const uint32_t KEY_ALPHA_TEST_SHIFT = 9;
+    const uint32_t KEY_FOG_SHIFT = 10;
+    const uint32_t KEY_FULLBRIGHT_SHIFT = 11;
+    const TPipelineKey KEY_VALID_BIT = 1u << 31;
+
+    const TPipelineKey KEY_RENDER_MODE_BITS = 0x7u << KEY_RENDER_MODE_SHIFT;
+    const TPipelineKey KEY_VERTEX_FORMAT_BITS = 0x3u << KEY_VERTEX_FORMAT_SHIFT;
+    // Dynamic state on the library path
+    const TPipelineKey KEY_DYNAMIC_BITS =
+            0x3u << KEY_CULL_MODE_SHIFT | 1u << KEY_DEPTH_TEST_SHIFT | 1u << KEY_DEPTH_WRITE_SHIFT;
+    // Key bits each library part is compiled from, indexed by ELibraryPart
+    const TPipelineKey LIBRARY_KEY_BITS[] = {
+            KEY_VERTEX_FORMAT_BITS,
+            KEY_VERTEX_FORMAT_BITS | KEY_RENDER_MODE_BITS | 1u << KEY_FOG_SHIFT | 1u << KEY_FULLBRIGHT_SHIFT,
+            KEY_VERTEX_FORMAT_BITS | KEY_RENDER_MODE_BITS | 1u << KEY_ALPHA_TEST_SHIFT | 1u << KEY_FOG_SHIFT,
+            0
+    };
+    const uint32_t LIBRARY_PART_SHIFT = 24;
+    const VkGraphicsPipelineLibraryFlagsEXT LIBRARY_PART_FLAGS[] = {
+            VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+            VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+            VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+            VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT
+    };
+
+    enum EBlendMode {
+        BLEND_MODE_NONE,
+        BLEND_MODE_ALPHA,
+        BLEND_MODE_ADD
+    };
+
+    typedef struct SRenderModeDesc {
+        EBlendMode blendMode;
+        bool depthTest;
+        bool depthWrite;
+        bool alphaTest;
+        bool fullbright;
+    } TRenderModeDesc;
+
+    // How each render mode draws, indexed by ERenderMode. Every variant is derived from this table.
+    const TRenderModeDesc RENDER_MODE_TABLE[RENDER_MODE_COUNT] = {
+            // Normal
+            {BLEND_MODE_NONE,  true,  true,  false, false},
+            // Color, flat render color blended by render amount
+            {BLEND_MODE_ALPHA, true,  false, false, true},
+            // Texture, blended by render amount
+            {BLEND_MODE_ALPHA, true,  false, false, false},
+            // Glow, additive sprites visible through walls
+            {BLEND_MODE_ADD,   false, false, false, true},
+            // Solid, alpha tested cutouts like grates and fences
+            {BLEND_MODE_NONE,  true,  true,  true,  false},
+            // Additive
+            {BLEND_MODE_ADD,   true,  false, false, true},
+    };
+
+    // Shader side of TPipelineState, see the constant_id declarations of the uber-shaders
+    typedef struct SSpecializationData {
+        int32_t renderMode;
+        VkBool32 alphaTest;
+        VkBool32 fog;
+        VkBool32 fullbright;
+    } TSpecializationData;
+
+    // Blending of a render mode, filled into the blend attachment or set as dynamic state
+    static VkColorBlendEquationEXT blendEquation(ERenderMode renderMode, VkBool32 *blendEnable) {
+        VkColorBlendEquationEXT equation{};
+        equation.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+        equation.colorBlendOp = VK_BLEND_OP_ADD;
+        equation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        equation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        equation.alphaBlendOp = VK_BLEND_OP_ADD;
+        *blendEnable = VK_FALSE;
+        // Translucent modes blend over the scene, additive ones brighten it, alpha test discards in the shader
+        switch (RENDER_MODE_TABLE[renderMode % RENDER_MODE_COUNT].blendMode) {
+            case BLEND_MODE_ALPHA:
+                *blendEnable = VK_TRUE;
+                equation.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+                equation.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+                break;
+            case BLEND_MODE_ADD:
+                *blendEnable = VK_TRUE;
+                equation.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+                equation.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+                break;
+            default:
+                break;
+        }
+        return equation;
+    }
+
+    TPipelineKey CPipelineRegistry::pack(const TPipelineState &state) {
+        return KEY_VALID_BIT |
+               (static_cast<uint32_t>(state.renderMode) & 0x7) << KEY_RENDER_MODE_SHIFT |
+               (static_cast<uint32_t>(state.vertexFormat) & 0x3) << KEY_VERTEX_FORMAT_SHIFT |
+               (static_cast<uint32_t>(state.cullMode) & 0x3) << KEY_CULL_MODE_SHIFT |
+               (state.depthTest ? 1u : 0u) << KEY_DEPTH_TEST_SHIFT |
+               (state.depthWrite ? 1u : 0u) << KEY_DEPTH_WRITE_SHIFT |
+               (state.alphaTest ? 1u : 0u) << KEY_ALPHA_TEST_SHIFT |
+               (state.fog ? 1u : 0u) << KEY_FOG_SHIFT |
+               (state.fullbright ? 1u : 0u) << KEY_FULLBRIGHT_SHIFT;
+    }
+
+    TPipelineState CPipelineRegistry::unpack(TPipelineKey key) {
+        TPipelineState state{};
+        state.renderMode = static_cast<ERenderMode>((key >> KEY_RENDER_MODE_SHIFT) & 0x7);
+        state.vertexFormat = static_cast<EVertexFormat>((key >> KEY_VERTEX_FORMAT_SHIFT) & 0x3);
+        state.cullMode = static_cast<VkCullModeFlags>((key >> KEY_CULL_MODE_SHIFT) & 0x3);
+        state.depthTest = (key >> KEY_DEPTH_TEST_SHIFT) & 1;
+        state.depthWrite = (key >> KEY_DEPTH_WRITE_SHIFT) & 1;
+        state.alphaTest = (key >> KEY_ALPHA_TEST_SHIFT) & 1;
+        state.fog = (key >> KEY_FOG_SHIFT) & 1;
+        state.fullbright = (key >> KEY_FULLBRIGHT_SHIFT) & 1;
+        return state;
+    }
+
+    TPipelineState CPipelineRegistry::makeState(ERenderMode renderMode, EVertexFormat vertexFormat,
+                                                VkCullModeFlags cullMode, bool fog) {
+        const TRenderModeDesc &desc = RENDER_MODE_TABLE[renderMode % RENDER_MODE_COUNT];
+        TPipelineState state{};
+        state.renderMode = renderMode;
+        state.vertexFormat = vertexFormat;
+        state.cullMode = cullMode;
+        state.depthTest = desc.depthTest;
+        state.depthWrite = desc.depthWrite;
+        state.alphaTest = desc.alphaTest;
+        state.fog = fog;
+        state.fullbright = desc.fullbright;
+        return state;
+    }
+
+    // Keys differ in a few low bits, spread them over the whole table
+    static uint32_t hashKey(TPipelineKey key) {
+        key ^= key >> 16;
+        key *= 0x85ebca6bu;
+        key ^= key >> 13;
+        key *= 0xc2b2ae35u;
+        key ^= key >> 16;
+        return key;
+    }
+
+    bool CPipelineRegistry::create(VkDevice device, CPipelineCache *cache, VkPipelineLayout layout,
+                                   VkFormat colorFormat, VkFormat depthFormat, uint32_t compileThreadCount,
+                                   bool pipelineLibrary) {
+        logicDevice = device;
+        pipelineCache = cache;
+        pipelineLayout = layout;
+        colorAttachmentFormat = colorFormat;
+        depthAttachmentFormat = depthFormat;
+        this->pipelineLibrary = pipelineLibrary;
+        if (pipelineLibrary) {
+            cmdSetColorBlendEnable = reinterpret_cast<PFN_vkCmdSetColorBlendEnableEXT>(
+                    vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEnableEXT"));
+            cmdSetColorBlendEquation = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(
+                    vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEquationEXT"));
+            this->pipelineLibrary = cmdSetColorBlendEnable != nullptr && cmdSetColorBlendEquation != nullptr;
+        }
+
+        // Not on the job system, its wait() would let the engine thread pick up a compile mid frame
+        for (uint32_t i = 0; i < std::max(compileThreadCount, 1u); ++i) {
+            compileThreads.emplace_back(&CPipelineRegistry::compileMain, this);
+        }
+        return true;
+    }
+
+    void CPipelineRegistry::destroy() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            quit = true;
+        }
+        queueChanged.notify_all();
+        for (auto &thread: compileThreads) {
+            thread.join();
+        }
+        compileThreads.clear();
+
+        for (auto &slot: slots) {
+            if (slot.status.load() == SLOT_STATUS_READY) {
+                vkDestroyPipeline(logicDevice, slot.pipeline, nullptr);
+            }
+            slot.key = 0;
+            slot.pipeline = VK_NULL_HANDLE;
+            slot.status = SLOT_STATUS_PENDING;
+        }
+        // Linked pipelines do not reference their libraries once created
+        for (auto &library: libraries) {
+            vkDestroyPipeline(logicDevice, library.second, nullptr);
+        }
+        libraries.clear();
+        for (auto &formatShaders: shaders) {
+            if (formatShaders.vertexShader) {
+                vkDestroyShaderModule(logicDevice, formatShaders.vertexShader, nullptr);
+            }
+            if (formatShaders.fragmentShader) {
+                vkDestroyShaderModule(logicDevice, formatShaders.fragmentShader, nullptr);
+            }
+            formatShaders = {};
+        }
+        pipelineCount = 0;
+        queueHead = 0;
+        queueTail = 0;
+        quit = false;
+    }
+
+    bool CPipelineRegistry::setShaders(EVertexFormat format, VkShaderModule vertexShader,
+                                       VkShaderModule fragmentShader) {
+        shaders[format].vertexShader = vertexShader;
+        shaders[format].fragmentShader = fragmentShader;
+
+        // Opaque, double sided and depth tested, close enough to any state of the format for a few frames
+        TPipelineState fallbackState = makeState(RENDER_MODE_NORMAL, format, VK_CULL_MODE_NONE, false);
+        bool inserted{};
+        TSlot *slot = findOrInsert(toSlotKey(pack(fallbackState)), &inserted);
+        VkPipeline fallback = buildPipeline(fallbackState);
+        if (!slot || !inserted || fallback == VK_NULL_HANDLE) {
+            LOG(ERR, "Cannot create fallback pipeline!");
+            return false;
+        }
+        slot->pipeline = fallback;
+        slot->status.store(SLOT_STATUS_READY, std::memory_order_release);
+        shaders[format].fallback = fallback;
+        pipelineCount++;
+        return true;
+    }
+
+    VkPipeline CPipelineRegistry::get(TPipelineKey key) {
+        bool inserted{};
+        TSlot *slot = findOrInsert(toSlotKey(key), &inserted);
+        if (inserted) {
+            enqueue(static_cast<uint32_t>(slot - slots.data()));
+        }
+        if (slot && slot->status.load(std::memory_order_acquire) == SLOT_STATUS_READY) {
+            return slot->pipeline;
+        }
+        return shaders[unpack(key).vertexFormat % VERTEX_FORMAT_COUNT].fallback;
+    }
+
+    void CPipelineRegistry::bind(VkCommandBuffer commandBuffer, TPipelineKey key) {
+        VkPipeline pipeline = get(key);
+        if (pipeline == VK_NULL_HANDLE) {
+            return;
+        }
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        if (!pipelineLibrary) {
+            return;
+        }
+
+        TPipelineState state = unpack(key);
+        vkCmdSetCullMode(commandBuffer, state.cullMode);
+        vkCmdSetDepthTestEnable(commandBuffer, state.depthTest ? VK_TRUE : VK_FALSE);
+        vkCmdSetDepthWriteEnable(commandBuffer, state.depthWrite ? VK_TRUE : VK_FALSE);
+        VkBool32 blendEnable{};
+        VkColorBlendEquationEXT equation = blendEquation(state.renderMode, &blendEnable);
+        cmdSetColorBlendEnable(commandBuffer, 0, 1, &blendEnable);
+        cmdSetColorBlendEquation(commandBuffer, 0, 1, &equation);
+    }
+
+    void CPipelineRegistry::request(TPipelineKey key) {
+        bool inserted{};
+        TSlot *slot = findOrInsert(toSlotKey(key), &inserted);
+        if (inserted) {
+            enqueue(static_cast<uint32_t>(slot - slots.data()));
+        }
+    }
+
+    void CPipelineRegistry::prewarm(const ERenderMode *renderModes, uint32_t count, const VkCullModeFlags *cullModes,
+                                    uint32_t cullModeCount, bool fog) {
+        for (uint32_t format = 0; format < VERTEX_FORMAT_COUNT; ++format) {
+            if (shaders[format].vertexShader == VK_NULL_HANDLE || shaders[format].fragmentShader == VK_NULL_HANDLE) {
+                continue;
+            }
+            for (uint32_t i = 0; i < count; ++i) {
+                for (uint32_t cull = 0; cull < cullModeCount; ++cull) {
+                    request(pack(makeState(renderModes[i], static_cast<EVertexFormat>(format), cullModes[cull], fog)));
+                }
+            }
+        }
+    }
+
+    void CPipelineRegistry::waitIdle() {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [this] { return queueHead == queueTail && compiling == 0; });
+    }
+
+    uint32_t CPipelineRegistry::getPipelineCount() const {
+        return pipelineCount.load();
+    }
+
+    uint32_t CPipelineRegistry::getPendingCount() const {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        return queueTail - queueHead + compiling;
+    }
+
+    void CPipelineRegistry::benchmark(TPipelineBuildStats *stats) {
+        *stats = {};
+        stats->pipelineLibrary = pipelineLibrary;
+
+        std::vector<TPipelineState> states{};
+        for (uint32_t format = 0; format < VERTEX_FORMAT_COUNT; ++format) {
+            if (shaders[format].vertexShader == VK_NULL_HANDLE || shaders[format].fragmentShader == VK_NULL_HANDLE) {
+                continue;
+            }
+            for (uint32_t mode = 0; mode < RENDER_MODE_COUNT; ++mode) {
+                for (VkCullModeFlags cullMode: {VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT}) {
+                    for (bool fog: {false, true}) {
+                        states.push_back(makeState(static_cast<ERenderMode>(mode), static_cast<EVertexFormat>(format),
+                                                   cullMode, fog));
+                    }
+                }
+            }
+        }
+
+        // Libraries first: shader compiles the driver caches itself (e.g. the Mesa disk cache) then favor the
+        // monolithic builds that follow, never the path being measured against them
+        if (pipelineLibrary) {
+            benchmarkLibraries(states, stats);
+        }
+
+        for (const auto &state: states) {
+            auto start = std::chrono::steady_clock::now();
+            VkPipeline pipeline = buildMonolithic(state, false);
+            stats->monolithicMs += std::chrono::duration<float, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            if (pipeline != VK_NULL_HANDLE) {
+                stats->monolithicPipelines++;
+                vkDestroyPipeline(logicDevice, pipeline, nullptr);
+            }
+        }
+    }
+
+    void CPipelineRegistry::benchmarkLibraries(const std::vector<TPipelineState> &states, TPipelineBuildStats *stats) {
+        // States differing only in dynamic state link to the same pipeline
+        std::vector<TPipelineKey> linkKeys{};
+        for (const auto &state: states) {
+            linkKeys.push_back(toSlotKey(pack(state)));
+        }
+        std::sort(linkKeys.begin(), linkKeys.end());
+        linkKeys.erase(std::unique(linkKeys.begin(), linkKeys.end()), linkKeys.end());
+
+        // Parts first, so link times are not mixed with compiles. A fresh map keeps the registry's parts out.
+        TLibraryMap benchmarkLibraries{};
+        std::vector<std::array<VkPipeline, LIBRARY_PART_COUNT>> linkParts(linkKeys.size());
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < linkKeys.size(); ++i) {
+            TPipelineState state = unpack(linkKeys[i]);
+            for (uint32_t part = 0; part < LIBRARY_PART_COUNT; ++part) {
+                linkParts[i][part] = getLibrary(static_cast<ELibraryPart>(part), state, &benchmarkLibraries, false);
+            }
+        }
+        stats->libraryMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        stats->libraries = static_cast<unsigned int>(benchmarkLibraries.size());
+
+        for (const auto &parts: linkParts) {
+            if (std::find(parts.begin(), parts.end(), VK_NULL_HANDLE) != parts.end()) {
+                continue;
+            }
+            start = std::chrono::steady_clock::now();
+            VkPipeline pipeline = linkLibraries(parts, false);
+            stats->linkMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (pipeline != VK_NULL_HANDLE) {
+                stats->linkedPipelines++;
+                vkDestroyPipeline(logicDevice, pipeline, nullptr);
+            }
+        }
+        for (auto &library: benchmarkLibraries) {
+            vkDestroyPipeline(logicDevice, library.second, nullptr);
+        }
+    }
+
+    TPipelineKey CPipelineRegistry::toSlotKey(TPipelineKey key) const {
+        return pipelineLibrary ? key & ~KEY_DYNAMIC_BITS : key;
+    }
+
+    CPipelineRegistry::TSlot *CPipelineRegistry::findOrInsert(TPipelineKey key, bool *inserted) {
+        *inserted = false;
+        uint32_t start = hashKey(key) & (CAPACITY - 1);
+        for (uint32_t probe = 0; probe < CAPACITY; ++probe) {
+            TSlot &slot = slots[(start + probe) & (CAPACITY - 1)];
+            TPipelineKey current = slot.key.load(std::memory_order_acquire);
+            if (current == 0) {
+                // Claim the empty slot, a thread inserting the same key at the same time gets it back
+                if (slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                    *inserted = true;
+                    return &slot;
+                }
+            }
+            if (current == key) {
+                return &slot;
+            }
+        }
+
+        LOG(ERR, "Pipeline registry is full!");
+        return nullptr;
+    }
+
+    void CPipelineRegistry::enqueue(uint32_t slotIndex) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue[queueTail++ % CAPACITY] = slotIndex;
+        }
+        queueChanged.notify_all();
+    }
+
+    void CPipelineRegistry::compileMain() {
+        for (;;) {
+            uint32_t slotIndex{};
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [this] { return quit || queueHead != queueTail; });
+                if (quit) {
+                    return;
+                }
+                slotIndex = queue[queueHead++ % CAPACITY];
+                compiling++;
+            }
+
+            TSlot &slot = slots[slotIndex];
+            VkPipeline pipeline = buildPipeline(unpack(slot.key.load(std::memory_order_acquire)));
+            slot.pipeline = pipeline;
+            slot.status.store(pipeline != VK_NULL_HANDLE ? SLOT_STATUS_READY : SLOT_STATUS_FAILED,
+                              std::memory_order_release);
+            if (pipeline != VK_NULL_HANDLE) {
+                pipelineCount++;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                compiling--;
+            }
+            queueChanged.notify_all();
+        }
+    }
+
+    // Create infos of every state of a pipeline, pointers only refer into the struct itself
+    typedef struct SPipelineDesc {
+        VkVertexInputBindingDescription vertexBinding;
+        std::array<VkVertexInputAttributeDescription, 4> vertexAttributes;
+        VkPipelineVertexInputStateCreateInfo vertexInputState;
+        VkPipelineInputAssemblyStateCreateInfo inputAssemblyState;
+        VkPipelineViewportStateCreateInfo viewportState;
+        VkPipelineRasterizationStateCreateInfo rasterizationState;
+        VkPipelineMultisampleStateCreateInfo multisampleState;
+        VkPipelineDepthStencilStateCreateInfo depthStencilState;
+        VkPipelineColorBlendAttachmentState blendAttachmentState;
+        VkPipelineColorBlendStateCreateInfo colorBlendState;
+        std::array<VkDynamicState, 7> dynamicStates;
+        VkPipelineDynamicStateCreateInfo dynamicState;
+        TSpecializationData specializationData;
+        std::array<VkSpecializationMapEntry, 4> specializationEntries;
+        VkSpecializationInfo specializationInfo;
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
+        VkFormat colorFormat;
+        VkPipelineRenderingCreateInfo renderingInfo;
+    } TPipelineDesc;
+
+    // dynamicState leaves cull mode, depth test and write and blending to the command buffer
+    static void describePipeline(const TPipelineState &state, VkShaderModule vertexShader,
+                                 VkShaderModule fragmentShader, VkFormat colorFormat, VkFormat depthFormat,
+                                 bool dynamicState, TPipelineDesc *desc) {
+        *desc = {};
+
+        // Dynamic rendering, attachment formats instead of a render pass
+        desc->colorFormat = colorFormat;
+        desc->renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+        desc->renderingInfo.colorAttachmentCount = 1;
+        desc->renderingInfo.pColorAttachmentFormats = &desc->colorFormat;
+        desc->renderingInfo.depthAttachmentFormat = depthFormat;
+
+        // Vertex input descriptions, generated from the struct members. VERTEX_FORMAT_COLOR is the only layout.
+        desc->vertexBinding = TColorVertexLayout::binding();
+        auto attributes = TColorVertexLayout::attributes();
+        std::copy(attributes.begin(), attributes.end(), desc->vertexAttributes.begin());
+        uint32_t attributeCount = static_cast<uint32_t>(attributes.size());
+        desc->vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        desc->vertexInputState.vertexBindingDescriptionCount = 1;
+        desc->vertexInputState.pVertexBindingDescriptions = &desc->vertexBinding;
+        desc->vertexInputState.vertexAttributeDescriptionCount = attributeCount;
+        desc->vertexInputState.pVertexAttributeDescriptions = desc->vertexAttributes.data();
+
+        // Fans and strips are expanded into the index buffers
+        desc->inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        desc->inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+        desc->viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        desc->viewportState.viewportCount = 1;
+        desc->viewportState.scissorCount = 1;
+
+        desc->rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        desc->rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+        desc->rasterizationState.cullMode = state.cullMode;
+        desc->rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        desc->rasterizationState.depthClampEnable = VK_FALSE;
+        desc->rasterizationState.rasterizerDiscardEnable = VK_FALSE;
+        desc->rasterizationState.depthBiasEnable = VK_FALSE;
+        desc->rasterizationState.lineWidth = 1.0f;
+
+        desc->multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        desc->multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        desc->multisampleState.pSampleMask = nullptr;
+
+        desc->depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        desc->depthStencilState.depthTestEnable = state.depthTest ? VK_TRUE : VK_FALSE;
+        desc->depthStencilState.depthWriteEnable = state.depthWrite ? VK_TRUE : VK_FALSE;
+        desc->depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+        desc->depthStencilState.depthBoundsTestEnable = VK_FALSE;
+        desc->depthStencilState.back.failOp = VK_STENCIL_OP_KEEP;
+        desc->depthStencilState.back.passOp = VK_STENCIL_OP_KEEP;
+        desc->depthStencilState.back.compareOp = VK_COMPARE_OP_ALWAYS;
+        desc->depthStencilState.stencilTestEnable = VK_FALSE;
+        desc->depthStencilState.front = desc->depthStencilState.back;
+
+        VkBool32 blendEnable{};
+        VkColorBlendEquationEXT equation = blendEquation(state.renderMode, &blendEnable);
+        desc->blendAttachmentState.colorWriteMask = 0xf;
+        desc->blendAttachmentState.blendEnable = blendEnable;
+        desc->blendAttachmentState.srcColorBlendFactor = equation.srcColorBlendFactor;
+        desc->blendAttachmentState.dstColorBlendFactor = equation.dstColorBlendFactor;
+        desc->blendAttachmentState.colorBlendOp = equation.colorBlendOp;
+        desc->blendAttachmentState.srcAlphaBlendFactor = equation.srcAlphaBlendFactor;
+        desc->blendAttachmentState.dstAlphaBlendFactor = equation.dstAlphaBlendFactor;
+        desc->blendAttachmentState.alphaBlendOp = equation.alphaBlendOp;
+        desc->colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        desc->colorBlendState.attachmentCount = 1;
+        desc->colorBlendState.pAttachments = &desc->blendAttachmentState;
+
+        desc->dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR,
+                               VK_DYNAMIC_STATE_CULL_MODE, VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE,
+                               VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE, VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT,
+                               VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT};
+        desc->dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        desc->dynamicState.pDynamicStates = desc->dynamicStates.data();
+        desc->dynamicState.dynamicStateCount = dynamicState ? static_cast<uint32_t>(desc->dynamicStates.size()) : 2;
+
+        // Both stages get every constant, ids a stage does not declare are ignored
+        desc->specializationData.renderMode = static_cast<int32_t>(state.renderMode);
+        desc->specializationData.alphaTest = state.alphaTest ? VK_TRUE : VK_FALSE;
+        desc->specializationData.fog = state.fog ? VK_TRUE : VK_FALSE;
+        desc->specializationData.fullbright = state.fullbright ? VK_TRUE : VK_FALSE;
+        desc->specializationEntries = {{
+                {0, offsetof(TSpecializationData, renderMode), sizeof(int32_t)},
+                {1, offsetof(TSpecializationData, alphaTest), sizeof(VkBool32)},
+                {2, offsetof(TSpecializationData, fog), sizeof(VkBool32)},
+                {3, offsetof(TSpecializationData, fullbright), sizeof(VkBool32)}
+        }};
+        desc->specializationInfo.mapEntryCount = static_cast<uint32_t>(desc->specializationEntries.size());
+        desc->specializationInfo.pMapEntries = desc->specializationEntries.data();
+        desc->specializationInfo.dataSize = sizeof(desc->specializationData);
+        desc->specializationInfo.pData = &desc->specializationData;
+
+        desc->shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        desc->shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        desc->shaderStages[0].module = vertexShader;
+        desc->shaderStages[0].pName = "main";
+        desc->shaderStages[0].pSpecializationInfo = &desc->specializationInfo;
+        desc->shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        desc->shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        desc->shaderStages[1].module = fragmentShader;
+        desc->shaderStages[1].pName = "main";
+        desc->shaderStages[1].pSpecializationInfo = &desc->specializationInfo;
+    }
+
+    VkPipeline CPipelineRegistry::buildPipeline(const TPipelineState &state) {
+        const TShaders &formatShaders = shaders[state.vertexFormat];
+        if (formatShaders.vertexShader == VK_NULL_HANDLE || formatShaders.fragmentShader == VK_NULL_HANDLE) {
+            LOG(ERR, ("No shaders for vertex format " + std::to_string(state.vertexFormat)).c_str());
+            return VK_NULL_HANDLE;
+        }
+        if (!pipelineLibrary) {
+            return buildMonolithic(state, true);
+        }
+
+        std::array<VkPipeline, LIBRARY_PART_COUNT> parts{};
+        for (uint32_t part = 0; part < LIBRARY_PART_COUNT; ++part) {
+            parts[part] = getLibrary(static_cast<ELibraryPart>(part), state, &libraries, true);
+            if (parts[part] == VK_NULL_HANDLE) {
+                return VK_NULL_HANDLE;
+            }
+        }
+        return linkLibraries(parts, true);
+    }
+
+    VkPipeline CPipelineRegistry::buildMonolithic(const TPipelineState &state, bool cached) const {
+        const TShaders &formatShaders = shaders[state.vertexFormat];
+        TPipelineDesc desc;
+        describePipeline(state, formatShaders.vertexShader, formatShaders.fragmentShader, colorAttachmentFormat,
+                         depthAttachmentFormat, false, &desc);
+
+        VkGraphicsPipelineCreateInfo graphicsPipelineCI{};
+        graphicsPipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        graphicsPipelineCI.pNext = &desc.renderingInfo;
+        graphicsPipelineCI.layout = pipelineLayout;
+        graphicsPipelineCI.stageCount = static_cast<uint32_t>(desc.shaderStages.size());
+        graphicsPipelineCI.pStages = desc.shaderStages.data();
+        graphicsPipelineCI.pVertexInputState = &desc.vertexInputState;
+        graphicsPipelineCI.pInputAssemblyState = &desc.inputAssemblyState;
+        graphicsPipelineCI.pRasterizationState = &desc.rasterizationState;
+        graphicsPipelineCI.pColorBlendState = &desc.colorBlendState;
+        graphicsPipelineCI.pMultisampleState = &desc.multisampleState;
+        graphicsPipelineCI.pViewportState = &desc.viewportState;
+        graphicsPipelineCI.pDepthStencilState = &desc.depthStencilState;
+        graphicsPipelineCI.pDynamicState = &desc.dynamicState;
+        return createPipeline(graphicsPipelineCI, cached);
+    }
+
+    VkPipeline CPipelineRegistry::buildLibrary(ELibraryPart part, const TPipelineState &state, bool cached) const {
+        const TShaders &formatShaders = shaders[state.vertexFormat];
+        TPipelineDesc desc;
+        describePipeline(state, formatShaders.vertexShader, formatShaders.fragmentShader, colorAttachmentFormat,
+                         depthAttachmentFormat, true, &desc);
+
+        // Parts without attachment state ignore the formats
+        VkGraphicsPipelineLibraryCreateInfoEXT libraryCI{};
+        libraryCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+        libraryCI.pNext = &desc.renderingInfo;
+        libraryCI.flags = LIBRARY_PART_FLAGS[part];
+
+        // Every part gets the same dynamic states, each one only reads those of its own state
+        VkGraphicsPipelineCreateInfo graphicsPipelineCI{};
+        graphicsPipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        graphicsPipelineCI.pNext = &libraryCI;
+        graphicsPipelineCI.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+        graphicsPipelineCI.pDynamicState = &desc.dynamicState;
+        switch (part) {
+            case LIBRARY_PART_VERTEX_INPUT:
+                graphicsPipelineCI.pVertexInputState = &desc.vertexInputState;
+                graphicsPipelineCI.pInputAssemblyState = &desc.inputAssemblyState;
+                break;
+            case LIBRARY_PART_PRE_RASTERIZATION:
+                graphicsPipelineCI.stageCount = 1;
+                graphicsPipelineCI.pStages = &desc.shaderStages[0];
+                graphicsPipelineCI.pViewportState = &desc.viewportState;
+                graphicsPipelineCI.pRasterizationState = &desc.rasterizationState;
+                graphicsPipelineCI.layout = pipelineLayout;
+                break;
+            case LIBRARY_PART_FRAGMENT_SHADER:
+                graphicsPipelineCI.stageCount = 1;
+                graphicsPipelineCI.pStages = &desc.shaderStages[1];
+                graphicsPipelineCI.pDepthStencilState = &desc.depthStencilState;
+                graphicsPipelineCI.pMultisampleState = &desc.multisampleState;
+                graphicsPipelineCI.layout = pipelineLayout;
+                break;
+            default:
+                graphicsPipelineCI.pColorBlendState = &desc.colorBlendState;
+                graphicsPipelineCI.pMultisampleState = &desc.multisampleState;
+                break;
+        }
+        return createPipeline(graphicsPipelineCI, cached);
+    }
+
+    VkPipeline CPipelineRegistry::getLibrary(ELibraryPart part, const TPipelineState &state, TLibraryMap *map,
+                                             bool cached) {
+        uint32_t libraryKey = static_cast<uint32_t>(part) << LIBRARY_PART_SHIFT |
+                              (pack(state) & LIBRARY_KEY_BITS[part]);
+        {
+            std::lock_guard<std::mutex> lock(libraryMutex);
+            auto found = map->find(libraryKey);
+            if (found != map->end()) {
+                return found->second;
+            }
+        }
+
+        // Two compile threads may build the same part, the second one keeps the first
+        VkPipeline library = buildLibrary(part, state, cached);
+        if (library == VK_NULL_HANDLE) {
+            return VK_NULL_HANDLE;
+        }
+        std::lock_guard<std::mutex> lock(libraryMutex);
+        auto inserted = map->emplace(libraryKey, library);
+        if (!inserted.second) {
+            vkDestroyPipeline(logicDevice, library, nullptr);
+        }
+        return inserted.first->second;
+    }
+
+    VkPipeline CPipelineRegistry::linkLibraries(const std::array<VkPipeline, LIBRARY_PART_COUNT> &parts,
+                                                bool cached) const {
+        // Fast link without VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT, it costs about a pipeline bind
+        VkPipelineLibraryCreateInfoKHR libraryCI{};
+        libraryCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+        libraryCI.libraryCount = static_cast<uint32_t>(parts.size());
+        libraryCI.pLibraries = parts.data();
+
+        VkGraphicsPipelineCreateInfo graphicsPipelineCI{};
+        graphicsPipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        graphicsPipelineCI.pNext = &libraryCI;
+        graphicsPipelineCI.layout = pipelineLayout;
+        return createPipeline(graphicsPipelineCI, cached);
+    }
+
+    VkPipeline CPipelineRegistry::createPipeline(const VkGraphicsPipelineCreateInfo &createInfo, bool cached) const {
+        VkPipeline pipeline{};
+        VkResult result = cached ? pipelineCache->createGraphicsPipeline(createInfo, &pipeline)
+                                 : vkCreateGraphicsPipelines(logicDevice, VK_NULL_HANDLE, 1, &createInfo, nullptr,
+                                                             &pipeline);
+        if (!VK_CHECK_RESULT(result, "Cannot create graphics pipeline!")) {
+            return VK_NULL_HANDLE;
+        }
+        return pipeline;
+    }
+
+}
@@ -0,0 +1,27 @@
+#include <common/CShaderLibrary.h>
+#include <cstring>
+
+
+namespace REF_VK {
+
+#include <EmbeddedShaders.inc>
+
+    // The table ends with an empty entry
+    static constexpr uint32_t EMBEDDED_SHADER_COUNT = sizeof(EMBEDDED_SHADERS) / sizeof(EMBEDDED_SHADERS[0]) - 1;
+
+    const TEmbeddedShader *CShaderLibrary::find(const char *name) {
+        // The hash only skips the string compares, two names may share it
+        uint64_t nameHash = hash(name);
+        for (uint32_t i = 0; i < EMBEDDED_SHADER_COUNT; ++i) {
+            if (EMBEDDED_SHADERS[i].hash == nameHash && strcmp(EMBEDDED_SHADERS[i].name, name) == 0) {
+                return &EMBEDDED_SHADERS[i];
+            }
+        }
+        return nullptr;
+    }
+
+    uint32_t CShaderLibrary::getCount() {
+        return EMBEDDED_SHADER_COUNT;
+    }
+
+}
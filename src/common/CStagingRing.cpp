@@ -0,0 +1,100 @@
+#include <common/CStagingRing.h>
+#include <common/CTools.h>
+#include <common/CMemoryBudget.h>
+
+
+namespace REF_VK {
+
+    bool CStagingRing::create(VmaAllocator allocator, VkDeviceSize size, VkDeviceSize copyAlignment) {
+        vmaAllocator = allocator;
+        capacity = size;
+        alignment = copyAlignment > 0 ? copyAlignment : 1;
+        head = 0;
+        used = 0;
+        regions.clear();
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_STAGING);
+
+        VkBufferCreateInfo bufferCI{};
+        bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCI.size = capacity;
+        bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VmaAllocationInfo ringAllocInfo{};
+        if (!VK_CHECK_RESULT(vmaCreateBuffer(vmaAllocator, &bufferCI, &allocInfo, &buffer, &allocation, &ringAllocInfo),
+                             "Cannot create staging ring!")) {
+            capacity = 0;
+            return false;
+        }
+        CMemoryBudget::track(vmaAllocator, allocation);
+        mapped = static_cast<uint8_t *>(ringAllocInfo.pMappedData);
+        return true;
+    }
+
+    void CStagingRing::destroy() {
+        if (buffer != VK_NULL_HANDLE) {
+            CMemoryBudget::untrack(vmaAllocator, allocation);
+            vmaDestroyBuffer(vmaAllocator, buffer, allocation);
+            buffer = VK_NULL_HANDLE;
+            allocation = VK_NULL_HANDLE;
+        }
+        mapped = nullptr;
+        capacity = 0;
+        regions.clear();
+    }
+
+    bool CStagingRing::allocate(VkDeviceSize size, uint64_t value, TStagingAllocation *stagingAllocation) {
+        if (buffer == VK_NULL_HANDLE || size == 0 || size > capacity) {
+            return false;
+        }
+
+        VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+        VkDeviceSize consumed = offset + size - head;
+        if (offset + size > capacity) {
+            // Not enough room before the end, skip the tail and start over at zero
+            offset = 0;
+            consumed = capacity - head + size;
+        }
+        if (used + consumed > capacity) {
+            return false;
+        }
+
+        if (!regions.empty() && regions.back().value == value) {
+            regions.back().consumed += consumed;
+        } else {
+            regions.push_back({consumed, value});
+        }
+        used += consumed;
+        head = (offset + size) % capacity;
+
+        stagingAllocation->buffer = buffer;
+        stagingAllocation->offset = offset;
+        stagingAllocation->mapped = mapped + offset;
+        return true;
+    }
+
+    void CStagingRing::flush(const TStagingAllocation &stagingAllocation, VkDeviceSize size) {
+        // No-op on host coherent memory
+        vmaFlushAllocation(vmaAllocator, allocation, stagingAllocation.offset, size);
+    }
+
+    void CStagingRing::reclaim(uint64_t completedValue) {
+        while (!regions.empty() && regions.front().value <= completedValue) {
+            used -= regions.front().consumed;
+            regions.pop_front();
+        }
+    }
+
+    VkDeviceSize CStagingRing::getCapacity() const {
+        return capacity;
+    }
+
+    VkDeviceSize CStagingRing::getUsedBytes() const {
+        return used;
+    }
+
+}
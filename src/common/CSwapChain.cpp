@@ -75,7 +75,7 @@ namespace REF_VK {
         return true;
     }
 
-    void CSwapChain::create(int *width, int *height, bool vsync, bool fullscreen) {
+    void CSwapChain::create(int *width, int *height, bool vsync, bool fullscreen, TRetiredSwapChain *retired) {
 
         assert(this->physicalDevice);
         assert(this->device);
@@ -110,22 +110,27 @@ namespace REF_VK {
 
         VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
 
-        // if not VSYNC
+        // if not VSYNC, take the first supported mode in preference order
         if (!vsync) {
-            for (int i = 0; i < presentModeCount; ++i) {
-                if (presentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-                    swapchainPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-                    break;
-                }
-                if (presentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-                    swapchainPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            std::array<VkPresentModeKHR, 2> preferredModes{VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+            if (allowTearing) {
+                // Lowest latency, frames replace the scanout immediately
+                std::swap(preferredModes[0], preferredModes[1]);
+            }
+            for (auto &preferredMode: preferredModes) {
+                if (std::find(presentModes.begin(), presentModes.end(), preferredMode) != presentModes.end()) {
+                    swapchainPresentMode = preferredMode;
                     break;
                 }
             }
         }
+        presentMode = swapchainPresentMode;
 
-        // Determine the number of images
+        // Determine the number of images, fewer images means fewer frames queued for display
         uint32_t desiredNumberOfSwapchainImages = surfCaps.minImageCount + 1;
+        if (requestedImageCount > 0) {
+            desiredNumberOfSwapchainImages = std::max(requestedImageCount, surfCaps.minImageCount);
+        }
         if ((surfCaps.maxImageCount > 0) && (desiredNumberOfSwapchainImages > surfCaps.maxImageCount)) {
             desiredNumberOfSwapchainImages = surfCaps.maxImageCount;
         }
@@ -180,12 +185,20 @@ namespace REF_VK {
         // Create swap chain
         VK_CHECK_RESULT(vkCreateSwapchainKHR(device, &swapchainCI, nullptr, &swapchain), "Cannot create swapchain!");
 
-        // If any swapchian is re-created, destroy the old swapchain
+        // If any swapchian is re-created, destroy the old swapchain or let the caller retire it
         if (oldSwapchain != VK_NULL_HANDLE) {
-            for (int i = 0; i < imageCount; ++i) {
-                vkDestroyImageView(device, buffers[i].view, nullptr);
+            if (retired) {
+                retired->swapchain = oldSwapchain;
+                retired->views.clear();
+                for (int i = 0; i < imageCount; ++i) {
+                    retired->views.push_back(buffers[i].view);
+                }
+            } else {
+                for (int i = 0; i < imageCount; ++i) {
+                    vkDestroyImageView(device, buffers[i].view, nullptr);
+                }
+                vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
             }
-            vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
         }
         VK_CHECK_RESULT(vkGetSwapchainImagesKHR(device, swapchain, &imageCount, nullptr),
                         "Cannot get swapchain image count!");
@@ -226,4 +239,20 @@ namespace REF_VK {
 
     }
 
+    void CSwapChain::cleanup() {
+        if (swapchain != VK_NULL_HANDLE) {
+            for (auto &buffer: buffers) {
+                vkDestroyImageView(device, buffer.view, nullptr);
+            }
+            vkDestroySwapchainKHR(device, swapchain, nullptr);
+            buffers.clear();
+            images.clear();
+        }
+        if (surface != VK_NULL_HANDLE) {
+            vkDestroySurfaceKHR(instance, surface, nullptr);
+        }
+        swapchain = VK_NULL_HANDLE;
+        surface = VK_NULL_HANDLE;
+    }
+
 }
@@ -0,0 +1,92 @@
+#include <common/CTimeline.h>
+#include <common/CTools.h>
+
+
+namespace REF_VK {
+
+    bool CTimeline::create(VkDevice logicDevice, uint64_t initialValue) {
+        device = logicDevice;
+
+        VkSemaphoreTypeCreateInfo semaphoreTypeCI{};
+        semaphoreTypeCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        semaphoreTypeCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        semaphoreTypeCI.initialValue = initialValue;
+
+        VkSemaphoreCreateInfo semaphoreCI{};
+        semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreCI.pNext = &semaphoreTypeCI;
+
+        lastSubmitted = initialValue;
+        lastCompleted = initialValue;
+        return VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &semaphore),
+                               "Cannot create timeline semaphore!");
+    }
+
+    void CTimeline::destroy() {
+        if (semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, semaphore, nullptr);
+            semaphore = VK_NULL_HANDLE;
+        }
+    }
+
+    VkResult CTimeline::submit(VkQueue queue, const VkSubmitInfo &submitInfo, uint64_t *signalValue,
+                               std::mutex *queueMutex) {
+        std::lock_guard<std::mutex> lock(submitMutex);
+        *signalValue = lastSubmitted.load() + 1;
+        VkResult result{};
+        if (queueMutex) {
+            std::lock_guard<std::mutex> queueLock(*queueMutex);
+            result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+        } else {
+            result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+        }
+        if (result == VK_SUCCESS) {
+            lastSubmitted.store(*signalValue);
+        }
+        return result;
+    }
+
+    uint64_t CTimeline::submittedValue() const {
+        return lastSubmitted.load();
+    }
+
+    uint64_t CTimeline::completedValue() {
+        uint64_t value{};
+        if (VK_CHECK_RESULT(vkGetSemaphoreCounterValue(device, semaphore, &value),
+                            "Cannot read timeline semaphore value!")) {
+            // Several threads may refresh concurrently, never move the cached value backwards
+            uint64_t cached = lastCompleted.load();
+            while (value > cached && !lastCompleted.compare_exchange_weak(cached, value)) {
+            }
+        }
+        return lastCompleted.load();
+    }
+
+    bool CTimeline::isComplete(uint64_t value) {
+        if (value <= lastCompleted.load()) {
+            return true;
+        }
+        return value <= completedValue();
+    }
+
+    bool CTimeline::wait(uint64_t value, uint64_t timeout) {
+        if (isComplete(value)) {
+            return true;
+        }
+
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &value;
+        if (!VK_CHECK_RESULT(vkWaitSemaphores(device, &waitInfo, timeout), "Timeline semaphore wait failed!")) {
+            return false;
+        }
+
+        uint64_t cached = lastCompleted.load();
+        while (value > cached && !lastCompleted.compare_exchange_weak(cached, value)) {
+        }
+        return true;
+    }
+
+}
@@ -1,5 +1,8 @@
 #include <common/CTools.h>
-#include <fstream>
+#include <common/CFileSystem.h>
+#include <common/CFrameArena.h>
+#include <cstdlib>
+#include <cstring>
 
 namespace REF_VK {
 
@@ -98,45 +101,48 @@ namespace REF_VK {
     }
 
     VkShaderModule loadSPIRVShader(VkDevice device, std::string fileName) {
-        size_t shaderSize{};
-        char *shaderCode{};
-
-        std::ifstream is(fileName, std::ios::binary | std::ios::in | std::ios::ate);
-
-        if (is.is_open()) {
-            shaderSize = is.tellg();
-            is.seekg(0, std::ios::beg);
-
-            // Copy data to buffer
-            shaderCode = new char[shaderSize];
-            is.read(shaderCode, shaderSize);
-            is.close();
-            assert(shaderSize > 0);
+        // Mapped straight from disk, the driver reads the pages without an intermediate copy
+        CMappedFile file{};
+        if (!file.open(fileName)) {
+            VK_CHECK_RESULT(VkResult::VK_ERROR_UNKNOWN,
+                            ("Cannot read shader file! \n\t SPIR-V file path = " + fileName).c_str());
+            return VK_NULL_HANDLE;
         }
+        return loadSPIRVShader(device, file.getSpan(), fileName.c_str());
+    }
 
-        if (shaderCode) {
-            VkShaderModuleCreateInfo shaderModuleCI{};
-            shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            shaderModuleCI.codeSize = shaderSize;
-            shaderModuleCI.pCode = (uint32_t *) shaderCode;
+    VkShaderModule loadSPIRVShader(VkDevice device, const TFileSpan &code, const char *name) {
+        if (!code.data || code.size == 0 || code.size % sizeof(uint32_t) != 0) {
+            VK_CHECK_RESULT(VkResult::VK_ERROR_UNKNOWN,
+                            ("Invalid SPIR-V code! \n\t SPIR-V file path = " + std::string(name)).c_str());
+            return VK_NULL_HANDLE;
+        }
 
-            VkShaderModule shaderModule{};
-            VK_CHECK_RESULT(vkCreateShaderModule(device, &shaderModuleCI, nullptr, &shaderModule),
-                            ("Cannot create shader module! \n\t SPIR-V file path = " + fileName).c_str());
+        // Archive members are not word aligned, those go through scratch memory
+        CScratchScope scratch{};
+        const uint32_t *words = reinterpret_cast<const uint32_t *>(code.data);
+        if (reinterpret_cast<uintptr_t>(code.data) % alignof(uint32_t) != 0) {
+            auto *copy = static_cast<uint32_t *>(scratch.getArena()->allocate(code.size, alignof(uint32_t)));
+            memcpy(copy, code.data, code.size);
+            words = copy;
+        }
 
-            delete[] shaderCode;
+        VkShaderModuleCreateInfo shaderModuleCI{};
+        shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        shaderModuleCI.codeSize = code.size;
+        shaderModuleCI.pCode = words;
 
-            return shaderModule;
-        } else {
-            VK_CHECK_RESULT(VkResult::VK_ERROR_UNKNOWN,
-                            ("Cannot read shader file! \n\t SPIR-V file path = " + fileName).c_str());
+        VkShaderModule shaderModule{};
+        if (!VK_CHECK_RESULT(vkCreateShaderModule(device, &shaderModuleCI, nullptr, &shaderModule),
+                             ("Cannot create shader module! \n\t SPIR-V file path = " + std::string(name)).c_str())) {
             return VK_NULL_HANDLE;
         }
-
-        return nullptr;
+        return shaderModule;
     }
 
     std::string getBasedAssetsPath() {
-        return "../Assets/";
+        // Developer override, the engine mounts its game directories through R_MountPath
+        const char *path = std::getenv("REF_VK_ASSETS");
+        return path && path[0] ? std::string(path) + "/" : "../Assets/";
     }
 }
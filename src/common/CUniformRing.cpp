@@ -0,0 +1,81 @@
+#include <common/CUniformRing.h>
+#include <common/CTools.h>
+#include <common/CMemoryBudget.h>
+#include <algorithm>
+#include <cstring>
+
+
+namespace REF_VK {
+
+    bool CUniformRing::create(VmaAllocator allocator, VkDeviceSize minOffsetAlignment, uint32_t slotCount,
+                              VkDeviceSize slotSize) {
+        vmaAllocator = allocator;
+        alignment = std::max<VkDeviceSize>(minOffsetAlignment, 1);
+        regionSize = (slotSize + alignment - 1) / alignment * alignment;
+        regionBase = 0;
+        used = 0;
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_UNIFORM);
+
+        VkBufferCreateInfo bufferCI{};
+        bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCI.size = regionSize * slotCount;
+        bufferCI.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VmaAllocationInfo ringAllocInfo{};
+        if (!VK_CHECK_RESULT(vmaCreateBuffer(vmaAllocator, &bufferCI, &allocInfo, &buffer, &allocation, &ringAllocInfo),
+                             "Cannot create uniform ring!")) {
+            return false;
+        }
+        CMemoryBudget::track(vmaAllocator, allocation);
+        mapped = static_cast<uint8_t *>(ringAllocInfo.pMappedData);
+        return true;
+    }
+
+    void CUniformRing::destroy() {
+        if (buffer != VK_NULL_HANDLE) {
+            CMemoryBudget::untrack(vmaAllocator, allocation);
+            vmaDestroyBuffer(vmaAllocator, buffer, allocation);
+            buffer = VK_NULL_HANDLE;
+            allocation = VK_NULL_HANDLE;
+        }
+        mapped = nullptr;
+    }
+
+    void CUniformRing::beginFrame(uint32_t slot) {
+        regionBase = regionSize * slot;
+        used = 0;
+    }
+
+    void CUniformRing::endFrame() {
+        VkDeviceSize size = std::min(used.load(), regionSize);
+        if (size > 0) {
+            vmaFlushAllocation(vmaAllocator, allocation, regionBase, size);
+        }
+    }
+
+    uint32_t CUniformRing::push(const void *data, VkDeviceSize size) {
+        VkDeviceSize alignedSize = (size + alignment - 1) / alignment * alignment;
+        VkDeviceSize offset = used.fetch_add(alignedSize);
+        if (offset + size > regionSize) {
+            LOG(ERR, "Uniform ring exhausted for this frame!");
+            return INVALID_OFFSET;
+        }
+
+        memcpy(mapped + regionBase + offset, data, size);
+        return static_cast<uint32_t>(regionBase + offset);
+    }
+
+    VkBuffer CUniformRing::getBuffer() const {
+        return buffer;
+    }
+
+    VkDeviceSize CUniformRing::getUsedBytes() const {
+        return std::min(used.load(), regionSize);
+    }
+
+}
@@ -0,0 +1,405 @@
+#include <common/CUploader.h>
+#include <common/CTools.h>
+#include <common/CMemoryBudget.h>
+#include <algorithm>
+#include <cstring>
+
+
+namespace REF_VK {
+
+    bool CUploader::create(CDevice *vulkanDevice, VmaAllocator allocator, VkQueue transferQueue,
+                           std::mutex *queueMutex) {
+        device = vulkanDevice;
+        logicDevice = vulkanDevice->device;
+        vmaAllocator = allocator;
+        queue = transferQueue;
+        sharedQueueMutex = queueMutex;
+        transferFamily = device->queueFamilyIndices.transfer;
+        graphicsFamily = device->queueFamilyIndices.graphics;
+
+        // Batches signal values above WRITTEN_TOKEN, so in place writes always compare as finished
+        if (!timeline.create(logicDevice, WRITTEN_TOKEN)) {
+            return false;
+        }
+        acquiredValue = WRITTEN_TOKEN;
+        recordedAcquires.reserve(RESERVED_ACQUIRES);
+        submittedAcquires.reserve(RESERVED_ACQUIRES);
+        bufferBarriers.reserve(RESERVED_ACQUIRES);
+        imageBarriers.reserve(RESERVED_ACQUIRES);
+
+        // Image copies need offsets aligned to the texel size as well, 16 covers every format we upload
+        VkDeviceSize copyAlignment = std::max<VkDeviceSize>(device->properties.limits.optimalBufferCopyOffsetAlignment,
+                                                            16);
+        if (!stagingRing.create(vmaAllocator, STAGING_RING_SIZE, copyAlignment)) {
+            LOG(NORMAL, "Staging ring unavailable, every upload uses its own staging buffer");
+        }
+
+        for (auto &batch: batches) {
+            batch.commandPool = device->createCommandPool(transferFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+            VkCommandBufferAllocateInfo allocateInfo{};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocateInfo.commandPool = batch.commandPool;
+            allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocateInfo.commandBufferCount = 1;
+            if (!VK_CHECK_RESULT(vkAllocateCommandBuffers(logicDevice, &allocateInfo, &batch.commandBuffer),
+                                 "Cannot allocate upload command buffer!")) {
+                return false;
+            }
+            batch.value = 0;
+            batch.open = false;
+        }
+
+        if (hasDedicatedQueue()) {
+            LOG(NORMAL, "Uploads use a dedicated transfer queue");
+        }
+        return true;
+    }
+
+    void CUploader::destroy() {
+        // The device is idle at shutdown, every batch has finished
+        stagingRing.destroy();
+        for (auto &batch: batches) {
+            releaseStaging(batch);
+            if (batch.commandPool != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(logicDevice, batch.commandPool, nullptr);
+                batch.commandPool = VK_NULL_HANDLE;
+            }
+        }
+        recordedAcquires.clear();
+        submittedAcquires.clear();
+        bufferBarriers.clear();
+        imageBarriers.clear();
+        timeline.destroy();
+    }
+
+    bool CUploader::hasDedicatedQueue() const {
+        return transferFamily != graphicsFamily;
+    }
+
+    TUploadToken CUploader::uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size,
+                                         VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+        std::lock_guard<std::mutex> lock(mutex);
+        TBatch &batch = openBatch();
+        TUploadToken token = timeline.submittedValue() + 1;
+
+        CStagingRing::TStagingAllocation staging{};
+        if (!writeStaging(batch, token, data, size, &staging)) {
+            return 0;
+        }
+        stagedUploads++;
+        stagedBytes += size;
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = staging.offset;
+        copyRegion.dstOffset = offset;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(batch.commandBuffer, staging.buffer, buffer, 1, &copyRegion);
+
+        if (hasDedicatedQueue()) {
+            // Release half of the ownership transfer, the graphics queue records the matching acquire
+            VkBufferMemoryBarrier releaseBarrier{};
+            releaseBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            releaseBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            releaseBarrier.dstAccessMask = 0;
+            releaseBarrier.srcQueueFamilyIndex = transferFamily;
+            releaseBarrier.dstQueueFamilyIndex = graphicsFamily;
+            releaseBarrier.buffer = buffer;
+            releaseBarrier.offset = offset;
+            releaseBarrier.size = size;
+            vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &releaseBarrier, 0, nullptr);
+        }
+
+        TAcquire acquire{};
+        acquire.value = token;
+        acquire.buffer = buffer;
+        acquire.offset = offset;
+        acquire.size = size;
+        acquire.dstStage = dstStage;
+        acquire.dstAccess = dstAccess;
+        recordedAcquires.push_back(acquire);
+
+        return token;
+    }
+
+    TUploadToken CUploader::uploadBuffer(VkBuffer buffer, VmaAllocation allocation, VkDeviceSize offset,
+                                         const void *data, VkDeviceSize size, VkPipelineStageFlags dstStage,
+                                         VkAccessFlags dstAccess) {
+        VkMemoryPropertyFlags memoryFlags{};
+        vmaGetAllocationMemoryProperties(vmaAllocator, allocation, &memoryFlags);
+        // Host visible system memory would make every draw read over the bus, such buffers still get a copy
+        const VkMemoryPropertyFlags inPlaceFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        if ((memoryFlags & inPlaceFlags) != inPlaceFlags) {
+            return uploadBuffer(buffer, offset, data, size, dstStage, dstAccess);
+        }
+
+        // The next queue submission makes host writes visible, no copy, barrier or ownership change needed
+        if (!VK_CHECK_RESULT(vmaCopyMemoryToAllocation(vmaAllocator, data, allocation, offset, size),
+                             "Cannot write upload in place!")) {
+            return 0;
+        }
+        directUploads++;
+        directBytes += size;
+        return WRITTEN_TOKEN;
+    }
+
+    TUploadToken CUploader::uploadImage(VkImage image, VkImageAspectFlags aspect, uint32_t width, uint32_t height,
+                                        const void *data, VkDeviceSize size, VkPipelineStageFlags dstStage) {
+        std::lock_guard<std::mutex> lock(mutex);
+        TBatch &batch = openBatch();
+        TUploadToken token = timeline.submittedValue() + 1;
+
+        CStagingRing::TStagingAllocation staging{};
+        if (!writeStaging(batch, token, data, size, &staging)) {
+            return 0;
+        }
+        stagedUploads++;
+        stagedBytes += size;
+
+        VkImageMemoryBarrier imageBarrier{};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.srcAccessMask = 0;
+        imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = image;
+        imageBarrier.subresourceRange = {aspect, 0, 1, 0, 1};
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+        VkBufferImageCopy copyRegion{};
+        copyRegion.bufferOffset = staging.offset;
+        copyRegion.imageSubresource = {aspect, 0, 0, 1};
+        copyRegion.imageExtent = {width, height, 1};
+        vkCmdCopyBufferToImage(batch.commandBuffer, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                               &copyRegion);
+
+        // Transition to the sampled layout, combined with the release when the owner changes.
+        // The graphics submission waits on the timeline, which makes the copy visible.
+        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.dstAccessMask = 0;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        if (hasDedicatedQueue()) {
+            imageBarrier.srcQueueFamilyIndex = transferFamily;
+            imageBarrier.dstQueueFamilyIndex = graphicsFamily;
+        }
+        vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+        TAcquire acquire{};
+        acquire.value = token;
+        acquire.image = image;
+        acquire.aspect = aspect;
+        acquire.dstStage = dstStage;
+        acquire.dstAccess = VK_ACCESS_SHADER_READ_BIT;
+        recordedAcquires.push_back(acquire);
+
+        return token;
+    }
+
+    bool CUploader::flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        TBatch &batch = batches[currentBatch];
+        if (!batch.open) {
+            return true;
+        }
+
+        batch.open = false;
+        if (!VK_CHECK_RESULT(vkEndCommandBuffer(batch.commandBuffer), "Cannot end upload command buffer!")) {
+            return false;
+        }
+
+        // Tokens handed out while the batch was open are the value the submit signals
+        uint64_t signalValue = 0;
+        VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+        timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineSubmitInfo.signalSemaphoreValueCount = 1;
+        timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineSubmitInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timeline.semaphore;
+        // wait() flushes from any thread, a queue shared with graphics must not race the frame submits
+        if (!VK_CHECK_RESULT(timeline.submit(queue, submitInfo, &signalValue, sharedQueueMutex),
+                             "Cannot submit upload batch!")) {
+            return false;
+        }
+        batch.value = signalValue;
+
+        submittedAcquires.insert(submittedAcquires.end(), recordedAcquires.begin(), recordedAcquires.end());
+        recordedAcquires.clear();
+        currentBatch = (currentBatch + 1) % BATCH_COUNT;
+        return true;
+    }
+
+    uint64_t CUploader::acquire(VkCommandBuffer commandBuffer, VkPipelineStageFlags *waitStage) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (submittedAcquires.empty()) {
+            return 0;
+        }
+
+        uint64_t waitValue = 0;
+        VkPipelineStageFlags stages = 0;
+        bufferBarriers.clear();
+        imageBarriers.clear();
+        for (auto &acquire: submittedAcquires) {
+            waitValue = std::max(waitValue, acquire.value);
+            stages |= acquire.dstStage;
+            if (!hasDedicatedQueue()) {
+                // Same family, waiting on the timeline is all it takes
+                continue;
+            }
+
+            if (acquire.image != VK_NULL_HANDLE) {
+                VkImageMemoryBarrier imageBarrier{};
+                imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                imageBarrier.srcAccessMask = 0;
+                imageBarrier.dstAccessMask = acquire.dstAccess;
+                imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+                imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                imageBarrier.srcQueueFamilyIndex = transferFamily;
+                imageBarrier.dstQueueFamilyIndex = graphicsFamily;
+                imageBarrier.image = acquire.image;
+                imageBarrier.subresourceRange = {acquire.aspect, 0, 1, 0, 1};
+                imageBarriers.push_back(imageBarrier);
+            } else {
+                VkBufferMemoryBarrier bufferBarrier{};
+                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                bufferBarrier.srcAccessMask = 0;
+                bufferBarrier.dstAccessMask = acquire.dstAccess;
+                bufferBarrier.srcQueueFamilyIndex = transferFamily;
+                bufferBarrier.dstQueueFamilyIndex = graphicsFamily;
+                bufferBarrier.buffer = acquire.buffer;
+                bufferBarrier.offset = acquire.offset;
+                bufferBarrier.size = acquire.size;
+                bufferBarriers.push_back(bufferBarrier);
+            }
+        }
+
+        if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+            // Source stages match the semaphore wait stages, chaining the barrier after the wait
+            vkCmdPipelineBarrier(commandBuffer, stages, stages, 0, 0, nullptr,
+                                 static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                                 static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+        }
+        submittedAcquires.clear();
+
+        *waitStage |= stages;
+        acquiredValue = waitValue;
+        return waitValue;
+    }
+
+    bool CUploader::isAvailable(TUploadToken token) const {
+        return token != 0 && token <= acquiredValue.load();
+    }
+
+    bool CUploader::isComplete(TUploadToken token) {
+        return token != 0 && timeline.isComplete(token);
+    }
+
+    bool CUploader::wait(TUploadToken token) {
+        if (token > timeline.submittedValue()) {
+            flush();
+        }
+        return timeline.wait(token);
+    }
+
+    void CUploader::collect() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stagingRing.reclaim(timeline.completedValue());
+        for (auto &batch: batches) {
+            if (!batch.open && batch.value != 0 && timeline.isComplete(batch.value)) {
+                releaseStaging(batch);
+            }
+        }
+    }
+
+    TUploadStats CUploader::getStats() const {
+        TUploadStats stats{};
+        stats.directUploads = directUploads.load();
+        stats.directBytes = directBytes.load();
+        stats.stagedUploads = stagedUploads.load();
+        stats.stagedBytes = stagedBytes.load();
+        return stats;
+    }
+
+    CUploader::TBatch &CUploader::openBatch() {
+        TBatch &batch = batches[currentBatch];
+        if (batch.open) {
+            return batch;
+        }
+
+        // Only blocks when every batch of the ring is still on the transfer queue
+        timeline.wait(batch.value);
+        releaseStaging(batch);
+        VK_CHECK_RESULT(vkResetCommandPool(logicDevice, batch.commandPool, 0), "Cannot reset upload command pool!");
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK_RESULT(vkBeginCommandBuffer(batch.commandBuffer, &beginInfo), "Cannot begin upload command buffer!");
+        batch.open = true;
+        return batch;
+    }
+
+    bool CUploader::writeStaging(TBatch &batch, uint64_t value, const void *data, VkDeviceSize size,
+                                 CStagingRing::TStagingAllocation *staging) {
+        if (stagingRing.allocate(size, value, staging)) {
+            memcpy(staging->mapped, data, size);
+            stagingRing.flush(*staging, size);
+            return true;
+        }
+
+        // Larger than the ring or the ring is full, use a buffer of its own released with the batch
+        TStagingBuffer dedicated{};
+        if (!createStaging(data, size, &dedicated)) {
+            return false;
+        }
+        batch.staging.push_back(dedicated);
+        staging->buffer = dedicated.buffer;
+        staging->offset = 0;
+        staging->mapped = nullptr;
+        return true;
+    }
+
+    bool CUploader::createStaging(const void *data, VkDeviceSize size, TStagingBuffer *staging) {
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_STAGING);
+
+        VkBufferCreateInfo bufferCI{};
+        bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCI.size = size;
+        bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VmaAllocationInfo stagingAllocInfo{};
+        if (!VK_CHECK_RESULT(vmaCreateBuffer(vmaAllocator, &bufferCI, &allocInfo, &staging->buffer,
+                                             &staging->allocation, &stagingAllocInfo),
+                             "Cannot create upload staging buffer!")) {
+            return false;
+        }
+        CMemoryBudget::track(vmaAllocator, staging->allocation);
+        memcpy(stagingAllocInfo.pMappedData, data, size);
+        vmaFlushAllocation(vmaAllocator, staging->allocation, 0, size);
+        return true;
+    }
+
+    void CUploader::releaseStaging(TBatch &batch) {
+        for (auto &staging: batch.staging) {
+            CMemoryBudget::untrack(vmaAllocator, staging.allocation);
+            vmaDestroyBuffer(vmaAllocator, staging.buffer, staging.allocation);
+        }
+        batch.staging.clear();
+    }
+
+}
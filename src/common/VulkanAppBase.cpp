@@ -1,6 +1,7 @@
 #define VMA_IMPLEMENTATION
 
 #include <common/VulkanAppBase.h>
+#include <algorithm>
 
 #if defined(_DEBUG)
 bool enabledValidationLayer = true;
@@ -9,111 +10,304 @@ bool enabledValidationLayer = false;
 #endif
 
 
-void REF_VK::VulkanAppBase::setupFrameBuffer() {
-    std::array<VkImageView, 2> attachments{};
+void REF_VK::VulkanAppBase::setupOffscreenTargets() {
+    // One target per frame slot, so frames in flight never share a color image
+    colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
 
-    attachments[1] = depthStencil.imageView;
+    VkImageCreateInfo imageCI{};
+    imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCI.imageType = VK_IMAGE_TYPE_2D;
+    imageCI.format = colorFormat;
+    imageCI.extent = {static_cast<uint32_t>(winWidth), static_cast<uint32_t>(winHeight), 1};
+    imageCI.mipLevels = 1;
+    imageCI.arrayLayers = 1;
+    imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+    // Transfer source so frames can be read back for captures
+    imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_RENDER_TARGET);
+
+    VkImageViewCreateInfo imageViewCI{};
+    imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCI.format = colorFormat;
+    imageViewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCI.subresourceRange.baseMipLevel = 0;
+    imageViewCI.subresourceRange.levelCount = 1;
+    imageViewCI.subresourceRange.baseArrayLayer = 0;
+    imageViewCI.subresourceRange.layerCount = 1;
 
-    VkFramebufferCreateInfo framebufferCI{};
-    framebufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferCI.pNext = nullptr;
-    framebufferCI.renderPass = renderPass;
-    framebufferCI.attachmentCount = 2;
-    framebufferCI.pAttachments = attachments.data();
-    framebufferCI.width = winWidth;
-    framebufferCI.height = winHeight;
-    framebufferCI.layers = 1;
+    offscreenTargets.resize(MAX_CONCURRENT_FRAMES);
+    for (auto &target: offscreenTargets) {
+        VK_CHECK_RESULT(vmaCreateImage(vmaAllocator, &imageCI, &allocInfo, &target.image, &target.allocation, nullptr),
+                        "Cannot create offscreen color target!");
+        CMemoryBudget::track(vmaAllocator, target.allocation);
+        imageViewCI.image = target.image;
+        VK_CHECK_RESULT(vkCreateImageView(logicDevice, &imageViewCI, nullptr, &target.view),
+                        "Cannot create offscreen color target view!");
+    }
+}
 
-    // Create frame buffers for every swap chain image
-    frameBuffers.resize(swapChain.imageCount);
-    for (int i = 0; i < swapChain.buffers.size(); ++i) {
-        attachments[0] = swapChain.buffers[i].view;
-        VK_CHECK_RESULT(vkCreateFramebuffer(logicDevice, &framebufferCI, nullptr, &frameBuffers[i]));
+void REF_VK::VulkanAppBase::setupRenderCompleteSemaphores() {
+    VkSemaphoreCreateInfo semaphoreCI{};
+    semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    // Nothing is presented in headless mode
+    renderCompleteSemaphores.resize(headless ? 0 : swapChain.imageCount);
+    for (auto &semaphore: renderCompleteSemaphores) {
+        VK_CHECK_RESULT(vkCreateSemaphore(logicDevice, &semaphoreCI, nullptr, &semaphore));
     }
+}
 
+bool REF_VK::VulkanAppBase::recreateSwapChain() {
+    if (headless) {
+        return true;
+    }
+
+    int drawableWidth = 0, drawableHeight = 0;
+    SDL_Vulkan_GetDrawableSize(window, &drawableWidth, &drawableHeight);
+    if (drawableWidth <= 0 || drawableHeight <= 0) {
+        // Minimized, keep the old swap chain until there is something to draw into
+        return false;
+    }
+    winWidth = drawableWidth;
+    winHeight = drawableHeight;
+
+    // No idle wait, everything the submitted frames use is destroyed once they complete.
+    // Passes pick their attachments when recorded, so only the images themselves are rebuilt.
+    retiredSemaphores.insert(retiredSemaphores.end(), renderCompleteSemaphores.begin(),
+                             renderCompleteSemaphores.end());
+    deletionQueue.destroyImageView(depthStencil.imageView, frameNumber);
+    deletionQueue.destroyImage(depthStencil.image, depthStencil.allocation, frameNumber);
+
+    TRetiredSwapChain retired{};
+    swapChain.create(&winWidth, &winHeight, vsync, false, &retired);
+    swapChainFirstFrame = frameNumber;
+    retiredSwapChains.push_back(std::move(retired));
+
+    renderCompleteSemaphores.clear();
+    setupDepthStencil();
+    setupRenderCompleteSemaphores();
+
+    swapChainDirty = false;
+    return true;
 }
 
-void REF_VK::VulkanAppBase::createPipelineCache() {
-    VkPipelineCacheCreateInfo pipelineCacheCI{};
-    pipelineCacheCI.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VK_CHECK_RESULT(vkCreatePipelineCache(logicDevice, &pipelineCacheCI, nullptr, &pipelineCache));
+void REF_VK::VulkanAppBase::releaseRetiredSwapChains() {
+    // The acquire means presentation moved on to the new swap chain, the current frame is the last user
+    for (auto &semaphore: retiredSemaphores) {
+        deletionQueue.destroySemaphore(semaphore, frameNumber);
+    }
+    retiredSemaphores.clear();
+    for (auto &retired: retiredSwapChains) {
+        for (auto &view: retired.views) {
+            deletionQueue.destroyImageView(view, frameNumber);
+        }
+        deletionQueue.destroySwapchain(retired.swapchain, frameNumber);
+    }
+    retiredSwapChains.clear();
 }
 
-void REF_VK::VulkanAppBase::setupRenderPass() {
-    std::array<VkAttachmentDescription, 2> attachments{};
-
-    // Color attachment
-    attachments[0].format = swapChain.colorFormat;
-    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    // Depth attachment
-    attachments[1].format = depthFormat;
-    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference colorReference{};
-    colorReference.attachment = 0;
-    colorReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference depthReference{};
-    depthReference.attachment = 1;
-    depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpassDescription{};
-    subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpassDescription.colorAttachmentCount = 1;
-    subpassDescription.pColorAttachments = &colorReference;
-    subpassDescription.pDepthStencilAttachment = &depthReference;
-    subpassDescription.inputAttachmentCount = 0;
-    subpassDescription.pInputAttachments = nullptr;
-    subpassDescription.preserveAttachmentCount = 0;
-    subpassDescription.pPreserveAttachments = nullptr;
-    subpassDescription.pResolveAttachments = nullptr;
-
-    // Subpass dependencies for layout transitions
-    std::array<VkSubpassDependency, 2> dependencies{};
-
-    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[0].dstSubpass = 0;
-    dependencies[0].srcStageMask =
-            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
-    dependencies[0].dstStageMask =
-            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
-    dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    dependencies[0].dstAccessMask =
-            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
-    dependencies[0].dependencyFlags = 0;
-
-    dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependencies[1].dstSubpass = 0;
-    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependencies[1].srcAccessMask = 0;
-    dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
-    dependencies[1].dependencyFlags = 0;
-
-    VkRenderPassCreateInfo renderPassCI{};
-    renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassCI.attachmentCount = static_cast<uint32_t>(attachments.size());
-    renderPassCI.pAttachments = attachments.data();
-    renderPassCI.subpassCount = 1;
-    renderPassCI.pSubpasses = &subpassDescription;
-    renderPassCI.dependencyCount = static_cast<uint32_t>(dependencies.size());
-    renderPassCI.pDependencies = dependencies.data();
-
-    VK_CHECK_RESULT(vkCreateRenderPass(logicDevice, &renderPassCI, nullptr, &renderPass));
+uint32_t REF_VK::VulkanAppBase::getColorTargetCount() const {
+    if (headless) {
+        return static_cast<uint32_t>(offscreenTargets.size());
+    }
+    return swapChain.imageCount;
+}
 
+REF_VK::TRenderTarget REF_VK::VulkanAppBase::getColorTarget(uint32_t index) const {
+    TRenderTarget target{};
+    if (headless) {
+        target.colorImage = offscreenTargets[index].image;
+        target.colorView = offscreenTargets[index].view;
+        // Kept ready for a readback, present layout needs the swap chain extension
+        target.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    } else {
+        target.colorImage = swapChain.buffers[index].image;
+        target.colorView = swapChain.buffers[index].view;
+        target.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    }
+    target.depthImage = depthStencil.image;
+    target.depthView = depthStencil.imageView;
+    target.extent = {static_cast<uint32_t>(winWidth), static_cast<uint32_t>(winHeight)};
+    return target;
+}
+
+bool REF_VK::VulkanAppBase::createRenderTexture(uint32_t width, uint32_t height, TRenderTexture *texture) {
+    *texture = {};
+    texture->target.extent = {width, height};
+    texture->target.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    // Same formats as the main view, so every pipeline and recorded pass works in both
+    VkImageCreateInfo imageCI{};
+    imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCI.imageType = VK_IMAGE_TYPE_2D;
+    imageCI.format = colorFormat;
+    imageCI.extent = {width, height, 1};
+    imageCI.mipLevels = 1;
+    imageCI.arrayLayers = 1;
+    imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_RENDER_TARGET);
+
+    VkImageViewCreateInfo imageViewCI{};
+    imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCI.format = colorFormat;
+    imageViewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCI.subresourceRange.levelCount = 1;
+    imageViewCI.subresourceRange.layerCount = 1;
+
+    if (!VK_CHECK_RESULT(vmaCreateImage(vmaAllocator, &imageCI, &allocInfo, &texture->target.colorImage,
+                                        &texture->colorAllocation, nullptr), "Cannot create render texture!")) {
+        return false;
+    }
+    CMemoryBudget::track(vmaAllocator, texture->colorAllocation);
+    imageViewCI.image = texture->target.colorImage;
+    if (!VK_CHECK_RESULT(vkCreateImageView(logicDevice, &imageViewCI, nullptr, &texture->target.colorView),
+                         "Cannot create render texture view!")) {
+        return false;
+    }
+
+    imageCI.format = depthFormat;
+    imageCI.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    imageViewCI.format = depthFormat;
+    imageViewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (depthFormat >= VK_FORMAT_D16_UNORM_S8_UINT) {
+        imageViewCI.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+    if (!VK_CHECK_RESULT(vmaCreateImage(vmaAllocator, &imageCI, &allocInfo, &texture->target.depthImage,
+                                        &texture->depthAllocation, nullptr), "Cannot create render texture depth!")) {
+        return false;
+    }
+    CMemoryBudget::track(vmaAllocator, texture->depthAllocation);
+    imageViewCI.image = texture->target.depthImage;
+    return VK_CHECK_RESULT(vkCreateImageView(logicDevice, &imageViewCI, nullptr, &texture->target.depthView),
+                           "Cannot create render texture depth view!");
+}
+
+void REF_VK::VulkanAppBase::destroyRenderTexture(TRenderTexture *texture) {
+    if (texture->target.colorView) {
+        deletionQueue.destroyImageView(texture->target.colorView, frameNumber);
+    }
+    if (texture->target.colorImage) {
+        deletionQueue.destroyImage(texture->target.colorImage, texture->colorAllocation, frameNumber);
+    }
+    if (texture->target.depthView) {
+        deletionQueue.destroyImageView(texture->target.depthView, frameNumber);
+    }
+    if (texture->target.depthImage) {
+        deletionQueue.destroyImage(texture->target.depthImage, texture->depthAllocation, frameNumber);
+    }
+    *texture = {};
+    texture->retireFrame = frameNumber;
+}
+
+void REF_VK::VulkanAppBase::beginRendering(VkCommandBuffer commandBuffer, const TRenderTarget &target, bool clear,
+                                           bool clearColor) {
+    const VkPipelineStageFlags attachmentStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                                  VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                                  VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+    // Takes over the layout transitions and dependencies the render pass used to declare
+    std::array<VkImageMemoryBarrier, 2> imageBarriers{};
+    imageBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarriers[0].srcAccessMask = clear ? 0 : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarriers[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarriers[0].oldLayout = clear ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarriers[0].image = target.colorImage;
+    imageBarriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    imageBarriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarriers[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    imageBarriers[1].dstAccessMask =
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    imageBarriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarriers[1].image = target.depthImage;
+    imageBarriers[1].subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+    if (depthFormat >= VK_FORMAT_D16_UNORM_S8_UINT) {
+        imageBarriers[1].subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+    // Render textures may still be sampled by the previous frame's main view
+    vkCmdPipelineBarrier(commandBuffer, attachmentStages | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, attachmentStages,
+                         0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()),
+                         imageBarriers.data());
+
+    VkRenderingAttachmentInfo colorAttachment{};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    colorAttachment.imageView = target.colorView;
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    if (!clear) {
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    } else {
+        colorAttachment.loadOp = clearColor ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    }
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+
+    // Only the pass that draws the scene needs depth, later passes into the target leave it alone
+    VkRenderingAttachmentInfo depthAttachment{};
+    depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depthAttachment.imageView = target.depthView;
+    depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.clearValue.depthStencil = {1.0f, 0};
+
+    VkRenderingInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    // Draws are recorded into secondary command buffers by the worker threads
+    renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    renderingInfo.renderArea.extent = target.extent;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    renderingInfo.pDepthAttachment = &depthAttachment;
+    vkCmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+void REF_VK::VulkanAppBase::endRendering(VkCommandBuffer commandBuffer, const TRenderTarget &target, bool lastPass) {
+    vkCmdEndRendering(commandBuffer);
+    if (!lastPass) {
+        return;
+    }
+
+    VkImageMemoryBarrier imageBarrier{};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    imageBarrier.newLayout = target.finalLayout;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = target.colorImage;
+    imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    // Presentation waits on the semaphore, readbacks and sampling need the writes visible
+    VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    if (target.finalLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    } else if (target.finalLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, dstStage, 0, 0, nullptr, 0,
+                         nullptr, 1, &imageBarrier);
+}
+
+void REF_VK::VulkanAppBase::createPipelineCache() {
+    pipelineCache.create(device, pipelineCachePath);
 }
 
 void REF_VK::VulkanAppBase::setupDepthStencil() {
@@ -131,9 +325,11 @@ void REF_VK::VulkanAppBase::setupDepthStencil() {
     // Allocate memory for image and bind to out image
     VmaAllocationCreateInfo allocInfo{};
     allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_RENDER_TARGET);
     VK_CHECK_RESULT(
             vmaCreateImage(vmaAllocator, &imageCI, &allocInfo, &depthStencil.image, &depthStencil.allocation,
                            nullptr));
+    CMemoryBudget::track(vmaAllocator, depthStencil.allocation);
 
     // Image view
     VkImageViewCreateInfo imageViewCI{};
@@ -155,31 +351,48 @@ void REF_VK::VulkanAppBase::setupDepthStencil() {
 
 }
 
-void REF_VK::VulkanAppBase::createSynchronizationPrimitives() {
-    // Wait fences to sync command buffer access
-    VkFenceCreateInfo fenceCI = genFenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-    waitFences.resize(drawCmdBuffers.size());
-    for (auto &fence: waitFences) {
-        VK_CHECK_RESULT(vkCreateFence(logicDevice, &fenceCI, nullptr, &fence));
-    }
-}
+bool REF_VK::VulkanAppBase::submitAndWait(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore,
+                                          uint64_t waitValue, VkPipelineStageFlags waitStage) {
+    // One-off submission, waits on its own timeline value instead of a temporary fence
+    uint64_t signalValue = 0;
 
-bool REF_VK::VulkanAppBase::createCommandBuffers() {
+    VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineSubmitInfo.signalSemaphoreValueCount = 1;
+    timelineSubmitInfo.pSignalSemaphoreValues = &signalValue;
 
-    drawCmdBuffers.resize(swapChain.imageCount);
-    auto CI = genCommandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-                                           static_cast<uint32_t>(drawCmdBuffers.size()));
-    bool result = VK_CHECK_RESULT(vkAllocateCommandBuffers(logicDevice, &CI, drawCmdBuffers.data()));
-    return result;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineSubmitInfo;
+    if (waitSemaphore != VK_NULL_HANDLE) {
+        timelineSubmitInfo.waitSemaphoreValueCount = 1;
+        timelineSubmitInfo.pWaitSemaphoreValues = &waitValue;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &graphicsTimeline.semaphore;
+
+    if (!VK_CHECK_RESULT(graphicsTimeline.submit(queue, submitInfo, &signalValue, &queueMutex),
+                         "Cannot submit command buffer!")) {
+        return false;
+    }
+    return graphicsTimeline.wait(signalValue);
 }
 
 VkResult REF_VK::VulkanAppBase::createInstance() {
-    std::vector<const char *> instanceExtensions = {VK_KHR_SURFACE_EXTENSION_NAME};
+    std::vector<const char *> instanceExtensions{};
 
     // Depending on os the extensions
+    if (!headless) {
+        instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #if defined(_WIN32)
-    instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+        instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #endif
+    }
 
     // Get extensions supported by the instance and store for later use
     uint32_t extCount = 0;
@@ -268,16 +481,59 @@ VkResult REF_VK::VulkanAppBase::createInstance() {
 }
 
 void REF_VK::VulkanAppBase::shutdown() {
-    SDL_DestroyWindow(window);
-    SDL_Vulkan_UnloadLibrary();
-    SDL_Quit();
-    SDL_Log("%s", SDL_GetError());
+    if (logicDevice) {
+        vkDeviceWaitIdle(logicDevice);
+
+        releaseRetiredSwapChains();
+        deletionQueue.flushAll();
+        uploader.destroy();
+        for (auto &semaphore: renderCompleteSemaphores) {
+            vkDestroySemaphore(logicDevice, semaphore, nullptr);
+        }
+        renderCompleteSemaphores.clear();
+        vkDestroyImageView(logicDevice, depthStencil.imageView, nullptr);
+        CMemoryBudget::untrack(vmaAllocator, depthStencil.allocation);
+        vmaDestroyImage(vmaAllocator, depthStencil.image, depthStencil.allocation);
+        for (auto &target: offscreenTargets) {
+            vkDestroyImageView(logicDevice, target.view, nullptr);
+            CMemoryBudget::untrack(vmaAllocator, target.allocation);
+            vmaDestroyImage(vmaAllocator, target.image, target.allocation);
+        }
+        offscreenTargets.clear();
+        pipelineCache.destroy();
+        vkDestroyDescriptorPool(logicDevice, descriptorPool, nullptr);
+        graphicsTimeline.destroy();
+        vkDestroyCommandPool(logicDevice, cmdPool, nullptr);
+        swapChain.cleanup();
+        vmaDestroyAllocator(vmaAllocator);
+
+        // CDevice owns the logical device
+        delete device;
+        device = nullptr;
+        logicDevice = VK_NULL_HANDLE;
+    }
+    if (instance) {
+        if (enabledValidationLayer) {
+            vks::debug::freeDebugCallback(instance);
+        }
+        vkDestroyInstance(instance, nullptr);
+        instance = VK_NULL_HANDLE;
+    }
+
+    if (!headless) {
+        SDL_DestroyWindow(window);
+        SDL_Vulkan_UnloadLibrary();
+        SDL_Quit();
+        SDL_Log("%s", SDL_GetError());
+    }
 }
 
 bool REF_VK::VulkanAppBase::init() {
     bool isSuccess = true;
 
-    initWindow();
+    if (!headless) {
+        initWindow();
+    }
 
     /* ========== Init Vulkan ========== */
 
@@ -307,13 +563,107 @@ bool REF_VK::VulkanAppBase::init() {
     // Set logical device
     phyDevice = physicalDevices[selectionDeviceIndex];
     device = new REF_VK::CDevice(phyDevice);
+    LOG(NORMAL, (std::string("Selected device: ") + device->properties.deviceName).c_str());
+    // Used by the GPU profiler when present
+    enableFeatures.pipelineStatisticsQuery = device->features.pipelineStatisticsQuery;
+    // Lets the secondary command buffers run inside the profiler's statistics queries
+    enableFeatures.inheritedQueries = device->features.inheritedQueries;
+    // Present id and present wait let the frame pacer wait for the display instead of the GPU
+    if (!headless && device->extensionSupported(VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+        device->extensionSupported(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+        presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        presentIdFeatures.pNext = &presentWaitFeatures;
+        VkPhysicalDeviceFeatures2 supportedFeatures2{};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures2.pNext = &presentIdFeatures;
+        vkGetPhysicalDeviceFeatures2(phyDevice, &supportedFeatures2);
+        if (presentIdFeatures.presentId && presentWaitFeatures.presentWait) {
+            presentWaitSupported = true;
+            enableDeviceExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            enableDeviceExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+            presentWaitFeatures.pNext = deviceCreateNextChain;
+            deviceCreateNextChain = &presentIdFeatures;
+        }
+    }
+    // Real heap budgets from the driver instead of VMA's estimate
+    if (device->extensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+        memoryBudgetSupported = true;
+        enableDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+    // Graphics pipeline library plus dynamic blend state, the pipeline registry links its pipelines from parts.
+    // Dynamic cull mode and depth test/write are core in 1.3.
+    if (device->properties.apiVersion >= VK_API_VERSION_1_3 &&
+        device->extensionSupported(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        device->extensionSupported(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        device->extensionSupported(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        pipelineLibraryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+        extendedDynamicState3Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+        pipelineLibraryFeatures.pNext = &extendedDynamicState3Features;
+        VkPhysicalDeviceFeatures2 supportedFeatures2{};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures2.pNext = &pipelineLibraryFeatures;
+        vkGetPhysicalDeviceFeatures2(phyDevice, &supportedFeatures2);
+        if (pipelineLibraryFeatures.graphicsPipelineLibrary &&
+            extendedDynamicState3Features.extendedDynamicState3ColorBlendEnable &&
+            extendedDynamicState3Features.extendedDynamicState3ColorBlendEquation) {
+            pipelineLibrarySupported = true;
+            enableDeviceExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+            enableDeviceExtensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+            enableDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+            // Only enable the dynamic states the registry sets
+            extendedDynamicState3Features = {};
+            extendedDynamicState3Features.sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+            extendedDynamicState3Features.extendedDynamicState3ColorBlendEnable = VK_TRUE;
+            extendedDynamicState3Features.extendedDynamicState3ColorBlendEquation = VK_TRUE;
+            pipelineLibraryFeatures.pNext = &extendedDynamicState3Features;
+            extendedDynamicState3Features.pNext = deviceCreateNextChain;
+            deviceCreateNextChain = &pipelineLibraryFeatures;
+        }
+    }
+    LOG(NORMAL, pipelineLibrarySupported ? "Pipelines are linked from graphics pipeline libraries"
+                                         : "Graphics pipeline library unavailable, using monolithic pipelines");
+    // Passes begin with vkCmdBeginRendering, no render pass or framebuffer objects, so 1.3 is required
+    VkPhysicalDeviceVulkan13Features supportedVulkan13Features{};
+    supportedVulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    if (device->properties.apiVersion >= VK_API_VERSION_1_3) {
+        VkPhysicalDeviceFeatures2 supportedFeatures2{};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures2.pNext = &supportedVulkan13Features;
+        vkGetPhysicalDeviceFeatures2(phyDevice, &supportedFeatures2);
+    }
+    if (!supportedVulkan13Features.dynamicRendering) {
+        LOG(ERR, (std::string("Device ") + device->properties.deviceName +
+                  " does not support Vulkan 1.3 dynamic rendering").c_str());
+        // No logical device yet, so destroy would not release it
+        delete device;
+        device = nullptr;
+        return false;
+    }
+    enableVulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    enableVulkan13Features.dynamicRendering = VK_TRUE;
+    enableVulkan13Features.pNext = deviceCreateNextChain;
+    deviceCreateNextChain = &enableVulkan13Features;
+    // Timeline semaphores are core in 1.2 but still have to be enabled
+    enableVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    enableVulkan12Features.timelineSemaphore = VK_TRUE;
+    enableVulkan12Features.pNext = deviceCreateNextChain;
+    deviceCreateNextChain = &enableVulkan12Features;
     isSuccess = VK_CHECK_RESULT(device->createLogicalDevice(enableFeatures, enableDeviceExtensions,
-                                                            deviceCreateNextChain),
+                                                            deviceCreateNextChain, !headless),
                                 "Could not create vulkan device");
     logicDevice = device->device;
+    if (presentWaitSupported) {
+        vkWaitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+                vkGetDeviceProcAddr(logicDevice, "vkWaitForPresentKHR"));
+        presentWaitSupported = vkWaitForPresent != nullptr;
+    }
 
     // Get graphics queue form the device
     vkGetDeviceQueue(logicDevice,device->queueFamilyIndices.graphics, 0, &queue);
+    // Same queue as graphics when the device has no separate transfer family
+    vkGetDeviceQueue(logicDevice, device->queueFamilyIndices.transfer, 0, &transferQueue);
 
     //Find a suitable depth, stencil format
     VkBool32 validFormat{};
@@ -324,25 +674,8 @@ bool REF_VK::VulkanAppBase::init() {
     }
     assert(validFormat);
 
-    // Create synchronization objects
-    VkSemaphoreCreateInfo semaphoreCreateInfo{};
-    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    // Create synchronization semaphore for swap chain image presentation
-    VK_CHECK_RESULT(
-            vkCreateSemaphore(logicDevice, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete),
-            "Cannot create synchronization semaphore for swap chain image presentation");
-    // Create synchronization semaphore for command buffer
-    VK_CHECK_RESULT(
-            vkCreateSemaphore(logicDevice, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete),
-            "Cannot create synchronization semaphore for command buffer");
-
-    // Setup synchronization objects
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.pWaitDstStageMask = &submitPipelineStageFlags;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &semaphores.presentComplete;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &semaphores.renderComplete;
+    // Create the graphics queue timeline
+    isSuccess = graphicsTimeline.create(logicDevice) && isSuccess;
 
     return isSuccess;
 }
@@ -364,44 +697,53 @@ void REF_VK::VulkanAppBase::initWindow() {
 void REF_VK::VulkanAppBase::createCommandPool() {
     VkCommandPoolCreateInfo cmdPoolCI{};
     cmdPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    cmdPoolCI.queueFamilyIndex = swapChain.queueNodeIndex;
+    cmdPoolCI.queueFamilyIndex = device->queueFamilyIndices.graphics;
     cmdPoolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     VK_CHECK_RESULT(vkCreateCommandPool(logicDevice, &cmdPoolCI, nullptr, &cmdPool),
                     "Create command pool error!");
 }
 
 bool REF_VK::VulkanAppBase::prepare() {
-    // prepare swap chain context
-    swapChain.setContext(instance, phyDevice, logicDevice);
-
-    // Initial swap chain surface
-    bool isSuccess = swapChain.initSurface(window);
-
-    // Create command pool
-    createCommandPool();
-
-    // Setup swap chain
-    swapChain.create(&winWidth, &winHeight, false, false);
+    bool isSuccess = true;
 
     // Create VMA
     VmaAllocatorCreateInfo vmaAllocatorCI{};
     vmaAllocatorCI.device = this->logicDevice;
     vmaAllocatorCI.instance = this->instance;
     vmaAllocatorCI.physicalDevice = this->phyDevice;
+    // VMA must not use functions above the version the device supports
+    vmaAllocatorCI.vulkanApiVersion = std::min(VK_API_VERSION_1_3, device->properties.apiVersion);
+    if (memoryBudgetSupported) {
+        vmaAllocatorCI.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
     vmaCreateAllocator(&vmaAllocatorCI, &this->vmaAllocator);
+    memoryBudget.create(vmaAllocator, memoryBudgetSupported);
+    defragmenter.create(logicDevice, vmaAllocator);
+    deletionQueue.setContext(logicDevice, vmaAllocator);
+    uploader.create(device, vmaAllocator, transferQueue, transferQueue == queue ? &queueMutex : nullptr);
 
-    // Create command buffers
-    createCommandBuffers();
+    if (headless) {
+        setupOffscreenTargets();
+    } else {
+        // prepare swap chain context
+        swapChain.setContext(instance, phyDevice, logicDevice);
 
-    createSynchronizationPrimitives();
+        // Initial swap chain surface
+        isSuccess = swapChain.initSurface(window);
 
-    setupDepthStencil();
+        // Setup swap chain
+        swapChain.create(&winWidth, &winHeight, vsync, false);
+        colorFormat = swapChain.colorFormat;
+    }
 
-    setupRenderPass();
+    // Create command pool
+    createCommandPool();
+
+    setupDepthStencil();
 
     createPipelineCache();
 
-    setupFrameBuffer();
+    setupRenderCompleteSemaphores();
 
     return isSuccess;
 }
@@ -10,7 +10,24 @@
 #include <common/CSwapChain.h>
 #include <common/vk_mem_alloc.h>
 #include <common/VulkanAppBase.h>
+#include <common/CGpuProfiler.h>
+#include <common/CFramePacer.h>
+#include <common/CCommandRecorder.h>
+#include <common/CUniformRing.h>
+#include <common/CGeometryArena.h>
+#include <common/VertexLayout.h>
+#include <common/CFrameArena.h>
+#include <common/CHeapCounter.h>
+#include <common/CFileSystem.h>
+#include <common/CPipelineRegistry.h>
+#include <common/CShaderLibrary.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <cstring>
 
 #if defined(_WIN32)
 
@@ -19,11 +36,26 @@
 
 #endif
 
-#define MAX_CONCURRENT_FRAMES 2
-
 
 namespace REF_VK {
 
+    // Uniform bytes per frame, 256 byte aligned blocks leave room for about a thousand draws
+    const VkDeviceSize UNIFORM_RING_SLOT_SIZE = 256 * 1024;
+    // Geometry arena page size, about 24 MB of vertices and 16 MB of indices
+    const uint32_t GEOMETRY_PAGE_VERTICES = 1024 * 1024;
+    const uint32_t GEOMETRY_PAGE_INDICES = 4 * 1024 * 1024;
+    // Transient CPU data of one frame, grows to the high water mark if a frame needs more
+    const size_t FRAME_ARENA_SIZE = 4 * 1024 * 1024;
+    // Frames after start, a level change or a swap chain rebuild before heap allocations count as leaks
+    const uint64_t HEAP_CHECK_WARMUP_FRAMES = 120;
+    // Background pipeline compiles, kept off the frame's worker threads
+    const uint32_t PIPELINE_COMPILE_THREADS = 2;
+    // Mirror and monitor views drawn per frame, each is its own rendering pass before the main view
+    const uint32_t MAX_TEXTURE_PASSES = 4;
+    // Sprites and the HUD draw without culling, brushes cull back faces, mirrored studio models front faces
+    const std::array<VkCullModeFlags, 3> MAP_CULL_MODES{VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT,
+                                                        VK_CULL_MODE_FRONT_BIT};
+
     class CRef_Vk : public VulkanAppBase {
     public:
         void createSynchronizationPrimitives();
@@ -44,57 +76,190 @@ namespace REF_VK {
 
         bool prepare();
 
+        void shutdown();
+
+        void setFramesInFlight(uint32_t count);
+
+        void setHeadless(bool enable, int width, int height);
+
+        // Game directory or PAK / PK3 archive, later mounts override earlier ones
+        bool mountPath(const char *path);
+
+        void getFrameStats(TFrameStats *stats) const;
+
+        bool getGpuScopeStats(int scope, TGpuScopeStats *stats) const;
+
+        bool speedsMessage(char *out, size_t size) const;
+
+        void setPresentConfig(const TPresentConfig &config);
+
+        void waitForInputSample();
+
+        void getLatencyStats(TLatencyStats *stats) const;
+
+        void getUploadStats(TUploadStats *stats) const;
+
+        void getPipelineCacheStats(TPipelineCacheStats *stats) const;
+
+        void benchmarkPipelines(TPipelineBuildStats *stats);
+
+        int getMemoryHeapCount() const;
+
+        bool getMemoryHeapStats(int heap, TMemoryHeapStats *stats) const;
+
+        bool getMemoryCategoryStats(int category, TMemoryCategoryStats *stats) const;
+
+        bool memoryReport(char *out, size_t size) const;
+
+        bool dumpMemoryJson(const char *path) const;
+
+        void setDefragmentation(bool enable);
+
+        void setMapRenderModes(const int *renderModes, int count);
+
+        void setFog(bool enable, const float color[3], float density);
+
+        void getDefragStats(TDefragStats *stats) const;
+
+        void newMap();
+
+        int uploadMesh(const Vertex *vertices, int vertexCount, const uint32_t *indices, int indexCount);
+
+        void freeMesh(int mesh);
+
+        bool beginFrame(bool clearScene);
+
+        void renderScene();
+
+        int createRenderTexture(int width, int height);
+
+        void freeRenderTexture(int texture);
+
+        void renderSceneToTexture(int texture, const float *view);
+
+        void endFrame();
+
+        bool readPixel(int x, int y, unsigned char rgba[4]);
+
     private:
-        // Vertex buffer
-        struct {
-            VkBuffer buffer;
-            VmaAllocation allocation;
-        } vertices;
-        //Indices buffer
-        struct {
-            VkBuffer buffer;
-            VmaAllocation allocation;
-            uint32_t count;
-        } indices;
+        void setViewportScissor(VkCommandBuffer commandBuffer, VkExtent2D extent);
+
+        // Queue the scene draws of one pass, the extent is the pass's render area
+        void recordScene(uint32_t pass, VkExtent2D extent, const glm::mat4 &view, const glm::mat4 &projection);
+
+        // Scene camera projection for a render area of extent
+        static glm::mat4 sceneProjection(VkExtent2D extent);
+
+        // Embedded SPIR-V by its name below assets/, the .spv through the file system otherwise
+        VkShaderModule loadShader(const char *name);
+
+        // Startup pipeline cache hits and compile time
+        void reportPipelineCache() const;
+
+        // Shaders and game assets, read through mappings without copies
+        CFileSystem fileSystem{};
+
+        // Every mesh lives in the arena, draws only differ by firstIndex and vertexOffset
+        CGeometryArena geometryArena{};
+        TGeometryHandle triangleMesh = INVALID_GEOMETRY;
+        // Compact device memory on level changes, off unless R_SetDefragmentation asks for it
+        bool defragmentOnNewMap = false;
+        TDefragStats defragStats{};
+        // Transfer timeline value the frame submission waits for, 0 when nothing was acquired
+        uint64_t uploadWaitValue = 0;
+        VkPipelineStageFlags uploadWaitStage = 0;
 
         typedef struct SShaderData {
             glm::mat4 projection;
             glm::mat4 model;
             glm::mat4 view;
+            // rgb render color, a render amount
+            glm::vec4 renderColor;
+            glm::vec4 ambientLight;
+            // rgb fog color, a density
+            glm::vec4 fog;
         } TShaderData;
 
-        typedef struct SUniformBuffer {
-            VmaAllocation allocation;
-            VkBuffer buffer;
-            // store the resources bound to the binding point in a shader
-            VkDescriptorSet descriptorSet;
-            uint8_t *mapped{nullptr};
-        } TUniformBuffer;
-
-        std::array<VkSemaphore, MAX_CONCURRENT_FRAMES> presentCompleteSemaphores{};
-        std::array<VkSemaphore, MAX_CONCURRENT_FRAMES> renderCompleteSemaphores{};
-        std::array<VkFence, MAX_CONCURRENT_FRAMES> waitFences{};
+        // What a scene recording job needs, lives in the frame arena so the capture stays two pointers
+        typedef struct SSceneRecord {
+            CGeometryArena::TMeshRange range;
+            VkExtent2D extent;
+            glm::mat4 view;
+            glm::mat4 projection;
+        } TSceneRecord;
+
+        // Per-draw uniform data of every frame slot, bound through one dynamic descriptor set
+        CUniformRing uniformRing{};
+        VkDescriptorSet uniformDescriptorSet{};
+        // Camera of the frame being recorded, copied into each draw's uniform block
+        TShaderData frameShaderData{};
+
+        // Everything the CPU touches while recording one frame, reused once the GPU is done with it
+        typedef struct SFrameContext {
+            VkCommandBuffer commandBuffer;
+            // Swap chain image acquired
+            VkSemaphore presentComplete;
+            // Graphics timeline value signaled when this frame finished on the GPU
+            uint64_t timelineValue;
+            // Frame number last submitted from this slot
+            uint64_t frameNumber;
+        } TFrameContext;
+
+        std::array<TFrameContext, MAX_CONCURRENT_FRAMES> frames{};
         VkCommandPool commandPool{};
-        std::array<VkCommandBuffer, MAX_CONCURRENT_FRAMES> commandBuffers{};
-        std::array<TUniformBuffer, MAX_CONCURRENT_FRAMES> uniformBuffers{};
         VkDescriptorSetLayout descriptorSetLayout{};
         VkPipelineLayout pipelineLayout{};
-        VkPipeline pipeline{};
+        // Every pipeline state, compiled in the background on first use
+        CPipelineRegistry pipelineRegistry{};
+        TPipelineKey trianglePipeline{};
+        // Render modes of the current map's entities, their variants are compiled during R_NewMap
+        std::vector<ERenderMode> mapRenderModes{};
+        bool fogEnabled = false;
+        glm::vec4 fog{};
+        CGpuProfiler gpuProfiler{};
+        CFramePacer framePacer{};
+        // Culling, entity setup and command recording run here
+        CJobSystem jobSystem{};
+        CCommandRecorder commandRecorder{};
+        TPresentConfig presentConfig{false, false, 0, 0, 2};
+        // Freed slots keep a null image and are reused
+        std::vector<TRenderTexture> renderTextures{};
+        // Render textures drawn this frame, pass MAIN_VIEW_PASS + 1 + i renders into texturePasses[i]
+        std::array<int, MAX_TEXTURE_PASSES> texturePasses{};
+        uint32_t texturePassCount = 0;
+        // Color target of the last submitted frame, kept for readbacks in headless mode
+        uint32_t lastImageIndex = 0;
+        bool lastFrameSubmitted = false;
+
+        uint32_t framesInFlight = MIN_CONCURRENT_FRAMES;
+        // Ring size asked for during a frame, applied once R_EndFrame moved to the next slot
+        uint32_t requestedFramesInFlight = MIN_CONCURRENT_FRAMES;
+        uint32_t currentFrame = 0;
+        uint32_t currentImageIndex = 0;
+        bool frameActive = false;
+        // R_BeginFrame's clearScene, false when the scene covers the whole view
+        bool clearMainView = true;
+
+        // Draw lists, sort keys and record job data, reset once the frame is recorded
+        CFrameArena frameArena{};
+        // Steady state frames must not allocate from the global heap
+        uint64_t heapCheckFrame = HEAP_CHECK_WARMUP_FRAMES;
+        uint64_t frameHeapAllocations = 0;
+
+        // Wall time between consecutive R_EndFrame calls
+        TFrameStats frameStats{};
+        double frameTimeSumMs = 0.0;
+        std::chrono::steady_clock::time_point lastFrameEnd{};
     };
 
     void CRef_Vk::createSynchronizationPrimitives() {
         VkSemaphoreCreateInfo semaphoreCI{};
         semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        VkFenceCreateInfo fenceCI{};
-        fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceCI.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-        for (int i = 0; i < MAX_CONCURRENT_FRAMES; ++i) {
-            VK_CHECK_RESULT(vkCreateSemaphore(logicDevice, &semaphoreCI, nullptr, &presentCompleteSemaphores[i]));
-            VK_CHECK_RESULT(vkCreateSemaphore(logicDevice, &semaphoreCI, nullptr, &renderCompleteSemaphores[i]));
-
-            VK_CHECK_RESULT(vkCreateFence(logicDevice, &fenceCI, nullptr, &waitFences[i]));
+        // Every slot of the ring is created, so the depth can change without reallocation
+        for (auto &frame: frames) {
+            VK_CHECK_RESULT(vkCreateSemaphore(logicDevice, &semaphoreCI, nullptr, &frame.presentComplete));
+            frame.timelineValue = 0;
         }
 
         return;
@@ -104,134 +269,31 @@ namespace REF_VK {
 
         // Vertex data
         std::vector<Vertex> vertexBuffer{
-                {{1.0f,  1.0f,  0.0f}, {1.0f, 0.0f, 0.0f}},
-                {{-1.0f, 1.0f,  0.0f}, {0.0f, 1.0f, 0.0f}},
-                {{0.0f,  -1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}}
+                {{1.0f,  1.0f,  0.0f}, {255, 0,   0,   255}},
+                {{-1.0f, 1.0f,  0.0f}, {0,   255, 0,   255}},
+                {{0.0f,  -1.0f, 0.0f}, {0,   0,   255, 255}}
         };
-        uint32_t vertexBufferSize = static_cast<uint32_t>(vertexBuffer.size() * sizeof(Vertex));
 
         // Index data
         std::vector<uint32_t> indexBuffer{0,
                                           1,
                                           2};
-        uint32_t indexBufferSize = static_cast<uint32_t>(indexBuffer.size() * sizeof(uint32_t));
-        indices.count = indexBufferSize;
-
-        // Temp staging buffer
-        struct SStagingBuffer {
-            VkBuffer buffer;
-            VmaAllocation allocation;
-        };
-        struct {
-            SStagingBuffer vertices;
-            SStagingBuffer indices;
-        } stagingBuffers{};
 
-        // VMA memory usage auto
-        VmaAllocationCreateInfo allocInfo{};
-        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
-
-        // Allocator vertex staging buffer memory
-        VkBufferCreateInfo vbCI{};
-        vbCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        vbCI.size = vertexBufferSize;
-        vbCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        vbCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        VmaAllocationInfo stagingVertexBufferAllocInfo{};
-        bool result = VK_CHECK_RESULT(
-                vmaCreateBuffer(vmaAllocator, &vbCI, &allocInfo, &stagingBuffers.vertices.buffer,
-                                &stagingBuffers.vertices.allocation,
-                                &stagingVertexBufferAllocInfo));
-        // Map and copy
-        void *data = stagingVertexBufferAllocInfo.pMappedData;
-//            vmaMapMemory(vmaAllocator, stagingBuffers.vertices.allocation, &data);
-        memcpy(data, vertexBuffer.data(), vertexBufferSize);
-//            vmaUnmapMemory(vmaAllocator, stagingBuffers.vertices.allocation);
-        // Allocator vertex buffer memory
-        vbCI.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-        vbCI.flags = 0;
-        vmaCreateBuffer(vmaAllocator, &vbCI, &allocInfo, &vertices.buffer, &vertices.allocation, nullptr);
-
-        // Allocator index staging buffer memory
-        VkBufferCreateInfo ibCI{};
-        ibCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        ibCI.size = indexBufferSize;
-        ibCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        ibCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        VmaAllocationInfo stagingIndexBufferAllocInfo{};
-        result = VK_CHECK_RESULT(
-                vmaCreateBuffer(vmaAllocator, &ibCI, &allocInfo, &stagingBuffers.indices.buffer,
-                                &stagingBuffers.indices.allocation,
-                                &stagingIndexBufferAllocInfo));
-        // Map and copy
-        data = stagingIndexBufferAllocInfo.pMappedData;
-//            vmaMapMemory(vmaAllocator, stagingBuffers.indices.allocation, &data);
-        memcpy(data, indexBuffer.data(), indexBufferSize);
-//            vmaUnmapMemory(vmaAllocator, stagingBuffers.indices.allocation);
-        // Allocator index buffer memory
-        ibCI.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-        ibCI.flags = 0;
-        vmaCreateBuffer(vmaAllocator, &ibCI, &allocInfo, &indices.buffer, &indices.allocation, nullptr);
-
-
-        //Copy command buffer submit
-        VkCommandBuffer copyCmdBuf;
-
-        VkCommandBufferAllocateInfo cmdBuffAllocateInfo{};
-        cmdBuffAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        cmdBuffAllocateInfo.commandPool = cmdPool;
-        cmdBuffAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        cmdBuffAllocateInfo.commandBufferCount = 1;
-        VK_CHECK_RESULT(vkAllocateCommandBuffers(logicDevice, &cmdBuffAllocateInfo, &copyCmdBuf));
-
-        // Start command
-        VkCommandBufferBeginInfo cmdBuffBeginInfo{};
-        cmdBuffBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmdBuf, &cmdBuffBeginInfo));
-        {
-            VkBufferCopy copyRegion{};
-            // Vertex buffer copy
-            copyRegion.size = vertexBufferSize;
-            vkCmdCopyBuffer(copyCmdBuf, stagingBuffers.vertices.buffer, vertices.buffer, 1, &copyRegion);
-            // Index buffer copy
-            copyRegion.size = indexBufferSize;
-            vkCmdCopyBuffer(copyCmdBuf, stagingBuffers.indices.buffer, indices.buffer, 1, &copyRegion);
-        }
-        // Stop command
-        VK_CHECK_RESULT(vkEndCommandBuffer(copyCmdBuf));
-
-        // Create fence for wait command buffer executed
-        VkFenceCreateInfo fenceCI{};
-        fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceCI.flags = 0;
-        VkFence fence;
-        VK_CHECK_RESULT(vkCreateFence(logicDevice, &fenceCI, nullptr, &fence));
-
-        // Submit the command buffer to the queue to finish the copy
-        VkSubmitInfo submitInfoTemp{};
-        submitInfoTemp.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfoTemp.commandBufferCount = 1;
-        submitInfoTemp.pCommandBuffers = &copyCmdBuf;
-
-        // Submit to queue
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfoTemp, fence));
-        // Wait...
-        VK_CHECK_RESULT(vkWaitForFences(logicDevice, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
-
-        vkDestroyFence(logicDevice, fence, nullptr);
-        vkFreeCommandBuffers(logicDevice, cmdPool, 1, &copyCmdBuf);
-
-        vmaDestroyBuffer(vmaAllocator, stagingBuffers.vertices.buffer, stagingBuffers.vertices.allocation);
-//        vmaFreeMemory(vmaAllocator, stagingBuffers.vertices.allocation);
-        vmaDestroyBuffer(vmaAllocator, stagingBuffers.indices.buffer, stagingBuffers.indices.allocation);
-//        vmaFreeMemory(vmaAllocator, stagingBuffers.indices.allocation);
+        // Device local pages shared by all meshes, filled by the transfer queue
+        geometryArena.create(vmaAllocator, &uploader, sizeof(Vertex), GEOMETRY_PAGE_VERTICES, GEOMETRY_PAGE_INDICES,
+                             &defragmenter);
+        triangleMesh = geometryArena.allocate(vertexBuffer.data(), static_cast<uint32_t>(vertexBuffer.size()),
+                                              indexBuffer.data(), static_cast<uint32_t>(indexBuffer.size()));
 
         return;
     }
 
     bool CRef_Vk::prepare() {
-        VulkanAppBase::prepare();
+        if (!VulkanAppBase::prepare()) {
+            return false;
+        }
+        // The renderer's own assets under everything the engine mounted, before or after
+        fileSystem.mount(getBasedAssetsPath(), true);
         createSynchronizationPrimitives();
         createCommandBuffers();
         createVertexBuffer();
@@ -240,53 +302,780 @@ namespace REF_VK {
         createDescriptorPool();
         createDescriptorSets();
         createPipelines();
+        reportPipelineCache();
+        frameArena.create(FRAME_ARENA_SIZE);
+        gpuProfiler.create(device, MAX_CONCURRENT_FRAMES);
+        // One worker per remaining core, the engine thread takes part while it waits
+        jobSystem.create(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+        commandRecorder.create(logicDevice, device->queueFamilyIndices.graphics, MAX_CONCURRENT_FRAMES, &jobSystem,
+                               gpuProfiler.getInheritedStatistics());
+        framePacer.setPresentWait(presentWaitSupported && !headless);
+
+        return true;
+    }
 
+    void CRef_Vk::shutdown() {
+        // Drain every frame still in flight before anything is released
+        if (logicDevice) {
+            vkDeviceWaitIdle(logicDevice);
+
+            commandRecorder.destroy();
+            jobSystem.destroy();
+            gpuProfiler.destroy();
+            pipelineRegistry.destroy();
+            vkDestroyPipelineLayout(logicDevice, pipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(logicDevice, descriptorSetLayout, nullptr);
+
+            for (auto &frame: frames) {
+                vkDestroySemaphore(logicDevice, frame.presentComplete, nullptr);
+            }
+            uniformRing.destroy();
+            vkDestroyCommandPool(logicDevice, commandPool, nullptr);
+
+            geometryArena.destroy();
+            frameArena.destroy();
+            for (auto &texture: renderTextures) {
+                destroyRenderTexture(&texture);
+            }
+            renderTextures.clear();
+        }
+        fileSystem.unmountAll();
+
+        VulkanAppBase::shutdown();
+        // Everything queued for deletion was released with the device
+        frameStats.pendingDestroys = static_cast<unsigned int>(deletionQueue.pendingCount());
+        lastFrameSubmitted = false;
+    }
+
+    void CRef_Vk::setHeadless(bool enable, int width, int height) {
+        // Must be selected before R_Init, the instance and device depend on it
+        assert(!logicDevice);
+        headless = enable;
+        if (width > 0 && height > 0) {
+            winWidth = width;
+            winHeight = height;
+        }
+    }
+
+    bool CRef_Vk::mountPath(const char *path) {
+        return path && fileSystem.mount(path);
+    }
+
+    VkShaderModule CRef_Vk::loadShader(const char *name) {
+        // Compiled into the library, no file I/O
+        const TEmbeddedShader *shader = CShaderLibrary::find(name);
+        if (shader) {
+            TFileSpan code{reinterpret_cast<const uint8_t *>(shader->code), shader->size};
+            return loadSPIRVShader(logicDevice, code, name);
+        }
+
+        // Not part of the library, a .spv shipped with the game or a mod
+        std::string path = std::string(name) + ".spv";
+        TFileSpan code{};
+        if (!fileSystem.open(path.c_str(), &code)) {
+            LOG(ERR, ("Cannot find shader " + path).c_str());
+            return VK_NULL_HANDLE;
+        }
+        return loadSPIRVShader(logicDevice, code, path.c_str());
+    }
+
+    void CRef_Vk::getFrameStats(TFrameStats *stats) const {
+        *stats = frameStats;
+    }
+
+    bool CRef_Vk::getGpuScopeStats(int scope, TGpuScopeStats *stats) const {
+        if (scope < 0 || scope >= GPU_SCOPE_COUNT) {
+            return false;
+        }
+        *stats = gpuProfiler.getScopeStats(static_cast<EGpuScope>(scope));
         return true;
     }
 
+    bool CRef_Vk::speedsMessage(char *out, size_t size) const {
+        return gpuProfiler.speedsMessage(out, size);
+    }
+
+    void CRef_Vk::setPresentConfig(const TPresentConfig &config) {
+        presentConfig = config;
+        vsync = config.vsync;
+        swapChain.requestedImageCount = static_cast<uint32_t>(std::max(config.swapchainImages, 0));
+        swapChain.allowTearing = config.allowTearing;
+        framePacer.setMaxFps(config.maxFps);
+        // Applied by the swap chain rebuild at the start of the next frame
+        if (logicDevice) {
+            swapChainDirty = true;
+        }
+    }
+
+    void CRef_Vk::waitForInputSample() {
+        // Keep at most maxQueuedFrames between this input sample and the display
+        uint32_t maxQueued = std::clamp<uint32_t>(static_cast<uint32_t>(std::max(presentConfig.maxQueuedFrames, 1)), 1,
+                                                  framesInFlight);
+        if (frameNumber > maxQueued) {
+            uint64_t waitFrame = frameNumber - maxQueued;
+            if (presentWaitSupported && !headless && waitFrame >= swapChainFirstFrame) {
+                // Present ids are frame numbers, a failed present only costs the timeout
+                VkResult result = vkWaitForPresent(logicDevice, swapChain.swapchain, waitFrame, PRESENT_WAIT_TIMEOUT);
+                if (result == VK_SUCCESS) {
+                    framePacer.markDisplayed(waitFrame);
+                }
+            } else {
+                for (auto &slot: frames) {
+                    if (slot.frameNumber == waitFrame) {
+                        graphicsTimeline.wait(slot.timelineValue);
+                    }
+                }
+            }
+        }
+
+        framePacer.limit();
+        framePacer.markInputSample(frameNumber);
+    }
+
+    void CRef_Vk::getLatencyStats(TLatencyStats *stats) const {
+        *stats = framePacer.getStats();
+    }
+
+    void CRef_Vk::getUploadStats(TUploadStats *stats) const {
+        *stats = uploader.getStats();
+    }
+
+    void CRef_Vk::getPipelineCacheStats(TPipelineCacheStats *stats) const {
+        *stats = pipelineCache.getStats();
+    }
+
+    void CRef_Vk::benchmarkPipelines(TPipelineBuildStats *stats) {
+        pipelineRegistry.waitIdle();
+        pipelineRegistry.benchmark(stats);
+    }
+
+    void CRef_Vk::reportPipelineCache() const {
+        TPipelineCacheStats stats = pipelineCache.getStats();
+        LOG(NORMAL, ("Pipeline cache: " + std::to_string(stats.cacheHits) + "/" +
+                     std::to_string(stats.pipelinesCreated) + " pipelines (" + std::to_string(stats.unknownHits) +
+                     " unknown) from " + std::to_string(stats.loadedBytes / 1024) + " KB, " +
+                     std::to_string(stats.totalCompileMs) +
+                     " ms creating, slowest " + std::to_string(stats.maxCompileMs) + " ms").c_str());
+    }
+
+    int CRef_Vk::getMemoryHeapCount() const {
+        return logicDevice ? static_cast<int>(memoryBudget.getHeapCount()) : 0;
+    }
+
+    bool CRef_Vk::getMemoryHeapStats(int heap, TMemoryHeapStats *stats) const {
+        if (!logicDevice || heap < 0) {
+            return false;
+        }
+        return memoryBudget.getHeapStats(static_cast<uint32_t>(heap), stats);
+    }
+
+    bool CRef_Vk::getMemoryCategoryStats(int category, TMemoryCategoryStats *stats) const {
+        if (category < 0 || category >= MEMORY_CATEGORY_COUNT) {
+            return false;
+        }
+        *stats = CMemoryBudget::getCategoryStats(static_cast<EMemoryCategory>(category));
+        return true;
+    }
+
+    bool CRef_Vk::memoryReport(char *out, size_t size) const {
+        return logicDevice && memoryBudget.report(out, size);
+    }
+
+    bool CRef_Vk::dumpMemoryJson(const char *path) const {
+        return logicDevice && path && memoryBudget.dumpJson(path);
+    }
+
+    void CRef_Vk::setFramesInFlight(uint32_t count) {
+        // All slots already exist, a slot still owned by the GPU is waited on by beginFrame before reuse
+        requestedFramesInFlight = std::clamp<uint32_t>(count, MIN_CONCURRENT_FRAMES, MAX_CONCURRENT_FRAMES);
+        if (frameActive) {
+            return;
+        }
+        framesInFlight = requestedFramesInFlight;
+        currentFrame %= framesInFlight;
+    }
+
+    void CRef_Vk::newMap() {
+        assert(!frameActive);
+        // Meshes the engine freed before the level change are left behind, the survivors move to fresh pages
+        VkCommandBuffer commandBuffer{};
+        VkCommandBufferAllocateInfo cmdBufAllocateInfo = genCommandBufferAllocateInfo(cmdPool,
+                                                                                      VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                                                                      1);
+        if (!VK_CHECK_RESULT(vkAllocateCommandBuffers(logicDevice, &cmdBufAllocateInfo, &commandBuffer))) {
+            return;
+        }
+        VkCommandBufferBeginInfo cmdBufBeginInfo{};
+        cmdBufBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufBeginInfo));
+
+        // Pending uploads into the old pages must land before they are copied
+        uploader.flush();
+        VkPipelineStageFlags waitStage = 0;
+        uint64_t waitValue = uploader.acquire(commandBuffer, &waitStage);
+        if (waitValue != 0) {
+            VkMemoryBarrier memoryBarrier{};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, waitStage, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier,
+                                 0, nullptr, 0, nullptr);
+            waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        }
+
+        // Frames still in flight keep reading the old pages, those go through the deletion queue
+        geometryArena.collect(completedFrameNumber);
+        bool compacted = geometryArena.compact(commandBuffer, deletionQueue, frameNumber);
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+        submitAndWait(commandBuffer, waitValue != 0 ? uploader.timeline.semaphore : VK_NULL_HANDLE, waitValue,
+                      waitStage);
+
+        if (compacted) {
+            LOG(NORMAL, ("Geometry arena compacted to " + std::to_string(geometryArena.getPageCount()) + " pages, " +
+                         std::to_string(geometryArena.getLiveMeshCount()) + " meshes").c_str());
+        }
+
+        if (defragmentOnNewMap) {
+            // Memory only moves while nothing is in flight, the retired pages go first so their blocks can empty
+            vkDeviceWaitIdle(logicDevice);
+            deletionQueue.flushAll();
+            uploader.collect();
+            defragStats = {};
+            defragmenter.run(commandBuffer, [this](VkCommandBuffer cmd) { return submitAndWait(cmd); }, &defragStats);
+            LOG(NORMAL, ("Defragmentation moved " + std::to_string(defragStats.bytesMoved / 1024) + " KB in " +
+                         std::to_string(defragStats.allocationsMoved) + " allocations, freed " +
+                         std::to_string(defragStats.bytesFreed / 1024) + " KB in " +
+                         std::to_string(defragStats.ms) + " ms").c_str());
+        }
+        vkFreeCommandBuffers(logicDevice, cmdPool, 1, &commandBuffer);
+
+        // Every variant the map can draw is compiled behind the loading screen, not on first sight
+        auto prewarmStart = std::chrono::steady_clock::now();
+        pipelineRegistry.prewarm(mapRenderModes.data(), static_cast<uint32_t>(mapRenderModes.size()),
+                                 MAP_CULL_MODES.data(), static_cast<uint32_t>(MAP_CULL_MODES.size()), fogEnabled);
+        pipelineRegistry.waitIdle();
+        float prewarmMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                                   prewarmStart).count();
+        LOG(NORMAL, ("Pipelines prewarmed for " + std::to_string(mapRenderModes.size()) + " render modes in " +
+                     std::to_string(prewarmMs) + " ms, " + std::to_string(pipelineRegistry.getPipelineCount()) +
+                     " pipelines").c_str());
+        // Behind the loading screen, the frame path never writes the cache, shutdown saves the rest
+        pipelineCache.saveIfDirty();
+        // The new map's resources are loaded over the next frames
+        heapCheckFrame = frameNumber + HEAP_CHECK_WARMUP_FRAMES;
+    }
+
+    void CRef_Vk::setMapRenderModes(const int *renderModes, int count) {
+        mapRenderModes.clear();
+        for (int i = 0; renderModes && i < count; ++i) {
+            if (renderModes[i] >= 0 && renderModes[i] < RENDER_MODE_COUNT) {
+                mapRenderModes.push_back(static_cast<ERenderMode>(renderModes[i]));
+            }
+        }
+    }
+
+    void CRef_Vk::setFog(bool enable, const float color[3], float density) {
+        fogEnabled = enable;
+        // Without a color only the density changes
+        if (color) {
+            fog = glm::vec4(color[0], color[1], color[2], density);
+        } else {
+            fog.a = density;
+        }
+        // Fog is a shader feature, draws switch to the fogged variants
+        trianglePipeline = CPipelineRegistry::pack(CPipelineRegistry::makeState(RENDER_MODE_NORMAL, VERTEX_FORMAT_COLOR,
+                                                                                VK_CULL_MODE_NONE, fogEnabled));
+    }
+
+    void CRef_Vk::setDefragmentation(bool enable) {
+        defragmentOnNewMap = enable;
+    }
+
+    void CRef_Vk::getDefragStats(TDefragStats *stats) const {
+        *stats = defragStats;
+    }
+
+    bool CRef_Vk::beginFrame(bool clearScene) {
+        assert(!frameActive);
+        TFrameContext &frame = frames[currentFrame];
+        frameHeapAllocations = CHeapCounter::getAllocations();
+
+        // The engine did not call R_WaitForInputSample, still apply the frame limiter
+        if (!framePacer.hasInputSample(frameNumber)) {
+            framePacer.limit();
+            framePacer.markInputSample(frameNumber);
+        }
+
+        // Wait until the GPU has finished the last frame that used this slot,
+        // earlier slots of the ring may still be executing while we record this one
+        graphicsTimeline.wait(frame.timelineValue);
+
+        // Frames complete in submission order, any finished slot tells how far the GPU got
+        for (auto &slot: frames) {
+            if (slot.frameNumber > completedFrameNumber && graphicsTimeline.isComplete(slot.timelineValue)) {
+                completedFrameNumber = slot.frameNumber;
+            }
+        }
+        deletionQueue.flush(completedFrameNumber);
+        uploader.collect();
+        // Lets VMA refresh the heap budgets once per frame
+        vmaSetCurrentFrameIndex(vmaAllocator, static_cast<uint32_t>(frameNumber));
+        geometryArena.collect(completedFrameNumber);
+
+        if (headless) {
+            // Each slot owns its offscreen target
+            currentImageIndex = currentFrame;
+        } else {
+            // Pick up window resizes before the driver reports the swap chain out of date
+            int drawableWidth = 0, drawableHeight = 0;
+            SDL_Vulkan_GetDrawableSize(window, &drawableWidth, &drawableHeight);
+            if (swapChainDirty || drawableWidth != winWidth || drawableHeight != winHeight) {
+                if (!recreateSwapChain()) {
+                    return false;
+                }
+            }
+
+            VkResult result = vkAcquireNextImageKHR(logicDevice, swapChain.swapchain, UINT64_MAX,
+                                                    frame.presentComplete, VK_NULL_HANDLE, &currentImageIndex);
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                // The semaphore was not signaled, rebuild and try once more
+                if (!recreateSwapChain()) {
+                    return false;
+                }
+                result = vkAcquireNextImageKHR(logicDevice, swapChain.swapchain, UINT64_MAX,
+                                               frame.presentComplete, VK_NULL_HANDLE, &currentImageIndex);
+            }
+            if (result == VK_SUBOPTIMAL_KHR) {
+                // Still usable for this frame, rebuild on the next one
+                swapChainDirty = true;
+            } else if (result != VK_SUCCESS) {
+                VK_CHECK_RESULT(result, "Cannot acquire next swap chain image!");
+                return false;
+            }
+            if (!retiredSwapChains.empty() || !retiredSemaphores.empty()) {
+                releaseRetiredSwapChains();
+            }
+        }
+        framePacer.markAcquire(frameNumber);
+
+        // The slot's uniform region is free again, draws append their blocks to it
+        uniformRing.beginFrame(currentFrame);
+        frameShaderData.projection = sceneProjection({static_cast<uint32_t>(winWidth),
+                                                      static_cast<uint32_t>(winHeight)});
+        frameShaderData.view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.5f));
+        frameShaderData.renderColor = glm::vec4(1.0f);
+        frameShaderData.ambientLight = glm::vec4(1.0f);
+        frameShaderData.fog = fog;
+
+        VK_CHECK_RESULT(vkResetCommandBuffer(frame.commandBuffer, 0));
+        VkCommandBufferBeginInfo cmdBufBeginInfo{};
+        cmdBufBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK_RESULT(vkBeginCommandBuffer(frame.commandBuffer, &cmdBufBeginInfo));
+
+        // Submit pending copies and take ownership of everything the transfer queue produced
+        uploader.flush();
+        uploadWaitStage = 0;
+        uploadWaitValue = uploader.acquire(frame.commandBuffer, &uploadWaitStage);
+
+        // The slot's previous queries are complete since its timeline value was reached
+        gpuProfiler.beginFrame(frame.commandBuffer, currentFrame);
+        gpuProfiler.beginScope(frame.commandBuffer, GPU_SCOPE_FRAME);
+
+        // Passes begin in endFrame once their attachments are known, the main view clears depth either way
+        clearMainView = clearScene;
+        // The slot's timeline value was reached, so the worker pools of this slot are free
+        commandRecorder.beginFrame(currentFrame, colorFormat, depthFormat);
+        texturePassCount = 0;
+
+        frameActive = true;
+        return true;
+    }
+
+    void CRef_Vk::setViewportScissor(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+        // Dynamic state is not inherited, every secondary command buffer sets its own
+        VkViewport viewport{};
+        viewport.width = static_cast<float>(extent.width);
+        viewport.height = static_cast<float>(extent.height);
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor{};
+        scissor.extent = extent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
+
+    void CRef_Vk::renderScene() {
+        if (!frameActive) {
+            return;
+        }
+        recordScene(MAIN_VIEW_PASS, {static_cast<uint32_t>(winWidth), static_cast<uint32_t>(winHeight)},
+                    frameShaderData.view, frameShaderData.projection);
+    }
+
+    glm::mat4 CRef_Vk::sceneProjection(VkExtent2D extent) {
+        float aspect = static_cast<float>(extent.width) / static_cast<float>(extent.height);
+        return glm::perspective(glm::radians(60.0f), aspect, 0.1f, 256.0f);
+    }
+
+    int CRef_Vk::uploadMesh(const Vertex *vertices, int vertexCount, const uint32_t *indices, int indexCount) {
+        if (!logicDevice || !vertices || !indices || vertexCount <= 0 || indexCount <= 0) {
+            return INVALID_GEOMETRY;
+        }
+        return static_cast<int>(geometryArena.allocate(vertices, static_cast<uint32_t>(vertexCount), indices,
+                                                       static_cast<uint32_t>(indexCount)));
+    }
+
+    void CRef_Vk::freeMesh(int mesh) {
+        if (!logicDevice || mesh <= 0 || mesh == static_cast<int>(triangleMesh)) {
+            return;
+        }
+        // The current frame may already have drawn it
+        geometryArena.free(static_cast<TGeometryHandle>(mesh), frameNumber);
+    }
+
+    int CRef_Vk::createRenderTexture(int width, int height) {
+        if (!logicDevice || width <= 0 || height <= 0) {
+            return -1;
+        }
+        // A freed slot is reused once no frame can still queue a pass into it or sample it
+        auto found = std::find_if(renderTextures.begin(), renderTextures.end(), [this](const TRenderTexture &texture) {
+            return texture.target.colorImage == VK_NULL_HANDLE && texture.retireFrame <= completedFrameNumber;
+        });
+        if (found == renderTextures.end()) {
+            found = renderTextures.insert(renderTextures.end(), TRenderTexture{});
+        }
+        if (!VulkanAppBase::createRenderTexture(static_cast<uint32_t>(width), static_cast<uint32_t>(height),
+                                                &*found)) {
+            destroyRenderTexture(&*found);
+            return -1;
+        }
+        return static_cast<int>(found - renderTextures.begin());
+    }
+
+    void CRef_Vk::freeRenderTexture(int texture) {
+        if (texture < 0 || texture >= static_cast<int>(renderTextures.size())) {
+            return;
+        }
+        // A pass queued this frame is skipped, frames in flight keep the images until they complete
+        destroyRenderTexture(&renderTextures[texture]);
+    }
+
+    void CRef_Vk::renderSceneToTexture(int texture, const float *view) {
+        if (!frameActive || texture < 0 || texture >= static_cast<int>(renderTextures.size()) ||
+            renderTextures[texture].target.colorImage == VK_NULL_HANDLE) {
+            return;
+        }
+        if (texturePassCount == MAX_TEXTURE_PASSES) {
+            LOG(ERR, "Too many render texture passes in one frame!");
+            return;
+        }
+        texturePasses[texturePassCount++] = texture;
+        // Projected for the texture's own aspect ratio, seen from the main camera unless a view is given
+        VkExtent2D extent = renderTextures[texture].target.extent;
+        recordScene(MAIN_VIEW_PASS + texturePassCount, extent, view ? glm::make_mat4(view) : frameShaderData.view,
+                    sceneProjection(extent));
+    }
+
+    void CRef_Vk::recordScene(uint32_t pass, VkExtent2D extent, const glm::mat4 &view, const glm::mat4 &projection) {
+        // Lives until the frame is recorded, the capture stays small enough for std::function's inline buffer
+        auto *record = frameArena.create<TSceneRecord>();
+        record->extent = extent;
+        record->view = view;
+        record->projection = projection;
+        if (!geometryArena.getRange(triangleMesh, &record->range) || !uploader.isAvailable(record->range.token)) {
+            return;
+        }
+
+        commandRecorder.record(COMMAND_BUCKET_WORLD, [this, record](VkCommandBuffer commandBuffer) {
+            const CGeometryArena::TMeshRange *range = &record->range;
+            // Per-draw block, only the dynamic offset changes between draws
+            TShaderData shaderData = frameShaderData;
+            shaderData.view = record->view;
+            shaderData.projection = record->projection;
+            shaderData.model = glm::mat4(1.0f);
+            uint32_t uniformOffset = uniformRing.push(shaderData);
+            if (uniformOffset == CUniformRing::INVALID_OFFSET) {
+                return;
+            }
+
+            setViewportScissor(commandBuffer, record->extent);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1,
+                                    &uniformDescriptorSet, 1, &uniformOffset);
+            // The fallback until the state's own pipeline has compiled
+            pipelineRegistry.bind(commandBuffer, trianglePipeline);
+            geometryArena.bindPage(commandBuffer, range->page);
+            vkCmdDrawIndexed(commandBuffer, range->indexCount, 1, range->firstIndex, range->vertexOffset, 0);
+        }, pass);
+    }
+
+    bool CRef_Vk::readPixel(int x, int y, unsigned char rgba[4]) {
+        // Only the offscreen targets end the frame in a layout a copy can read
+        if (!logicDevice || !headless || frameActive || !lastFrameSubmitted || !rgba || x < 0 || y < 0 ||
+            x >= winWidth || y >= winHeight) {
+            return false;
+        }
+        TRenderTarget target = getColorTarget(lastImageIndex);
+
+        VkBufferCreateInfo bufferCI{};
+        bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCI.size = 4;
+        bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        allocInfo.pUserData = CMemoryBudget::tag(MEMORY_CATEGORY_STAGING);
+        VkBuffer buffer{};
+        VmaAllocation allocation{};
+        VmaAllocationInfo allocationInfo{};
+        if (!VK_CHECK_RESULT(vmaCreateBuffer(vmaAllocator, &bufferCI, &allocInfo, &buffer, &allocation,
+                                             &allocationInfo), "Cannot create readback buffer!")) {
+            return false;
+        }
+        CMemoryBudget::track(vmaAllocator, allocation);
+
+        VkCommandBuffer commandBuffer{};
+        VkCommandBufferAllocateInfo cmdBufAllocateInfo = genCommandBufferAllocateInfo(cmdPool,
+                                                                                      VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                                                                                      1);
+        bool isSuccess = VK_CHECK_RESULT(vkAllocateCommandBuffers(logicDevice, &cmdBufAllocateInfo, &commandBuffer));
+        if (isSuccess) {
+            VkCommandBufferBeginInfo cmdBufBeginInfo{};
+            cmdBufBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            cmdBufBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufBeginInfo));
+            // The frame's last pass already made its writes visible to transfers
+            VkBufferImageCopy region{};
+            region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            region.imageOffset = {x, y, 0};
+            region.imageExtent = {1, 1, 1};
+            vkCmdCopyImageToBuffer(commandBuffer, target.colorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+                                   &region);
+            VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+            isSuccess = submitAndWait(commandBuffer);
+            vkFreeCommandBuffers(logicDevice, cmdPool, 1, &commandBuffer);
+        }
+        if (isSuccess) {
+            vmaInvalidateAllocation(vmaAllocator, allocation, 0, VK_WHOLE_SIZE);
+            memcpy(rgba, allocationInfo.pMappedData, 4);
+        }
+        CMemoryBudget::untrack(vmaAllocator, allocation);
+        vmaDestroyBuffer(vmaAllocator, buffer, allocation);
+        return isSuccess;
+    }
+
+    void CRef_Vk::endFrame() {
+        if (!frameActive) {
+            return;
+        }
+        TFrameContext &frame = frames[currentFrame];
+
+        // Buckets run in parallel but execute in world, studio, translucent, HUD order
+        commandRecorder.wait();
+        uniformRing.endFrame();
+
+        // Render textures first, the main view may sample them
+        for (uint32_t i = 0; i < texturePassCount; ++i) {
+            const TRenderTarget &target = renderTextures[texturePasses[i]].target;
+            if (target.colorImage == VK_NULL_HANDLE) {
+                // Freed after its pass was queued
+                continue;
+            }
+            beginRendering(frame.commandBuffer, target, true);
+            commandRecorder.execute(frame.commandBuffer, MAIN_VIEW_PASS + 1 + i, COMMAND_BUCKET_WORLD,
+                                    COMMAND_BUCKET_TRANSLUCENT);
+            endRendering(frame.commandBuffer, target, true);
+        }
+
+        // Scene, then the HUD as its own pass over the finished image without the scene's depth
+        TRenderTarget mainTarget = getColorTarget(currentImageIndex);
+        bool hud = commandRecorder.hasRecorded(MAIN_VIEW_PASS, COMMAND_BUCKET_HUD, COMMAND_BUCKET_HUD);
+        // Written once per frame from the primary, the secondaries inherit the statistics query
+        gpuProfiler.beginScope(frame.commandBuffer, GPU_SCOPE_WORLD);
+        beginRendering(frame.commandBuffer, mainTarget, true, clearMainView);
+        commandRecorder.execute(frame.commandBuffer, MAIN_VIEW_PASS, COMMAND_BUCKET_WORLD, COMMAND_BUCKET_TRANSLUCENT);
+        endRendering(frame.commandBuffer, mainTarget, !hud);
+        gpuProfiler.endScope(frame.commandBuffer, GPU_SCOPE_WORLD);
+        if (hud) {
+            gpuProfiler.beginScope(frame.commandBuffer, GPU_SCOPE_2D);
+            beginRendering(frame.commandBuffer, mainTarget, false);
+            commandRecorder.execute(frame.commandBuffer, MAIN_VIEW_PASS, COMMAND_BUCKET_HUD, COMMAND_BUCKET_HUD);
+            endRendering(frame.commandBuffer, mainTarget, true);
+            gpuProfiler.endScope(frame.commandBuffer, GPU_SCOPE_2D);
+        }
+        gpuProfiler.endScope(frame.commandBuffer, GPU_SCOPE_FRAME);
+        VK_CHECK_RESULT(vkEndCommandBuffer(frame.commandBuffer));
+
+        // Wait for the acquired image before writing color, signal the present and the timeline when done
+        std::array<VkSemaphore, 2> signalSemaphores{graphicsTimeline.semaphore, VK_NULL_HANDLE};
+        // The timeline fills in its value on submit, binary semaphores ignore theirs
+        std::array<uint64_t, 2> signalValues{0, 0};
+        uint32_t signalCount = 1;
+        if (!headless) {
+            signalSemaphores[signalCount++] = renderCompleteSemaphores[currentImageIndex];
+        }
+        VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+        timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineSubmitInfo.signalSemaphoreValueCount = signalCount;
+        timelineSubmitInfo.pSignalSemaphoreValues = signalValues.data();
+
+        // Uploads acquired this frame must land before the stages reading them
+        std::array<VkSemaphore, 2> waitSemaphores{};
+        std::array<uint64_t, 2> waitValues{};
+        std::array<VkPipelineStageFlags, 2> waitStageMasks{};
+        uint32_t waitCount = 0;
+        if (!headless) {
+            waitSemaphores[waitCount] = frame.presentComplete;
+            waitStageMasks[waitCount++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        }
+        if (uploadWaitValue != 0) {
+            waitSemaphores[waitCount] = uploader.timeline.semaphore;
+            waitValues[waitCount] = uploadWaitValue;
+            waitStageMasks[waitCount++] = uploadWaitStage;
+        }
+        timelineSubmitInfo.waitSemaphoreValueCount = waitCount;
+        timelineSubmitInfo.pWaitSemaphoreValues = waitValues.data();
+
+        VkSubmitInfo frameSubmitInfo{};
+        frameSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        frameSubmitInfo.pNext = &timelineSubmitInfo;
+        frameSubmitInfo.pWaitDstStageMask = waitStageMasks.data();
+        frameSubmitInfo.waitSemaphoreCount = waitCount;
+        frameSubmitInfo.pWaitSemaphores = waitSemaphores.data();
+        frameSubmitInfo.signalSemaphoreCount = signalCount;
+        frameSubmitInfo.pSignalSemaphores = signalSemaphores.data();
+        frameSubmitInfo.commandBufferCount = 1;
+        frameSubmitInfo.pCommandBuffers = &frame.commandBuffer;
+        // A failed submit keeps the slot's previous value, which is already reached
+        bool submitted = VK_CHECK_RESULT(graphicsTimeline.submit(queue, frameSubmitInfo, &signalValues[0], &queueMutex),
+                                         "Cannot submit frame!");
+        if (submitted) {
+            frame.timelineValue = signalValues[0];
+            lastImageIndex = currentImageIndex;
+            lastFrameSubmitted = true;
+        } else if (!headless) {
+            // The acquire still signals presentComplete. Wait on it with an empty batch so the slot's next
+            // acquire gets an unsignaled semaphore, beginFrame waits for the batch through the timeline.
+            uint64_t consumeValue = 0;
+            VkTimelineSemaphoreSubmitInfo consumeTimelineInfo{};
+            consumeTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            consumeTimelineInfo.signalSemaphoreValueCount = 1;
+            consumeTimelineInfo.pSignalSemaphoreValues = &consumeValue;
+            VkPipelineStageFlags consumeStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            VkSubmitInfo consumeSubmitInfo{};
+            consumeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            consumeSubmitInfo.pNext = &consumeTimelineInfo;
+            consumeSubmitInfo.waitSemaphoreCount = 1;
+            consumeSubmitInfo.pWaitSemaphores = &frame.presentComplete;
+            consumeSubmitInfo.pWaitDstStageMask = &consumeStage;
+            consumeSubmitInfo.signalSemaphoreCount = 1;
+            consumeSubmitInfo.pSignalSemaphores = &graphicsTimeline.semaphore;
+            if (VK_CHECK_RESULT(graphicsTimeline.submit(queue, consumeSubmitInfo, &consumeValue, &queueMutex),
+                                "Cannot consume the acquire semaphore!")) {
+                frame.timelineValue = consumeValue;
+            }
+        }
+
+        if (!headless && submitted) {
+            VkPresentInfoKHR presentInfo{};
+            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            presentInfo.waitSemaphoreCount = 1;
+            presentInfo.pWaitSemaphores = &renderCompleteSemaphores[currentImageIndex];
+            presentInfo.swapchainCount = 1;
+            presentInfo.pSwapchains = &swapChain.swapchain;
+            presentInfo.pImageIndices = &currentImageIndex;
+
+            // Tag the present with the frame number so the pacer can wait for it to be displayed
+            uint64_t presentId = frameNumber;
+            VkPresentIdKHR presentIdInfo{};
+            presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+            presentIdInfo.swapchainCount = 1;
+            presentIdInfo.pPresentIds = &presentId;
+            if (presentWaitSupported) {
+                presentInfo.pNext = &presentIdInfo;
+            }
+
+            VkResult result;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                result = vkQueuePresentKHR(queue, &presentInfo);
+            }
+            if (result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR) {
+                swapChainDirty = true;
+            } else if (result != VK_SUCCESS) {
+                VK_CHECK_RESULT(result, "Cannot present swap chain image!");
+            }
+        }
+
+        framePacer.markPresent(frameNumber);
+
+        // Frame time statistics, the first frame only starts the clock
+        auto now = std::chrono::steady_clock::now();
+        if (lastFrameEnd.time_since_epoch().count() != 0) {
+            float frameMs = std::chrono::duration<float, std::milli>(now - lastFrameEnd).count();
+            frameTimeSumMs += frameMs;
+            frameStats.frameCount++;
+            frameStats.lastFrameMs = frameMs;
+            frameStats.minFrameMs = frameStats.frameCount == 1 ? frameMs : std::min(frameStats.minFrameMs, frameMs);
+            frameStats.maxFrameMs = std::max(frameStats.maxFrameMs, frameMs);
+            frameStats.avgFrameMs = static_cast<float>(frameTimeSumMs / frameStats.frameCount);
+        }
+        frameStats.pendingDestroys = static_cast<unsigned int>(deletionQueue.pendingCount());
+        lastFrameEnd = now;
+
+        // Every recording job finished in wait, nothing references the frame's transient data
+        frameStats.frameArenaBytes = static_cast<unsigned int>(frameArena.getUsedBytes());
+        frameArena.reset();
+
+        // Counted on the render thread only, beginFrame sampled the same thread
+        frameStats.heapAllocations = static_cast<unsigned int>(CHeapCounter::getAllocations() - frameHeapAllocations);
+        if (CHeapCounter::isEnabled() && frameStats.heapAllocations != 0 &&
+            frameNumber >= std::max(heapCheckFrame, swapChainFirstFrame + HEAP_CHECK_WARMUP_FRAMES)) {
+            LOG(ERR, ("Frame " + std::to_string(frameNumber) + " made " + std::to_string(frameStats.heapAllocations) +
+                      " heap allocations").c_str());
+            assert(frameStats.heapAllocations == 0);
+        }
+
+        // Move to the next slot, the CPU starts recording it while the GPU works on this one
+        frame.frameNumber = frameNumber++;
+        framesInFlight = requestedFramesInFlight;
+        currentFrame = (currentFrame + 1) % framesInFlight;
+        frameActive = false;
+    }
+
     void CRef_Vk::createCommandBuffers() {
         VkCommandPoolCreateInfo commandPoolCI{};
         commandPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        commandPoolCI.queueFamilyIndex = swapChain.queueNodeIndex;
+        commandPoolCI.queueFamilyIndex = device->queueFamilyIndices.graphics;
         commandPoolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
         VK_CHECK_RESULT(vkCreateCommandPool(logicDevice, &commandPoolCI, nullptr, &commandPool));
 
+        std::array<VkCommandBuffer, MAX_CONCURRENT_FRAMES> commandBuffers{};
         VkCommandBufferAllocateInfo cmdBufAllocateInfo = genCommandBufferAllocateInfo(commandPool,
                                                                                       VK_COMMAND_BUFFER_LEVEL_PRIMARY,
                                                                                       MAX_CONCURRENT_FRAMES);
         VK_CHECK_RESULT(vkAllocateCommandBuffers(logicDevice, &cmdBufAllocateInfo, commandBuffers.data()));
+        for (int i = 0; i < MAX_CONCURRENT_FRAMES; ++i) {
+            frames[i].commandBuffer = commandBuffers[i];
+        }
     }
 
     void CRef_Vk::createUniformBuffers() {
-
-        VmaAllocationCreateInfo allocInfo{};
-        allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
-
-        VkBufferCreateInfo bufferCI{};
-        bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferCI.size = sizeof(TShaderData);
-        // This buffer type is The Uniform buffer
-        bufferCI.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-
-        for (int i = 0; i < MAX_CONCURRENT_FRAMES; ++i) {
-            VK_CHECK_RESULT(vmaCreateBuffer(vmaAllocator, &bufferCI, &allocInfo, &uniformBuffers[i].buffer,
-                                            &uniformBuffers[i].allocation,
-                                            nullptr),
-                            "Cannot create Uniform buffer!");
-            VK_CHECK_RESULT(
-                    vmaMapMemory(vmaAllocator, uniformBuffers[i].allocation, (void **) &uniformBuffers[i].mapped),
-                    "Cannot map Uniform buffer!");
-        }
+        // Room for every per-draw block of one frame, dynamic offsets must respect the device alignment
+        uniformRing.create(vmaAllocator, device->properties.limits.minUniformBufferOffsetAlignment,
+                           MAX_CONCURRENT_FRAMES, UNIFORM_RING_SLOT_SIZE);
 
         return;
     }
 
     void CRef_Vk::createDescriptorSetLayout() {
 
-        // Binding 0: Uniform buffer (Vertex shader)
+        // Binding 0: Per-draw uniform block (Vertex shader), offset given at bind time
         VkDescriptorSetLayoutBinding layoutBinding{};
-        layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         layoutBinding.descriptorCount = 1;
         layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
         layoutBinding.pImmutableSamplers = nullptr;
@@ -313,15 +1102,15 @@ namespace REF_VK {
 
     void CRef_Vk::createDescriptorPool() {
         VkDescriptorPoolSize descriptorPoolSize[1]{};
-        descriptorPoolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorPoolSize[0].descriptorCount = MAX_CONCURRENT_FRAMES;
+        descriptorPoolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        descriptorPoolSize[0].descriptorCount = 1;
 
         VkDescriptorPoolCreateInfo descriptorPoolCI{};
         descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         descriptorPoolCI.pNext = nullptr;
         descriptorPoolCI.poolSizeCount = 1;
         descriptorPoolCI.pPoolSizes = descriptorPoolSize;
-        descriptorPoolCI.maxSets = MAX_CONCURRENT_FRAMES;
+        descriptorPoolCI.maxSets = 1;
 
         VK_CHECK_RESULT(vkCreateDescriptorPool(logicDevice, &descriptorPoolCI, nullptr, &descriptorPool),
                         "Cannot create descriptor pool!");
@@ -330,178 +1119,46 @@ namespace REF_VK {
     }
 
     void CRef_Vk::createDescriptorSets() {
-        // Allocate one descriptor set per frame from the global descriptor pool
-        for (int i = 0; i < MAX_CONCURRENT_FRAMES; ++i) {
-            VkDescriptorSetAllocateInfo allocateInfo{};
-            allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocateInfo.descriptorPool = descriptorPool;
-            allocateInfo.descriptorSetCount = 1;
-            allocateInfo.pSetLayouts = &descriptorSetLayout;
-            VK_CHECK_RESULT(vkAllocateDescriptorSets(logicDevice, &allocateInfo, &uniformBuffers[i].descriptorSet));
-
-            // Update the descriptor set determining the shader binding points
-            VkWriteDescriptorSet writeDescriptorSet{};
-
-            // The buffers information is passed using a descriptor info structure
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = uniformBuffers[i].buffer;
-            bufferInfo.range = sizeof(TShaderData);
-
-            // Binding 0 : Uniform buffer
-            writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            writeDescriptorSet.dstSet = uniformBuffers[i].descriptorSet;
-            writeDescriptorSet.descriptorCount = 1;
-            writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            writeDescriptorSet.pBufferInfo = &bufferInfo;
-            writeDescriptorSet.dstBinding = 0;
-            vkUpdateDescriptorSets(logicDevice, 1, &writeDescriptorSet, 0, nullptr);
-
-            return;
-        }
+        // A single set for all frames, the frame slot is part of the dynamic offset
+        VkDescriptorSetAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocateInfo.descriptorPool = descriptorPool;
+        allocateInfo.descriptorSetCount = 1;
+        allocateInfo.pSetLayouts = &descriptorSetLayout;
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(logicDevice, &allocateInfo, &uniformDescriptorSet));
+
+        // Update the descriptor set determining the shader binding points
+        VkWriteDescriptorSet writeDescriptorSet{};
+
+        // The range is one draw's block, the dynamic offset selects which one
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = uniformRing.getBuffer();
+        bufferInfo.range = sizeof(TShaderData);
+
+        // Binding 0 : Uniform buffer
+        writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writeDescriptorSet.dstSet = uniformDescriptorSet;
+        writeDescriptorSet.descriptorCount = 1;
+        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        writeDescriptorSet.pBufferInfo = &bufferInfo;
+        writeDescriptorSet.dstBinding = 0;
+        vkUpdateDescriptorSets(logicDevice, 1, &writeDescriptorSet, 0, nullptr);
 
+        return;
     }
 
     void CRef_Vk::createPipelines() {
-        // ============ Create the graphics pipeline ============
-
-        VkGraphicsPipelineCreateInfo graphicsPipelineCI{};
-        graphicsPipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        graphicsPipelineCI.layout = pipelineLayout;
-        graphicsPipelineCI.renderPass = renderPass;
-
-        // Used triangle mode assembled data
-        VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCI{};
-        inputAssemblyStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssemblyStateCI.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-        // Rasterization state
-        VkPipelineRasterizationStateCreateInfo rasterizationStateCI{};
-        rasterizationStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizationStateCI.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
-        rasterizationStateCI.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-        rasterizationStateCI.depthClampEnable = VK_FALSE;
-        rasterizationStateCI.rasterizerDiscardEnable = VK_FALSE;
-        rasterizationStateCI.depthBiasEnable = VK_FALSE;
-        rasterizationStateCI.lineWidth = 1.0f;
-
-        // Color blend state describes how blend factors ar e calculated;
-        VkPipelineColorBlendAttachmentState blendAttachmentState{};
-        blendAttachmentState.colorWriteMask = 0xf;
-        blendAttachmentState.blendEnable = VK_FALSE;
-        VkPipelineColorBlendStateCreateInfo colorBlendStateCI{};
-        colorBlendStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlendStateCI.attachmentCount = 1;
-        colorBlendStateCI.pAttachments = &blendAttachmentState;
-
-        // Viewport state sets the number of viewports and scissor used in this pipeline
-        VkPipelineViewportStateCreateInfo viewportStateCI{};
-        viewportStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportStateCI.viewportCount = 1;
-        viewportStateCI.scissorCount = 1;
-
-        // Enable dynamic states
-        std::vector<VkDynamicState> dynamicStateEnables{};
-        dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);
-        dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);
-        VkPipelineDynamicStateCreateInfo dynamicStateCI{};
-        dynamicStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-        dynamicStateCI.pDynamicStates = dynamicStateEnables.data();
-        dynamicStateCI.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
-
-        // Depth and stencil state containing depth and stencil compare and test operations
-        VkPipelineDepthStencilStateCreateInfo depthStencilStateCI{};
-        depthStencilStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-        depthStencilStateCI.depthTestEnable = VK_TRUE;
-        depthStencilStateCI.depthWriteEnable = VK_TRUE;
-        depthStencilStateCI.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-        depthStencilStateCI.depthBoundsTestEnable = VK_FALSE;
-        depthStencilStateCI.back.failOp = VK_STENCIL_OP_KEEP;
-        depthStencilStateCI.back.passOp = VK_STENCIL_OP_KEEP;
-        depthStencilStateCI.back.compareOp = VK_COMPARE_OP_ALWAYS;
-        depthStencilStateCI.stencilTestEnable = VK_FALSE;
-        depthStencilStateCI.front = depthStencilStateCI.back;
-
-        // Multi sampling state
-        VkPipelineMultisampleStateCreateInfo multisampleStateCreateInfo{};
-        multisampleStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampleStateCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-        multisampleStateCreateInfo.pSampleMask = nullptr;
-
-        // Vertex input descriptions
-
-        // Vertex input binding
-        VkVertexInputBindingDescription vertexInputBindingDescription{};
-        vertexInputBindingDescription.binding = 0;
-        vertexInputBindingDescription.stride = sizeof(Vertex);
-        vertexInputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-        // Input attribute bindings describe shader attribute locations and memory layouts
-        std::array<VkVertexInputAttributeDescription, 2> vertexInputAttributes{};
-        // Example
-        //	layout (location = 0) in vec3 inPos;
-        //	layout (location = 1) in vec3 inColor;
-
-        // Attribute location 0 : Position
-        vertexInputAttributes[0].binding = 0;
-        vertexInputAttributes[0].location = 0;
-        vertexInputAttributes[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-        vertexInputAttributes[0].offset = offsetof(Vertex, position);
-        // Attribute location 1 : Color
-        vertexInputAttributes[1].binding = 0;
-        vertexInputAttributes[1].location = 1;
-        vertexInputAttributes[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-        vertexInputAttributes[1].offset = offsetof(Vertex, color);
-
-        // Vertex input state used for pipeline creation
-        VkPipelineVertexInputStateCreateInfo vertexInputStateCI{};
-        vertexInputStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputStateCI.vertexBindingDescriptionCount = 1;
-        vertexInputStateCI.pVertexBindingDescriptions = &vertexInputBindingDescription;
-        vertexInputStateCI.vertexAttributeDescriptionCount = 2;
-        vertexInputStateCI.pVertexAttributeDescriptions = vertexInputAttributes.data();
-
-        // Shaders
-        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
-
-        // Vertex Shader
-        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-        shaderStages[0].module = loadSPIRVShader(logicDevice,
-                                                 getBasedAssetsPath() + "/shaders/triangle/triangle.vert.spv");
-        shaderStages[0].pName = "main";
-        assert(shaderStages[0].module != VK_NULL_HANDLE);
-
-        // Fragment Shader
-        shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        shaderStages[1].module = loadSPIRVShader(logicDevice,
-                                                 getBasedAssetsPath() + "/shaders/triangle/triangle.frag.spv");
-        shaderStages[1].pName = "main";
-        assert(shaderStages[1].module != VK_NULL_HANDLE);
-
-        // Set pipeline shader stage info
-        graphicsPipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
-        graphicsPipelineCI.pStages = shaderStages.data();
-
-        // Set pipeline states info
-        graphicsPipelineCI.pVertexInputState = &vertexInputStateCI;
-        graphicsPipelineCI.pInputAssemblyState = &inputAssemblyStateCI;
-        graphicsPipelineCI.pRasterizationState = &rasterizationStateCI;
-        graphicsPipelineCI.pColorBlendState = &colorBlendStateCI;
-        graphicsPipelineCI.pMultisampleState = &multisampleStateCreateInfo;
-        graphicsPipelineCI.pViewportState = &viewportStateCI;
-        graphicsPipelineCI.pDepthStencilState = &depthStencilStateCI;
-        graphicsPipelineCI.pDynamicState = &dynamicStateCI;
-
-        // Create rendering pipeline
-        VK_CHECK_RESULT(
-                vkCreateGraphicsPipelines(logicDevice, pipelineCache, 1, &graphicsPipelineCI, nullptr, &pipeline),
-                "Cannot create graphics pipeline!");
-
-        // Destroy shader modules
-        vkDestroyShaderModule(logicDevice, shaderStages[0].module, nullptr);
-        vkDestroyShaderModule(logicDevice, shaderStages[1].module, nullptr);
+        // States are built by the registry, the shader modules stay alive with it
+        pipelineRegistry.create(logicDevice, &pipelineCache, pipelineLayout, colorFormat, depthFormat,
+                                PIPELINE_COMPILE_THREADS, pipelineLibrarySupported);
+
+        VkShaderModule vertexShader = loadShader("shaders/triangle/triangle.vert");
+        VkShaderModule fragmentShader = loadShader("shaders/triangle/triangle.frag");
+        assert(vertexShader != VK_NULL_HANDLE && fragmentShader != VK_NULL_HANDLE);
+        pipelineRegistry.setShaders(VERTEX_FORMAT_COLOR, vertexShader, fragmentShader);
+
+        trianglePipeline = CPipelineRegistry::pack(CPipelineRegistry::makeState(RENDER_MODE_NORMAL, VERTEX_FORMAT_COLOR,
+                                                                                VK_CULL_MODE_NONE, fogEnabled));
 
         return;
     }
@@ -510,9 +1167,10 @@ namespace REF_VK {
 }
 
 REF_VK::qboolean R_Init(void) {
-    REF_VK::qboolean result = REF_VK::ref_vk_obj.init();
-    result = REF_VK::ref_vk_obj.prepare();
-    return result;
+    if (!REF_VK::ref_vk_obj.init()) {
+        return false;
+    }
+    return REF_VK::ref_vk_obj.prepare();
 }
 
 void R_Shutdown(void) {
@@ -522,3 +1180,129 @@ void R_Shutdown(void) {
 const char *R_GetConfigName(void) {
     return "vulkan";
 }
+
+void R_SetHeadless(REF_VK::qboolean enable, int width, int height) {
+    REF_VK::ref_vk_obj.setHeadless(enable, width, height);
+}
+
+REF_VK::qboolean R_MountPath(const char *path) {
+    return REF_VK::ref_vk_obj.mountPath(path);
+}
+
+void R_GetFrameStats(REF_VK::TFrameStats *stats) {
+    REF_VK::ref_vk_obj.getFrameStats(stats);
+}
+
+REF_VK::qboolean R_GetGpuScopeStats(int scope, REF_VK::TGpuScopeStats *stats) {
+    return REF_VK::ref_vk_obj.getGpuScopeStats(scope, stats);
+}
+
+REF_VK::qboolean R_SpeedsMessage(char *out, size_t size) {
+    return REF_VK::ref_vk_obj.speedsMessage(out, size);
+}
+
+void R_SetPresentConfig(const REF_VK::TPresentConfig *config) {
+    if (config) {
+        REF_VK::ref_vk_obj.setPresentConfig(*config);
+    }
+}
+
+void R_WaitForInputSample(void) {
+    REF_VK::ref_vk_obj.waitForInputSample();
+}
+
+void R_GetLatencyStats(REF_VK::TLatencyStats *stats) {
+    REF_VK::ref_vk_obj.getLatencyStats(stats);
+}
+
+void R_GetUploadStats(REF_VK::TUploadStats *stats) {
+    REF_VK::ref_vk_obj.getUploadStats(stats);
+}
+
+void R_GetPipelineCacheStats(REF_VK::TPipelineCacheStats *stats) {
+    REF_VK::ref_vk_obj.getPipelineCacheStats(stats);
+}
+
+void R_BenchmarkPipelines(REF_VK::TPipelineBuildStats *stats) {
+    REF_VK::ref_vk_obj.benchmarkPipelines(stats);
+}
+
+int R_GetMemoryHeapCount(void) {
+    return REF_VK::ref_vk_obj.getMemoryHeapCount();
+}
+
+REF_VK::qboolean R_GetMemoryHeapStats(int heap, REF_VK::TMemoryHeapStats *stats) {
+    return REF_VK::ref_vk_obj.getMemoryHeapStats(heap, stats);
+}
+
+REF_VK::qboolean R_GetMemoryCategoryStats(int category, REF_VK::TMemoryCategoryStats *stats) {
+    return REF_VK::ref_vk_obj.getMemoryCategoryStats(category, stats);
+}
+
+REF_VK::qboolean R_MemoryReport(char *out, size_t size) {
+    return REF_VK::ref_vk_obj.memoryReport(out, size);
+}
+
+REF_VK::qboolean R_DumpMemoryJson(const char *path) {
+    return REF_VK::ref_vk_obj.dumpMemoryJson(path);
+}
+
+void R_SetFramesInFlight(int count) {
+    REF_VK::ref_vk_obj.setFramesInFlight(static_cast<uint32_t>(std::max(count, 0)));
+}
+
+void R_SetMapRenderModes(const int *renderModes, int count) {
+    REF_VK::ref_vk_obj.setMapRenderModes(renderModes, count);
+}
+
+void R_SetFog(REF_VK::qboolean enable, const float color[3], float density) {
+    REF_VK::ref_vk_obj.setFog(enable, color, density);
+}
+
+void R_NewMap(void) {
+    REF_VK::ref_vk_obj.newMap();
+}
+
+int R_UploadMesh(const REF_VK::Vertex *vertices, int vertexCount, const unsigned int *indices, int indexCount) {
+    return REF_VK::ref_vk_obj.uploadMesh(vertices, vertexCount, indices, indexCount);
+}
+
+void R_FreeMesh(int mesh) {
+    REF_VK::ref_vk_obj.freeMesh(mesh);
+}
+
+void R_SetDefragmentation(REF_VK::qboolean enable) {
+    REF_VK::ref_vk_obj.setDefragmentation(enable);
+}
+
+void R_GetDefragStats(REF_VK::TDefragStats *stats) {
+    REF_VK::ref_vk_obj.getDefragStats(stats);
+}
+
+void R_BeginFrame(REF_VK::qboolean clearScene) {
+    REF_VK::ref_vk_obj.beginFrame(clearScene);
+}
+
+void R_RenderScene(void) {
+    REF_VK::ref_vk_obj.renderScene();
+}
+
+int R_CreateRenderTexture(int width, int height) {
+    return REF_VK::ref_vk_obj.createRenderTexture(width, height);
+}
+
+void R_FreeRenderTexture(int texture) {
+    REF_VK::ref_vk_obj.freeRenderTexture(texture);
+}
+
+void R_RenderSceneToTexture(int texture, const float view[16]) {
+    REF_VK::ref_vk_obj.renderSceneToTexture(texture, view);
+}
+
+void R_EndFrame(void) {
+    REF_VK::ref_vk_obj.endFrame();
+}
+
+REF_VK::qboolean R_ReadPixel(int x, int y, unsigned char rgba[4]) {
+    return REF_VK::ref_vk_obj.readPixel(x, y, rgba);
+}
@@ -0,0 +1,114 @@
+#include <common/CJobSystem.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Job system scaling from one thread to every core, on a particle update and a sphere cull
+const uint32_t BENCH_PARTICLES = 1 << 20;
+const uint32_t BENCH_BATCH = 1024;
+const int BENCH_ITERATIONS = 20;
+
+struct SParticle {
+    float origin[3];
+    float velocity[3];
+    float radius;
+    int visible;
+};
+
+static void updateParticles(std::vector<SParticle> &particles, uint32_t begin, uint32_t end) {
+    const float frameTime = 1.0f / 60.0f;
+    // Planes of a 90 degree frustum looking down +x
+    const float planes[4][4] = {
+            {0.7071f,  0.7071f,  0.0f,     0.0f},
+            {0.7071f,  -0.7071f, 0.0f,     0.0f},
+            {0.7071f,  0.0f,     0.7071f,  0.0f},
+            {0.7071f,  0.0f,     -0.7071f, 0.0f},
+    };
+
+    for (uint32_t i = begin; i < end; ++i) {
+        SParticle &p = particles[i];
+        p.velocity[2] -= 800.0f * frameTime;
+        for (int axis = 0; axis < 3; ++axis) {
+            p.origin[axis] += p.velocity[axis] * frameTime;
+        }
+        p.visible = 1;
+        for (const auto &plane: planes) {
+            float distance = plane[0] * p.origin[0] + plane[1] * p.origin[1] + plane[2] * p.origin[2] - plane[3];
+            if (distance < -p.radius) {
+                p.visible = 0;
+                break;
+            }
+        }
+        // Some extra arithmetic so the loop is not purely memory bound
+        p.radius = std::sqrt(p.radius * p.radius + 0.001f);
+    }
+}
+
+static void resetParticles(std::vector<SParticle> &particles) {
+    for (uint32_t i = 0; i < particles.size(); ++i) {
+        SParticle &p = particles[i];
+        p.origin[0] = static_cast<float>(i % 1000) - 500.0f;
+        p.origin[1] = static_cast<float>((i / 1000) % 1000) - 500.0f;
+        p.origin[2] = static_cast<float>(i % 97);
+        p.velocity[0] = 10.0f;
+        p.velocity[1] = -5.0f;
+        p.velocity[2] = 100.0f;
+        p.radius = 1.0f;
+        p.visible = 0;
+    }
+}
+
+static uint64_t countVisible(const std::vector<SParticle> &particles) {
+    uint64_t visible = 0;
+    for (const auto &p: particles) {
+        visible += p.visible;
+    }
+    return visible;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<SParticle> particles(BENCH_PARTICLES);
+
+    // Single threaded reference
+    resetParticles(particles);
+    for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+        updateParticles(particles, 0, BENCH_PARTICLES);
+    }
+    uint64_t expected = countVisible(particles);
+
+    // Optional thread count limit, defaults to every core
+    uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (argc > 1) {
+        maxThreads = static_cast<uint32_t>(std::max(std::atoi(argv[1]), 1));
+    }
+    double baseMs = 0.0;
+    bool success = true;
+    for (uint32_t threadCount = 1; threadCount <= maxThreads; ++threadCount) {
+        REF_VK::CJobSystem jobSystem{};
+        jobSystem.create(threadCount - 1);
+        resetParticles(particles);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+            jobSystem.parallelFor(BENCH_PARTICLES, BENCH_BATCH, [&particles](uint32_t begin, uint32_t end) {
+                updateParticles(particles, begin, end);
+            });
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        jobSystem.destroy();
+
+        if (threadCount == 1) {
+            baseMs = ms;
+        }
+        uint64_t visible = countVisible(particles);
+        std::cout << "threads: " << threadCount
+                  << " time: " << ms / BENCH_ITERATIONS << " ms"
+                  << " speedup: " << baseMs / ms
+                  << (visible == expected ? "" : " MISMATCH") << "\n";
+        success = success && visible == expected;
+    }
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+#include <ref_vk.h>
+#include <iostream>
+
+// Full pipeline compiles against graphics pipeline library links, headless so it runs on lavapipe
+const int BENCH_WIDTH = 64, BENCH_HEIGHT = 64;
+
+static float perPipeline(float ms, unsigned int count) {
+    return count ? ms / static_cast<float>(count) : 0.0f;
+}
+
+int main(int argc, char *argv[]) {
+
+    R_SetHeadless(true, BENCH_WIDTH, BENCH_HEIGHT);
+    if (!R_Init()) {
+        std::cerr << "R_Init failed\n";
+        return 1;
+    }
+
+    REF_VK::TPipelineBuildStats stats{};
+    R_BenchmarkPipelines(&stats);
+    std::cout << "monolithic: " << stats.monolithicPipelines << " pipelines " << stats.monolithicMs << " ms"
+              << " (" << perPipeline(stats.monolithicMs, stats.monolithicPipelines) << " ms each)\n";
+    if (stats.pipelineLibrary) {
+        std::cout << "libraries: " << stats.libraries << " parts " << stats.libraryMs << " ms"
+                  << " (" << perPipeline(stats.libraryMs, stats.libraries) << " ms each)\n"
+                  << "linked: " << stats.linkedPipelines << " pipelines " << stats.linkMs << " ms"
+                  << " (" << perPipeline(stats.linkMs, stats.linkedPipelines) << " ms each)\n";
+    } else {
+        std::cout << "graphics pipeline library not supported, monolithic only\n";
+    }
+    // Only the Vulkan pipeline cache is bypassed, run with MESA_SHADER_CACHE_DISABLE=true or similar for cold numbers
+    std::cout << "note: libraries are built first, driver shader caches can only speed up the monolithic builds\n";
+
+    R_Shutdown();
+
+    if (stats.monolithicPipelines == 0) {
+        return 1;
+    }
+    return !stats.pipelineLibrary || stats.linkedPipelines > 0 ? 0 : 1;
+}
@@ -9,7 +9,9 @@ void init() {
 }
 
 void update() {
-
+    R_BeginFrame(true);
+    R_RenderScene();
+    R_EndFrame();
 }
 
 void destroy() {
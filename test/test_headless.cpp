@@ -0,0 +1,99 @@
+#include <ref_vk.h>
+#include <iostream>
+#include <algorithm>
+
+// Renders a fixed number of frames without a window, usable on a software ICD such as lavapipe
+const int HEADLESS_WIDTH = 640, HEADLESS_HEIGHT = 480;
+const unsigned int HEADLESS_FRAMES = 300;
+// Mirror sized render texture drawn before the main view every frame
+const int HEADLESS_TEXTURE_SIZE = 128;
+// Render textures only ever queue a handful of objects, anything above means the queue is not draining
+const unsigned int MAX_PENDING_DESTROYS = 64;
+// Frame whose render texture is freed and recreated, exercising delayed slot reuse
+const unsigned int HEADLESS_RECREATE_FRAME = 100;
+
+int main(int argc, char *argv[]) {
+
+    R_SetHeadless(true, HEADLESS_WIDTH, HEADLESS_HEIGHT);
+    R_SetFramesInFlight(2);
+    if (!R_Init()) {
+        std::cerr << "R_Init failed\n";
+        return 1;
+    }
+
+    int texture = R_CreateRenderTexture(HEADLESS_TEXTURE_SIZE, HEADLESS_TEXTURE_SIZE);
+    if (texture < 0) {
+        std::cerr << "R_CreateRenderTexture failed\n";
+        R_Shutdown();
+        return 1;
+    }
+
+    unsigned int maxPendingDestroys = 0;
+    REF_VK::TFrameStats stats{};
+    for (unsigned int i = 0; i < HEADLESS_FRAMES; ++i) {
+        R_BeginFrame(true);
+        if (i == HEADLESS_RECREATE_FRAME) {
+            R_FreeRenderTexture(texture);
+            texture = R_CreateRenderTexture(HEADLESS_TEXTURE_SIZE, HEADLESS_TEXTURE_SIZE);
+        }
+        R_RenderSceneToTexture(texture, nullptr);
+        R_RenderScene();
+        R_EndFrame();
+        R_GetFrameStats(&stats);
+        maxPendingDestroys = std::max(maxPendingDestroys, stats.pendingDestroys);
+    }
+    std::cout << "frames: " << stats.frameCount
+              << " min: " << stats.minFrameMs << " ms"
+              << " avg: " << stats.avgFrameMs << " ms"
+              << " max: " << stats.maxFrameMs << " ms"
+              << " pending destroys: " << stats.pendingDestroys
+              << " frame arena: " << stats.frameArenaBytes << " bytes"
+              << " heap allocations: " << stats.heapAllocations << "\n";
+
+    // The triangle covers the middle of the view, the corners keep the clear color
+    unsigned char corner[4]{}, center[4]{};
+    bool readBack = R_ReadPixel(0, 0, corner) && R_ReadPixel(HEADLESS_WIDTH / 2, HEADLESS_HEIGHT / 2, center);
+    std::cout << "corner: " << int(corner[0]) << " " << int(corner[1]) << " " << int(corner[2]) << " "
+              << int(corner[3]) << " center: " << int(center[0]) << " " << int(center[1]) << " "
+              << int(center[2]) << " " << int(center[3]) << "\n";
+
+    char speeds[1024]{};
+    if (R_SpeedsMessage(speeds, sizeof(speeds))) {
+        std::cout << speeds;
+    }
+
+    R_FreeRenderTexture(texture);
+    R_Shutdown();
+    REF_VK::TFrameStats shutdownStats{};
+    R_GetFrameStats(&shutdownStats);
+
+    bool passed = true;
+    // The first frame only starts the clock
+    if (stats.frameCount != HEADLESS_FRAMES - 1) {
+        std::cerr << "Expected " << HEADLESS_FRAMES - 1 << " timed frames, got " << stats.frameCount << "\n";
+        passed = false;
+    }
+    if (texture < 0) {
+        std::cerr << "Recreating the render texture failed\n";
+        passed = false;
+    }
+    if (!readBack) {
+        std::cerr << "R_ReadPixel failed\n";
+        passed = false;
+    } else if (corner[0] != 0 || corner[1] != 0 || corner[2] != 0 || corner[3] != 255) {
+        std::cerr << "Corner pixel is not the clear color\n";
+        passed = false;
+    } else if (center[0] == 0 && center[1] == 0 && center[2] == 0) {
+        std::cerr << "Center pixel was not drawn\n";
+        passed = false;
+    }
+    if (maxPendingDestroys > MAX_PENDING_DESTROYS) {
+        std::cerr << "Deletion queue grew to " << maxPendingDestroys << " objects\n";
+        passed = false;
+    }
+    if (shutdownStats.pendingDestroys != 0) {
+        std::cerr << shutdownStats.pendingDestroys << " objects left in the deletion queue after shutdown\n";
+        passed = false;
+    }
+    return passed ? 0 : 1;
+}